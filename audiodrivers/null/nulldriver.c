@@ -0,0 +1,24 @@
+// null audio driver for st3play (no audio device, musmixer() is called by the program itself)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../dig.h"
+
+void lockMixer(void)
+{
+}
+
+void unlockMixer(void)
+{
+}
+
+bool openMixer(int32_t mixingFrequency, int32_t mixingBufferSize)
+{
+	return true;
+	(void)mixingFrequency;
+	(void)mixingBufferSize;
+}
+
+void closeMixer(void)
+{
+}
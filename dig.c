@@ -28,12 +28,31 @@
 #include "digdata.h"
 #include "dig_gus.h"
 #include "digadl.h"
+#include "digamg.h"
+#include "digevent.h"
 #include "mixer/gus_gf1.h"
+#include "mixer/loudness.h"
+#include "mixer/tap.h"
 #include "mixer/sbpro.h"
+#include "mixer/sinc.h"
+#include "mixer/stem.h"
+#include "mixer/worker.h"
 #include "opl2/opl2.h"
 
 static uint32_t randSeed;
+static int32_t mixbuffersize; // 8bb: for getplayermemusage()
+#ifndef ST3_NO_ADLIB
+static bool adlibThreadFlag;
+static int32_t oplJobSamples;
+static mixsmp_t *oplBuffer; // 8bb: OPL2 output from the helper thread, see setAdLibThread()
+#endif
+static uint32_t channelMuteMask; // 8bb: bit n = ST3 channel n, shared with the control thread (see setChannelMuteMask())
+static bool loudnessFlag; // 8bb: see setLoudnessAnalysis()
+#ifdef ST3_FIXEDPOINT
+static int32_t prngStateL, prngStateR;
+#else
 static float fPrngStateL, fPrngStateR;
+#endif
 
 bool WAVRender_Flag; // global
 
@@ -115,7 +134,7 @@ void loadheaderpans(void) // pannings
 	for (int32_t i = 0; i < 32; i++, c++)
 	{
 		if (song.defaultpan[i] & 32)
-			c->apanpos = 0xF0 | (song.defaultpan[i] & 0xF); // 8bb: the 0xF0 part means that this channel has a pan set
+			setvoicepan(c, 0xF0 | (song.defaultpan[i] & 0xF)); // 8bb: the 0xF0 part means that this channel has a pan set
 	}
 }
 
@@ -134,22 +153,32 @@ void shutupsounds(void)
 	lockMixer();
 
 	memset(song._zchn, 0, sizeof (song._zchn));
+	memset(song._zvoice, 0, sizeof (song._zvoice));
 
 	zchn_t *ch = song._zchn;
 	for (int8_t i = 0; i < ACHANNELS; i++, ch++)
 	{
 		ch->channelnum = i;
+		ch->v = &song._zvoice[i];
 		ch->achannelused = 128;
-		ch->aguschannel = -1;
+		ch->v->aguschannel = -1;
 		ch->lastadlins = 101;
-		ch->m_oldvol = 255; // 8bb: from shutupsounds2() (GUS), but let's put it here
-		ch->m_oldpos = 0xFFFFFFFF; // 8bb: added this (also for GUS)
+		ch->v->m_oldvol = 255; // 8bb: from shutupsounds2() (GUS), but let's put it here
 	}
+	resetmixvoices(); // 8bb: the same for the mixer side (digevent.c)
 
 	song.lastachannelused = 1;
 
+	song.usedmask = song.dirtymask = ALLCHANNELS_MASK; // 8bb: achannelused=128
+	song.cellmask = ALLCHANNELS_MASK; // 8bb: the memset above didn't clear to the clearnotes() values
+	song.cmdmask = 0;
+	song.lazywaitmask = 0;
+	song.numtickcmds = 0;
+
+#ifndef ST3_NO_GUS
 	if (audio.soundcardtype == SOUNDCARD_GUS)
 		gcmd_inittables();
+#endif
 
 	unlockMixer();
 }
@@ -172,30 +201,39 @@ static void initmodule(void)
 
 void updateregs(void) // adlib/gravis
 {
-	zchn_t *ch = song._zchn;
-	for (int32_t i = 0; i < ACHANNELS; i++, ch++)
+	// 8bb: only clear bit 7 where it's set
+	uint64_t mask = song.dirtymask;
+	while (mask != 0)
 	{
-		ch->achannelused &= 127;
+		zchn_t *ch = &song._zchn[lowestbit64(mask)];
+		mask &= mask - 1;
 
-		if (audio.soundcardtype == SOUNDCARD_GUS)
-			gcmd_update(ch); // 8bb: update GUS registers (dig_gus.c)
+		ch->achannelused &= 127;
+		if (ch->achannelused == 0)
+			song.usedmask &= ~CHANNEL_BIT(ch);
 	}
+	song.dirtymask = 0;
 
-	if (audio.soundcardtype == SOUNDCARD_GUS)
-		gcmd_update(NULL); // 8bb: trigger GUS voices (dig_gus.c)
+	if (song.lazywaitmask != 0)
+		updatelazyvoices(); // 8bb: digamg.c
+
+	// 8bb: the GUS registers are updated in applytickevents() (digevent.c)
 
+#ifndef ST3_NO_ADLIB
 	if (song.adlibused)
 		updateadlib();
+#endif
 }
 
-uint16_t roundspd(zchn_t *ch, uint16_t spd) // 8bb: for Gxx with semitones-slide enabled
-{
-	uint32_t newspd = spd * ch->ac2spd;
-	if ((newspd >> 16) >= C2FREQ)
-		return spd; // 8bb: div error
-
-	newspd /= C2FREQ;
+#ifndef ST3_NO_SPDTABLES
+// 8bb: lookup tables for setspd() and roundspd(), see initspdtables()
+static uint16_t spdtablesmixingspeed;
+static uint32_t spd2mspeed[32768], spd2hz[32768];
+static uint8_t spd2note[65536];
+#endif
 
+static uint8_t findnearestnote(uint32_t newspd) // 8bb: the original note search from roundspd()
+{
 	// find octave
 
 	int8_t octa = 0;
@@ -229,9 +267,69 @@ uint16_t roundspd(zchn_t *ch, uint16_t spd) // 8bb: for Gxx with semitones-slide
 		}
 	}
 
+	return (octa << 4) | (newnote & 0x0F);
+}
+
+static uint32_t hz2mspeed(uint32_t hz)
+{
+	if (hz < 65536)
+	{
+		// 8bb: fits in 32-bit division
+		return (hz << 16) / audio.notemixingspeed;
+	}
+	else
+	{
+		// 8bb: hz is above 65535, slow calculation needed
+		const uint16_t quotient  = (uint16_t)(hz / audio.notemixingspeed);
+		const uint16_t remainder = (uint16_t)(hz % audio.notemixingspeed);
+		return (quotient << 16) | ((remainder << 16) / audio.notemixingspeed);
+	}
+}
+
+static void initspdtables(void)
+{
+#ifndef ST3_NO_SPDTABLES
+	if (spd2note[1] == 0) // 8bb: not depending on the mixing speed, only calculate once
+	{
+		for (uint32_t i = 1; i < 65536; i++)
+			spd2note[i] = findnearestnote(i);
+	}
+
+	if (spdtablesmixingspeed == audio.notemixingspeed)
+		return;
+
+	spdtablesmixingspeed = audio.notemixingspeed;
+
+	spd2mspeed[0] = spd2hz[0] = 0; // 8bb: not used, period 0 is handled in setspd()
+	for (uint32_t i = 1; i < 32768; i++)
+	{
+		const uint32_t hz = 14317056 / i;
+
+		spd2mspeed[i] = hz2mspeed(hz);
+		spd2hz[i] = hz;
+	}
+#endif
+}
+
+uint16_t roundspd(zchn_t *ch, uint16_t spd) // 8bb: for Gxx with semitones-slide enabled
+{
+	uint32_t newspd = spd * ch->ac2spd;
+	if ((newspd >> 16) >= C2FREQ)
+		return spd; // 8bb: div error
+
+	newspd /= C2FREQ;
+	if (newspd == 0)
+		return spd; // 8bb: added this, the octave search would never end
+
+	// 8bb: find octave and note (precalculated, see findnearestnote())
+
 	// get new speed from new note
 
-	newspd = stnote2herz((octa << 4) | (newnote & 0x0F)) * C2FREQ;
+#ifdef ST3_NO_SPDTABLES
+	newspd = stnote2herz(findnearestnote(newspd)) * C2FREQ;
+#else
+	newspd = stnote2herz(spd2note[newspd]) * C2FREQ;
+#endif
 	if ((newspd >> 16) >= ch->ac2spd)
 		return spd; // 8bb: div error
 
@@ -255,6 +353,8 @@ uint16_t scalec2spd(zchn_t *ch, uint16_t spd)
 void setspd(zchn_t *ch)
 {
 	ch->achannelused |= 128;
+	song.usedmask |= CHANNEL_BIT(ch);
+	song.dirtymask |= CHANNEL_BIT(ch);
 
 	const bool amigalimits = !!(song.masterflags & 16);
 
@@ -277,7 +377,7 @@ void setspd(zchn_t *ch)
 
 	if (tmpspd == 0)
 	{
-		ch->m_speed = 0;
+		setvoicespeed(ch, 0);
 
 		// 8bb: these two are for AdLib
 		ch->addherzretrig = 254;
@@ -293,19 +393,14 @@ void setspd(zchn_t *ch)
 			ch->aspd = tmpspd;
 	}
 
+#ifdef ST3_NO_SPDTABLES
 	const uint32_t hz = 14317056 / (uint16_t)tmpspd;
-	if (hz < 65536)
-	{
-		// 8bb: fits in 32-bit division
-		ch->m_speed = (hz << 16) / audio.notemixingspeed;
-	}
-	else
-	{
-		// 8bb: hz is above 65535, slow calculation needed
-		const uint16_t quotient  = (uint16_t)(hz / audio.notemixingspeed);
-		const uint16_t remainder = (uint16_t)(hz % audio.notemixingspeed);
-		ch->m_speed = (quotient << 16) | ((remainder << 16) / audio.notemixingspeed);
-	}
+	setvoicespeed(ch, hz2mspeed(hz));
+#else
+	// 8bb: tmpspd is 1..32767 here (aspdmin/aspdmax), see initspdtables()
+	setvoicespeed(ch, spd2mspeed[(uint16_t)tmpspd]);
+	const uint32_t hz = spd2hz[(uint16_t)tmpspd];
+#endif
 
 	// 8bb: for AdLib
 	ch->addherzhi = hz >> 16;
@@ -315,7 +410,9 @@ void setspd(zchn_t *ch)
 void setvol(zchn_t *ch)
 {
 	ch->achannelused |= 128;
-	ch->m_vol = ((uint8_t)ch->avol * song.useglobalvol) >> 8;
+	song.usedmask |= CHANNEL_BIT(ch);
+	song.dirtymask |= CHANNEL_BIT(ch);
+	setvoicevol(ch, ((uint8_t)ch->avol * song.useglobalvol) >> 8);
 }
 
 uint16_t stnote2herz(uint8_t note)
@@ -339,27 +436,311 @@ static inline int32_t random32(void) // 8bb: added this (LCG 32-bit random)
 	return (int32_t)randSeed;
 }
 
-void musmixer(int16_t *buffer, int32_t samples) // 8bb: not directly ported
+#ifndef ST3_NO_GUS
+static void renderGUS(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples)
 {
-	if (samples <= 0)
-		return;
+	GUS_RenderSamples(mixL, mixR, samples);
+}
 
-	if (!WAVRender_Flag && (!audio.playing || audio.samplesPerTickInt == 0))
+#ifndef ST3_NO_ADLIB
+static void renderGUSAdLib(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples)
+{
+	GUS_RenderSamples(mixL, mixR, samples);
+	OPL2_RenderSamples(mixL, mixR, samples); // 8bb: also lowers the gain of the PCM voices
+}
+#endif
+#endif
+
+static void renderSBPro(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples)
+{
+	SBPro_RenderSamples(mixL, mixR, samples); // 8bb: mono/stereo mixer was selected in SBPro_Init()
+}
+
+#ifndef ST3_NO_ADLIB
+static void renderSBProAdLib(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples)
+{
+	SBPro_RenderSamples(mixL, mixR, samples);
+	OPL2_RenderSamples(mixL, mixR, samples); // 8bb: also lowers the gain of the PCM voices
+}
+#endif
+
+// 8bb: small-footprint profile, the entries that can't be selected
+#ifdef ST3_NO_ADLIB
+#define renderGUSAdLib renderGUS // 8bb: song.adlibused is never set
+#define renderSBProAdLib renderSBPro
+#endif
+#ifdef ST3_NO_GUS
+#define renderGUS renderSBPro // 8bb: audio.soundcardtype is always SOUNDCARD_SBPRO
+#ifndef ST3_NO_ADLIB
+#define renderGUSAdLib renderSBProAdLib
+#endif
+#endif
+
+// 8bb: [audio.soundcardtype][song.adlibused]
+static void (*const renderfuncs[2][2])(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples) =
+{
+	{ renderGUS,   renderGUSAdLib   }, // SOUNDCARD_GUS
+	{ renderSBPro, renderSBProAdLib }  // SOUNDCARD_SBPRO
+};
+
+#ifndef ST3_NO_ADLIB
+static void renderopl2job(void *arg) // 8bb: runs on the helper thread (mixer/worker.c)
+{
+	OPL2_RenderToBuffer(oplBuffer, oplJobSamples);
+	(void)arg;
+}
+
+/* 8bb: The OPL2 output doesn't depend on the PCM voices, and the port
+** writes for this tick (updateregs()) are done at this point, so the
+** OPL2 emulator renders on the helper thread while the PCM voices are
+** mixed here. The output is the same as renderGUSAdLib()/renderSBProAdLib().
+*/
+static void renderAdLibThreaded(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples)
+{
+	oplJobSamples = samples;
+	Worker_Start(renderopl2job, NULL);
+
+	renderfuncs[audio.soundcardtype != SOUNDCARD_GUS][0](mixL, mixR, samples); // 8bb: PCM voices only
+
+	Worker_Wait();
+	OPL2_MixBuffer(mixL, mixR, oplBuffer, samples);
+}
+#endif
+
+static void (*renderfunc)(mixsmp_t *mixL, mixsmp_t *mixR, int32_t samples) = renderGUS;
+
+void selectrenderfunc(void) // 8bb: call when audio.soundcardtype or song.adlibused changes
+{
+	renderfunc = renderfuncs[audio.soundcardtype != SOUNDCARD_GUS][song.adlibused];
+#ifndef ST3_NO_ADLIB
+	if (song.adlibused && adlibThreadFlag)
+		renderfunc = renderAdLibThreaded;
+#endif
+}
+
+// 8bb: channel meters, see setChannelMeters()
+
+static bool meterFlag;
+static mixmeter_t pcmMeters[32], oplMeters[9]; // 8bb: filled by the mixers (SB Pro: channels 0..15, GUS: voices)
+static uint32_t meterPeak[32], meterSamples, meterBlock;
+static uint64_t meterSumSq[32];
+
+/* 8bb: Triple buffer. The mixer fills meterBuffers[meterBack] and swaps
+** it with the last finished one (meterReady), the reader swaps its own
+** (meterFront) with that one if it's new. Neither side has to wait, and
+** the reader always gets a whole block.
+*/
+static st3_meters_t meterBuffers[3];
+static uint32_t meterReady = 1; // 8bb: buffer index, bit 2 set = not read yet
+static uint32_t meterBack = 0, meterFront = 2;
+
+static void foldmeter(int32_t channel, const mixmeter_t *m)
+{
+	if (m->peak > meterPeak[channel])
+		meterPeak[channel] = m->peak;
+
+	meterSumSq[channel] += m->sumSq;
+}
+
+static void collectmeters(int32_t samples) // 8bb: after every render, since the GUS voices can change channel on the next tick
+{
+#ifndef ST3_NO_GUS
+	if (audio.soundcardtype == SOUNDCARD_GUS)
 	{
-		memset(buffer, 0, samples * 2 * sizeof (int16_t));
-		return;
+		for (int32_t i = 0; i < 32; i++)
+		{
+			const int32_t channel = gcmd_getvoicechannel(i);
+			if (channel >= 0 && channel < 16)
+				foldmeter(channel, &pcmMeters[i]);
+		}
 	}
+	else
+#endif
+	{
+		for (int32_t i = 0; i < 16; i++)
+			foldmeter(i, &pcmMeters[i]);
+	}
+
+#ifndef ST3_NO_ADLIB
+	for (int32_t i = 0; i < 9; i++)
+		foldmeter(16 + i, &oplMeters[i]);
+#endif
+
+	memset(pcmMeters, 0, sizeof (pcmMeters));
+	memset(oplMeters, 0, sizeof (oplMeters));
+	meterSamples += samples;
+}
 
-	float *fMixL = audio.fMixBufferL;
-	float *fMixR = audio.fMixBufferR;
+static void clearmeters(void)
+{
+	memset(pcmMeters, 0, sizeof (pcmMeters));
+	memset(oplMeters, 0, sizeof (oplMeters));
+	memset(meterPeak, 0, sizeof (meterPeak));
+	memset(meterSumSq, 0, sizeof (meterSumSq));
+	meterSamples = 0;
+}
+
+static void publishmeters(void) // 8bb: at the end of every musmixer() block
+{
+	st3_meters_t *m = &meterBuffers[meterBack];
+	m->block = ++meterBlock;
+	m->samples = meterSamples;
+
+	// 8bb: the mixers meter at the rate of the chip
+	double pcmRate = SBPro_GetOutputRate(), oplRate = 0.0;
+#ifndef ST3_NO_GUS
+	if (audio.soundcardtype == SOUNDCARD_GUS)
+		pcmRate = GUS_GetOutputRate();
+#endif
+#ifndef ST3_NO_ADLIB
+	oplRate = OPL2_GetOutputRate();
+#endif
+
+	for (int32_t i = 0; i < 32; i++)
+	{
+		const double mixes = (meterSamples * ((i < 16) ? pcmRate : oplRate)) / audio.outputFreq;
+
+		m->peak[i] = meterPeak[i] * (1.0f / 32768.0f);
+		m->rms[i] = (mixes > 0.0) ? (float)(sqrt(meterSumSq[i] / mixes) * (1.0 / 32768.0)) : 0.0f;
+	}
+
+	meterBack = ATOMIC_XCHG(meterReady, meterBack | 4) & 3;
+	clearmeters();
+}
+
+// 8bb: channel scopes, see setChannelScopes()
+
+#define NUM_SCOPES 25 // 8bb: ST3 channels 0..15 (PCM) and 16..24 (AdLib)
+
+/* 8bb: The rings are allocated when the scopes are turned on the first
+** time, and then kept until the program ends, so that readChannelScope()
+** on another thread can never see them freed. Turning the scopes off just
+** detaches them from the mixers.
+*/
+static scopering_t *scopeRings; // 8bb: NUM_SCOPES rings (heap)
+static int32_t scopesOn; // 8bb: ATOMIC_LOAD() it on other threads
+static int32_t scopeRate; // 8bb: in hertz, 0 = the rate of the chip
+static scope_t pcmScope, oplScope;
+
+static uint32_t scopestep(double chipRate) // 8bb: 16.16fp
+{
+	if (scopeRate <= 0 || scopeRate >= chipRate)
+		return 65536;
+
+	return (uint32_t)((scopeRate * 65536.0) / chipRate);
+}
+
+static double pcmchiprate(void)
+{
+#ifndef ST3_NO_GUS
+	if (audio.soundcardtype == SOUNDCARD_GUS)
+		return GUS_GetOutputRate();
+#endif
+	return SBPro_GetOutputRate();
+}
+
+static void beginscope(scope_t *s, double chipRate) // 8bb: before a mixer call
+{
+	s->step = scopestep(chipRate);
+	for (int32_t i = 0; i < s->numRings; i++)
+		s->end[i] = ATOMIC_LOAD(s->rings[i].readPos) + SCOPE_SIZE;
+}
+
+static void endscope(scope_t *s) // 8bb: after a mixer call, hands the new samples over
+{
+	for (int32_t i = 0; i < s->numRings; i++)
+		ATOMIC_STORE(s->rings[i].writePos, s->pos[i]);
+}
+
+static void beginscopes(void)
+{
+	// 8bb: PCM voice -> channel (the GUS voices can change channel on every tick)
+	for (int32_t i = 0; i < SCOPE_MAX_VOICES; i++)
+	{
+		int32_t channel = (i < 16) ? i : -1;
+#ifndef ST3_NO_GUS
+		if (audio.soundcardtype == SOUNDCARD_GUS)
+			channel = gcmd_getvoicechannel(i);
+#endif
+		pcmScope.map[i] = (channel >= 0 && channel < 16) ? (uint8_t)channel : 16;
+	}
+
+	beginscope(&pcmScope, pcmchiprate());
+#ifndef ST3_NO_ADLIB
+	beginscope(&oplScope, OPL2_GetOutputRate());
+#endif
+}
+
+static void endscopes(void)
+{
+	endscope(&pcmScope);
+#ifndef ST3_NO_ADLIB
+	endscope(&oplScope);
+#endif
+}
+
+static void rendermix(int32_t offset, int32_t samples)
+{
+	if (scopesOn)
+		beginscopes();
+
+	// 8bb: mix PCM voices (and AdLib voices, if used)
+	renderfunc(audio.mixBufferL + offset, audio.mixBufferR + offset, samples);
+
+	if (meterFlag)
+		collectmeters(samples);
+
+	if (scopesOn)
+		endscopes();
+}
+
+/* 8bb: Hands the mute mask over to the mixers, before every render() call
+** (the GUS voices of a channel can change on every tick). The replayer
+** doesn't know about it, so muted channels keep their state.
+*/
+static void applymutemask(void)
+{
+	const uint32_t mask = ATOMIC_LOAD(channelMuteMask);
+
+	SBPro_SetMuteMask((uint16_t)mask);
+#ifndef ST3_NO_ADLIB
+	OPL2_SetMuteMask((uint16_t)(mask >> 16));
+#endif
+
+#ifndef ST3_NO_GUS
+	if (audio.soundcardtype == SOUNDCARD_GUS)
+	{
+		uint32_t voiceMask = 0;
+		if ((uint16_t)mask != 0)
+		{
+			const int32_t numVoices = GUS_GetNumberOfVoices();
+			for (int32_t i = 0; i < numVoices; i++)
+			{
+				const int32_t channel = gcmd_getvoicechannel(i);
+				if (channel >= 0 && channel < 16 && (mask & (1UL << channel)))
+					voiceMask |= 1UL << i;
+			}
+		}
+
+		GUS_SetMuteMask(voiceMask);
+	}
+#endif
+}
+
+// 8bb: runs the replayer ticks, and lets render() do the samples in between
+static void mixticks(int32_t samples, void (*render)(int32_t offset, int32_t samples))
+{
+	int32_t offset = 0;
 
 	uint32_t samplesLeft = samples;
 	while (samplesLeft > 0)
 	{
 		if (audio.tickSampleCounter == 0)
 		{
+			begintickevents(audio.samplePos);
 			dorow(); // 8bb: digread.c (replayer ticker)
 			updateregs(); // 8bb: dig.c (GUS & AdLib updating)
+			applytickevents(); // 8bb: digevent.c (hands the tick over to the mixers)
 
 			audio.tickSampleCounter = audio.samplesPerTickInt;
 
@@ -375,39 +756,69 @@ void musmixer(int16_t *buffer, int32_t samples) // 8bb: not directly ported
 		if (samplesToMix > audio.tickSampleCounter)
 			samplesToMix = audio.tickSampleCounter;
 
-		// 8bb: mix PCM voices
-		if (audio.soundcardtype == SOUNDCARD_GUS)
-			GUS_RenderSamples(fMixL, fMixR, samplesToMix);
-		else
-			SBPro_RenderSamples(fMixL, fMixR, samplesToMix);
+		applymutemask();
+		render(offset, samplesToMix);
+		offset += samplesToMix;
 
-		// 8bb: mix AdLib (OPL2) voices
-		if (song.adlibused)
-		{
-			// lower gain a little before mixing in OPL2 samples
-			for (uint32_t i = 0; i < samplesToMix; i++)
-			{
-				fMixL[i] *= 2.0f/3.0f;
-				fMixR[i] *= 2.0f/3.0f;
-			}
+		audio.tickSampleCounter -= samplesToMix;
+		audio.samplePos += samplesToMix;
+		samplesLeft -= samplesToMix;
+	}
+}
 
-			OPL2_RenderSamples(fMixL, fMixR, samplesToMix);
-		}
+void musmixer(int16_t *buffer, int32_t samples) // 8bb: not directly ported
+{
+	if (samples <= 0)
+		return;
 
-		fMixL += samplesToMix;
-		fMixR += samplesToMix;
+	if (!WAVRender_Flag && (!audio.playing || audio.samplesPerTickInt == 0))
+	{
+		memset(buffer, 0, samples * 2 * sizeof (int16_t));
+		return;
+	}
 
-		audio.tickSampleCounter -= samplesToMix;
-		samplesLeft -= samplesToMix;
+	mixticks(samples, rendermix);
+	if (meterFlag)
+		publishmeters();
+
+	if (loudnessFlag) // 8bb: before the dithering, scaled to 1.0 = full scale
+	{
+#ifdef ST3_FIXEDPOINT
+		Loudness_Process(audio.mixBufferL, audio.mixBufferR, samples, audio.mixingVol * (1.0f / (256.0f * 32768.0f)));
+#else
+		Loudness_Process(audio.mixBufferL, audio.mixBufferR, samples, audio.fMixingVol * (1.0f / 32768.0f));
+#endif
 	}
 
+#ifdef ST3_FIXEDPOINT
+	int32_t prng, out32;
+	for (int32_t i = 0; i < samples; i++)
+	{
+		// 8bb: left channel - 1-bit triangular dithering (in 1/256 LSB units)
+		prng = random32() >> 24; // -128 .. 127 (-0.5 .. 0.5)
+		out32 = ((audio.mixBufferL[i] * audio.mixingVol) + prng) - prngStateL;
+		prngStateL = prng;
+		out32 >>= 8;
+		*buffer++ = (int16_t)(CLAMP(out32, INT16_MIN, INT16_MAX));
+
+		// 8bb: right channel - 1-bit triangular dithering (in 1/256 LSB units)
+		prng = random32() >> 24; // -128 .. 127 (-0.5 .. 0.5)
+		out32 = ((audio.mixBufferR[i] * audio.mixingVol) + prng) - prngStateR;
+		prngStateR = prng;
+		out32 >>= 8;
+		*buffer++ = (int16_t)(CLAMP(out32, INT16_MIN, INT16_MAX));
+
+		// 8bb: clear what we read from the mixing buffer
+		audio.mixBufferL[i] = audio.mixBufferR[i] = 0;
+	}
+#else
 	float fOut, fPrng;
 	int32_t out32;
 	for (int32_t i = 0; i < samples; i++)
 	{
 		// 8bb: left channel - 1-bit triangular dithering
 		fPrng = (float)random32() * (1.0f / (UINT32_MAX+1.0f)); // -0.5f .. 0.5f
-		fOut = audio.fMixBufferL[i] * audio.fMixingVol;
+		fOut = audio.mixBufferL[i] * audio.fMixingVol;
 		fOut = (fOut + fPrng) - fPrngStateL;
 		fPrngStateL = fPrng;
 		out32 = (int32_t)fOut;
@@ -415,15 +826,16 @@ void musmixer(int16_t *buffer, int32_t samples) // 8bb: not directly ported
 
 		// 8bb: right channel - 1-bit triangular dithering
 		fPrng = (float)random32() * (1.0f / (UINT32_MAX+1.0f)); // -0.5f .. 0.5f
-		fOut = audio.fMixBufferR[i] * audio.fMixingVol;
+		fOut = audio.mixBufferR[i] * audio.fMixingVol;
 		fOut = (fOut + fPrng) - fPrngStateR;
 		fPrngStateR = fPrng;
 		out32 = (int32_t)fOut;
 		*buffer++ = (int16_t)(CLAMP(out32, INT16_MIN, INT16_MAX));
 
 		// 8bb: clear what we read from the mixing buffer
-		audio.fMixBufferL[i] = audio.fMixBufferR[i] = 0.0f;
+		audio.mixBufferL[i] = audio.mixBufferR[i] = 0.0f;
 	}
+#endif
 }
 
 void zgotosong(int16_t order, int16_t row)
@@ -445,44 +857,21 @@ bool zplaysong(int16_t order)
 		return false;
 
 	song.adlibused = false; // 8bb: set in digadl.c if AdLib channels are handled
+	cleartickevents(); // 8bb: the events from here on belong to the first tick
 
+#ifndef ST3_NO_ADLIB
 	OPL2_Init(audio.outputFreq);
 	initadlib(); // initialize adlib
+#endif
 
 	song.stereomode = !!(song.header.mastermul & 128);
-	if (audio.soundcardtype == SOUNDCARD_GUS)
-		audio.notemixingspeed = 38587; // 8bb: yes, ST3 sets this to 38587 regardless of active GUS voices
-	else
-		audio.notemixingspeed = song.stereomode ? 22000 : 43478; // 8bb: first constant is off! :-(
+	audio.notemixingspeed = getnotemixingspeed(audio.soundcardtype, song.stereomode);
+	initspdtables();
 
 	// 8bb: calculate bpm2SamplesPerTick table
 	for (int32_t i = 0; i <= 255; i++)
 	{
-		const int32_t bpm = (i == 0) ? 1 : i;
-
-		double dHz;
-		if (audio.soundcardtype == SOUNDCARD_GUS)
-		{
-			// 8bb: calculate ST3-lossy value
-			int32_t hz = (bpm * 50) / 125;
-			if (hz < 19) // 8bb: ST3 does this to fit the PIT period range (this limits low BPM to 47.5)
-				hz = 19;
-
-			const int32_t PIT_Period = 1193180 / hz; // 8bb: ST3 off-by-one PIT clock constant
-
-			// 8bb: convert to actual hertz
-			const double dNominalPITClk = 157500000.0 / 132.0;
-			dHz = dNominalPITClk / (double)PIT_Period;
-		}
-		else
-		{
-			// 8bb: calculate ST3-lossy value
-			const int32_t samplesPerTick = (audio.notemixingspeed * 125) / (bpm * 50);
-
-			// 8bb: convert to actual hertz
-			dHz = audio.notemixingspeed / (double)samplesPerTick;
-		}
-
+		const double dHz = gettickrate(audio.soundcardtype, audio.notemixingspeed, (uint8_t)i);
 		const double dSamplesPerTick = audio.outputFreq / dHz;
 		const uint64_t samplesPerTick64 = (uint64_t)((dSamplesPerTick * (UINT32_MAX+1.0)) + 0.5); // 8bb: rounded 32.32fp
 
@@ -494,6 +883,7 @@ bool zplaysong(int16_t order)
 	initmodule();
 	loadheaderpans();
 
+#ifndef ST3_NO_GUS
 	if (audio.soundcardtype == SOUNDCARD_GUS)
 	{
 		uint8_t numGUSVoices = song.header.ultraclick;
@@ -502,12 +892,16 @@ bool zplaysong(int16_t order)
 		gcmd_setvoices(numGUSVoices);
 		gcmd_setstereo();
 	}
-	else if (audio.soundcardtype == SOUNDCARD_SBPRO)
+	else
+#endif
+	if (audio.soundcardtype == SOUNDCARD_SBPRO)
 	{
 		const uint8_t timeConstant = song.stereomode ? 210 : 233;
 		SBPro_Init(audio.outputFreq, timeConstant);
 	}
 
+	selectrenderfunc();
+
 	// 8bb: added these two for protection
 	song.np_patseg = NULL;
 	song.np_patoff = -1;
@@ -520,64 +914,341 @@ bool zplaysong(int16_t order)
 
 	// 8bb: zero tick sample counter so that it will instantly initiate a tick
 	audio.tickSampleCounterFrac = audio.tickSampleCounter = 0;
+	audio.samplePos = 0;
 
 	audio.playing = true;
 	return true;
 }
 
-static void freeinsmem(int32_t a)
+// 8bb: custom routines
+
+void setInterpolationQuality(int32_t quality)
+{
+	lockMixer();
+	Intrp_SetQuality(quality); // 8bb: mixer/sinc.c
+	unlockMixer();
+}
+
+void setAdLibMix(int32_t volume, int32_t panning)
+{
+#ifndef ST3_NO_ADLIB
+	volume = CLAMP(volume, 0, 256);
+	panning = CLAMP(panning, -128, 128);
+
+	// 8bb: balance, the side that is panned towards stays at full volume
+	const int32_t levelL = 128 - ((panning > 0) ?  panning : 0);
+	const int32_t levelR = 128 - ((panning < 0) ? -panning : 0);
+
+	lockMixer();
+#ifdef ST3_FIXEDPOINT
+	OPL2_SetGain((volume * levelL) >> 7, (volume * levelR) >> 7);
+#else
+	OPL2_SetGain((volume * levelL) * (1.0f / (256.0f * 128.0f)), (volume * levelR) * (1.0f / (256.0f * 128.0f)));
+#endif
+	unlockMixer();
+#else
+	(void)volume;
+	(void)panning;
+#endif
+}
+
+bool setAdLibThread(bool on)
+{
+#ifndef ST3_NO_ADLIB
+	if (on == adlibThreadFlag)
+		return true;
+
+	lockMixer();
+	if (on)
+	{
+		if (mixbuffersize <= 0)
+		{
+			unlockMixer();
+			return false; // 8bb: initMusic() wasn't called
+		}
+
+		oplBuffer = (mixsmp_t *)malloc(mixbuffersize * sizeof (mixsmp_t));
+		if (oplBuffer == NULL || !Worker_Init())
+		{
+			free(oplBuffer);
+			oplBuffer = NULL;
+
+			unlockMixer();
+			return false;
+		}
+	}
+	else
+	{
+		Worker_Free();
+
+		free(oplBuffer);
+		oplBuffer = NULL;
+	}
+
+	adlibThreadFlag = on;
+	selectrenderfunc();
+	unlockMixer();
+
+	return true;
+#else
+	return !on;
+#endif
+}
+
+void setChannelMuteMask(uint32_t mask)
+{
+	ATOMIC_STORE(channelMuteMask, mask); // 8bb: no lock, used from the next mixed chunk on
+}
+
+uint32_t getChannelMuteMask(void)
 {
-	ds_smp *ins = &song.ins[a];
-	if (ins->type == 1 && ins->baseptr != NULL)
+	return ATOMIC_LOAD(channelMuteMask);
+}
+
+void muteChannel(int32_t channel, bool mute)
+{
+	if (channel < 0 || channel > 31)
+		return;
+
+	uint32_t mask = getChannelMuteMask();
+	if (mute)
+		mask |= 1UL << channel;
+	else
+		mask &= ~(1UL << channel);
+
+	setChannelMuteMask(mask);
+}
+
+void soloChannel(int32_t channel)
+{
+	setChannelMuteMask((channel < 0 || channel > 31) ? 0 : ~(1UL << channel));
+}
+
+void setChannelMeters(bool on)
+{
+	lockMixer();
+
+	meterFlag = on;
+	clearmeters();
+
+	// 8bb: the mixers select their paths without metering for NULL
+	SBPro_SetMeters(on ? pcmMeters : NULL);
+#ifndef ST3_NO_GUS
+	GUS_SetMeters(on ? pcmMeters : NULL);
+#endif
+#ifndef ST3_NO_ADLIB
+	OPL2_SetMeters(on ? oplMeters : NULL);
+#endif
+
+	unlockMixer();
+}
+
+bool getChannelMeters(st3_meters_t *meters)
+{
+	bool newBlock = false;
+	if (ATOMIC_LOAD(meterReady) & 4)
 	{
-		free(ins->baseptr);
-		ins->baseptr = NULL;
+		meterFront = ATOMIC_XCHG(meterReady, meterFront) & 3;
+		newBlock = true;
 	}
+
+	*meters = meterBuffers[meterFront];
+	return newBlock;
 }
 
-// 8bb: custom routines
+bool setChannelScopes(bool on, int32_t rate)
+{
+	lockMixer();
+
+	SBPro_SetScope(NULL);
+#ifndef ST3_NO_GUS
+	GUS_SetScope(NULL);
+#endif
+#ifndef ST3_NO_ADLIB
+	OPL2_SetScope(NULL);
+#endif
+
+	ATOMIC_STORE(scopesOn, 0);
+
+	if (on)
+	{
+		if (scopeRings == NULL)
+		{
+			scopeRings = (scopering_t *)calloc(NUM_SCOPES, sizeof (scopering_t));
+			if (scopeRings == NULL)
+			{
+				unlockMixer();
+				return false;
+			}
+		}
+
+		scopeRate = (rate < 0) ? 0 : rate;
+
+		memset(&pcmScope, 0, sizeof (pcmScope));
+		pcmScope.rings = scopeRings;
+		pcmScope.numRings = 16; // 8bb: map[] is set in beginscopes()
+
+		memset(&oplScope, 0, sizeof (oplScope));
+		oplScope.rings = &scopeRings[16];
+		oplScope.numRings = 9;
+		for (int32_t i = 0; i < SCOPE_MAX_VOICES; i++)
+			oplScope.map[i] = (i < 9) ? (uint8_t)i : 9;
+
+		// 8bb: the rings may have been used before, continue where they are
+		for (int32_t i = 0; i < NUM_SCOPES; i++)
+		{
+			if (i < 16)
+				pcmScope.pos[i] = scopeRings[i].writePos;
+			else
+				oplScope.pos[i-16] = scopeRings[i].writePos;
+		}
+
+		SBPro_SetScope(&pcmScope);
+#ifndef ST3_NO_GUS
+		GUS_SetScope(&pcmScope);
+#endif
+#ifndef ST3_NO_ADLIB
+		OPL2_SetScope(&oplScope);
+#endif
+		ATOMIC_STORE(scopesOn, 1); // 8bb: also publishes scopeRings to readChannelScope()
+	}
+
+	unlockMixer();
+	return true;
+}
+
+double getChannelScopeRate(int32_t channel)
+{
+	if (channel < 0 || channel >= NUM_SCOPES)
+		return 0.0;
+
+	double chipRate = 0.0;
+	if (channel < 16)
+		chipRate = pcmchiprate();
+#ifndef ST3_NO_ADLIB
+	else
+		chipRate = OPL2_GetOutputRate();
+#endif
+
+	return (chipRate * scopestep(chipRate)) / 65536.0;
+}
+
+int32_t readChannelScope(int32_t channel, int16_t *buffer, int32_t maxSamples)
+{
+	if (!ATOMIC_LOAD(scopesOn) || channel < 0 || channel >= NUM_SCOPES || maxSamples <= 0)
+		return 0;
+
+	scopering_t *r = &scopeRings[channel];
+	const uint32_t writePos = ATOMIC_LOAD(r->writePos);
+
+	// 8bb: the newest samples, older ones are skipped
+	uint32_t readPos = r->readPos;
+	if (writePos - readPos > (uint32_t)maxSamples)
+		readPos = writePos - maxSamples;
+
+	const int32_t samples = (int32_t)(writePos - readPos);
+	for (int32_t i = 0; i < samples; i++)
+		buffer[i] = r->data[(readPos + i) & (SCOPE_SIZE-1)];
+
+	ATOMIC_STORE(r->readPos, writePos);
+	return samples;
+}
+
+bool setLoudnessAnalysis(bool on)
+{
+	lockMixer();
+
+	if (on)
+	{
+		loudnessFlag = Loudness_Init(audio.outputFreq);
+	}
+	else
+	{
+		loudnessFlag = false;
+		Loudness_Free();
+	}
+
+	unlockMixer();
+	return (loudnessFlag == on);
+}
+
+bool getLoudness(st3_loudness_t *info)
+{
+	lockMixer();
+	Loudness_Get(info);
+	const bool on = loudnessFlag;
+	unlockMixer();
+
+	return on;
+}
+
+uint16_t getnotemixingspeed(int32_t soundCardType, bool stereomode)
+{
+	if (soundCardType == SOUNDCARD_GUS)
+		return 38587; // 8bb: yes, ST3 sets this to 38587 regardless of active GUS voices
+	else
+		return stereomode ? 22000 : 43478; // 8bb: first constant is off! :-(
+}
+
+double gettickrate(int32_t soundCardType, uint16_t notemixingspeed, uint8_t tempo) // 8bb: in hertz
+{
+	const int32_t bpm = (tempo == 0) ? 1 : tempo;
+
+	if (soundCardType == SOUNDCARD_GUS)
+	{
+		// 8bb: calculate ST3-lossy value
+		int32_t hz = (bpm * 50) / 125;
+		if (hz < 19) // 8bb: ST3 does this to fit the PIT period range (this limits low BPM to 47.5)
+			hz = 19;
+
+		const int32_t PIT_Period = 1193180 / hz; // 8bb: ST3 off-by-one PIT clock constant
+
+		// 8bb: convert to actual hertz
+		const double dNominalPITClk = 157500000.0 / 132.0;
+		return dNominalPITClk / (double)PIT_Period;
+	}
+	else
+	{
+		// 8bb: calculate ST3-lossy value
+		const int32_t samplesPerTick = (notemixingspeed * 125) / (bpm * 50);
+
+		// 8bb: convert to actual hertz
+		return notemixingspeed / (double)samplesPerTick;
+	}
+}
 
 void resetAudioDither(void)
 {
 	randSeed = 0x12345000;
+#ifdef ST3_FIXEDPOINT
+	prngStateL = prngStateR = 0;
+#else
 	fPrngStateL = fPrngStateR = 0.0f;
+#endif
 }
 
 void closeMusic(void)
 {
 	closeMixer();
 
-	if (audio.fMixBufferL != NULL)
+	if (audio.mixBufferL != NULL)
 	{
-		free(audio.fMixBufferL);
-		audio.fMixBufferL = NULL;
+		free(audio.mixBufferL);
+		audio.mixBufferL = NULL;
 	}
 
-	if (audio.fMixBufferR != NULL)
+	if (audio.mixBufferR != NULL)
 	{
-		free(audio.fMixBufferR);
-		audio.fMixBufferR = NULL;
+		free(audio.mixBufferR);
+		audio.mixBufferR = NULL;
 	}
 
-	// free pattern data
-	for (int32_t i = 0; i < MAX_PATTERNS; i++)
-	{
-		if (song.patp[i] != NULL)
-		{
-			free(song.patp[i]);
-			song.patp[i] = NULL;
-		}
-	}
-
-	// free sample data
-	for (int32_t i = 0; i < MAX_INSTRUMENTS; i++)
-		freeinsmem(i);
-
-	memset(&song.header, 0, sizeof (song.header));
-	memset(song.order, 255, MAX_ORDERS);
-	memset(song.ins, 0, sizeof (song.ins));
+	st3_detachsong(); // 8bb: releases our reference to the song data (load.c)
 
 	song.adlibused = false;
+	setAdLibThread(false);
+	setChannelScopes(false, 0);
+	setLoudnessAnalysis(false);
 }
 
 bool initMusic(int32_t audioFrequency, int32_t audioBufferSize)
@@ -589,14 +1260,19 @@ bool initMusic(int32_t audioFrequency, int32_t audioBufferSize)
 
 	closeMusic();
 	memset(song._zchn, 0, sizeof (song._zchn));
+	memset(song._zvoice, 0, sizeof (song._zvoice));
+	resetmixvoices();
 
 	// zero tick sample counter so that it will instantly initiate a tick
 	audio.tickSampleCounterFrac = audio.tickSampleCounter = 0;
 
-	audio.fMixBufferL = (float *)calloc(audioBufferSize, sizeof (float));
-	audio.fMixBufferR = (float *)calloc(audioBufferSize, sizeof (float));
+	Intrp_SetQuality(intrpQuality); // 8bb: makes sure that the tables are set up (mixer/sinc.c)
+
+	mixbuffersize = audioBufferSize;
+	audio.mixBufferL = (mixsmp_t *)calloc(audioBufferSize, sizeof (mixsmp_t));
+	audio.mixBufferR = (mixsmp_t *)calloc(audioBufferSize, sizeof (mixsmp_t));
 
-	if (audio.fMixBufferL == NULL || audio.fMixBufferR == NULL)
+	if (audio.mixBufferL == NULL || audio.mixBufferR == NULL)
 	{
 		closeMusic();
 		return false;
@@ -623,18 +1299,20 @@ void togglePause(void)
 
 int32_t activePCMVoices(void)
 {
+#ifndef ST3_NO_GUS
 	if (audio.soundcardtype == SOUNDCARD_GUS)
 	{
 		return GUS_GetNumberOfRunningVoices();
 	}
 	else
+#endif
 	{
 		int32_t activeVoices = 0;
 
-		zchn_t *ch = song._zchn;
-		for (int32_t i = 0; i < 16; i++, ch++)
+		const zvoice_t *v = mixvoice;
+		for (int32_t i = 0; i < 16; i++, v++)
 		{
-			if (ch->m_base != NULL && ch->m_speed != 0 && ch->m_pos != 0xFFFFFFFF && ch->m_vol > 0)
+			if (v->m_base != NULL && v->m_speed != 0 && v->m_pos != 0xFFFFFFFF && v->m_vol > 0)
 				activeVoices++;
 		}
 
@@ -642,14 +1320,40 @@ int32_t activePCMVoices(void)
 	}
 }
 
+uint32_t getplayermemusage(void)
+{
+	uint32_t bytes = sizeof (song) + sizeof (audio);
+	bytes += 2 * mixbuffersize * sizeof (mixsmp_t); // 8bb: audio.mixBufferL/R (heap)
+#ifndef ST3_NO_SPDTABLES
+	bytes += sizeof (spd2mspeed) + sizeof (spd2hz) + sizeof (spd2note);
+#endif
+	bytes += SBPro_GetMemUsage() + Intrp_GetMemUsage() + geteventmemusage();
+	bytes += sizeof (meterBuffers) + sizeof (pcmMeters) + sizeof (oplMeters) + sizeof (meterPeak) + sizeof (meterSumSq);
+	bytes += sizeof (pcmScope) + sizeof (oplScope);
+	if (scopeRings != NULL)
+		bytes += NUM_SCOPES * sizeof (scopering_t); // 8bb: heap (kept once allocated)
+	bytes += Loudness_GetMemUsage(); // 8bb: heap
+#ifndef ST3_NO_GUS
+	bytes += GUS_GetMemUsage();
+#endif
+#ifndef ST3_NO_ADLIB
+	bytes += OPL2_GetMemUsage();
+	if (oplBuffer != NULL)
+		bytes += mixbuffersize * sizeof (mixsmp_t); // 8bb: heap
+#endif
+
+	return bytes;
+}
+
 int32_t activeAdLibVoices(void)
 {
 	int32_t activeVoices = 0;
 
-	zchn_t *ch = &song._zchn[16];
-	for (int32_t i = 0; i < 9; i++, ch++)
+	const zchn_t *ch = &song._zchn[16];
+	const zvoice_t *v = &song._zvoice[16];
+	for (int32_t i = 0; i < 9; i++, ch++, v++)
 	{
-		if (ch->m_speed != 0 && ch->m_vol > 0 && ch->lastadlins > 0)
+		if (v->m_speed != 0 && v->m_vol > 0 && ch->lastadlins > 0)
 			activeVoices++;
 	}
 
@@ -728,3 +1432,198 @@ bool Dig_RenderToWAV(uint32_t audioRate, uint32_t bufferSize, const char *filena
 
 	return true;
 }
+
+// 8bb: stem render
+
+#define NUM_STEMS 25 // 8bb: ST3 channels 0..15 (PCM) and 16..24 (AdLib)
+
+static stem_t *stems;
+static mixsmp_t *stemBuffer;
+static int32_t stemBufferSize;
+#ifndef ST3_NO_ADLIB
+static bool stemThreadFlag;
+static int32_t oplStemSamples;
+
+static void renderopl2stemjob(void *arg) // 8bb: runs on the helper thread (mixer/worker.c)
+{
+	OPL2_RenderStems(&stems[16], oplStemSamples);
+	(void)arg;
+}
+#endif
+
+/* 8bb: The same as rendermix(), but every ST3 channel is rendered to its
+** own stem. GUS voices go to the channel they were last assigned to, so
+** a voice that slides down after a new note stays in its old channel.
+** The OPL2 emulator renders on the helper thread while the PCM voices are
+** rendered here (as in renderAdLibThreaded()).
+*/
+static void renderstems(int32_t offset, int32_t samples)
+{
+	for (int32_t i = 0; i < NUM_STEMS; i++)
+	{
+		stems[i].outL = &stemBuffer[((i * 2) + 0) * stemBufferSize + offset];
+		stems[i].outR = &stemBuffer[((i * 2) + 1) * stemBufferSize + offset];
+	}
+
+#ifndef ST3_NO_ADLIB
+	if (song.adlibused && stemThreadFlag)
+	{
+		oplStemSamples = samples;
+		Worker_Start(renderopl2stemjob, NULL);
+	}
+#endif
+
+#ifndef ST3_NO_GUS
+	if (audio.soundcardtype == SOUNDCARD_GUS)
+	{
+		stem_t *voiceStem[32];
+		for (int32_t i = 0; i < 32; i++)
+		{
+			const int32_t channel = gcmd_getvoicechannel(i);
+			voiceStem[i] = (channel >= 0 && channel < 16) ? &stems[channel] : NULL;
+		}
+
+		GUS_RenderStems(stems, 16, voiceStem, samples);
+	}
+	else
+#endif
+	{
+		SBPro_RenderStems(stems, samples);
+	}
+
+#ifndef ST3_NO_ADLIB
+	if (song.adlibused)
+	{
+		if (stemThreadFlag)
+			Worker_Wait();
+		else
+			OPL2_RenderStems(&stems[16], samples);
+
+		for (int32_t i = 0; i < 16; i++)
+			OPL2_MixBuffer(stems[i].outL, stems[i].outR, NULL, samples); // 8bb: lower the PCM gain, as in the mix
+	}
+	else
+#endif
+	{
+		for (int32_t i = 16; i < NUM_STEMS; i++)
+		{
+			memset(stems[i].outL, 0, samples * sizeof (mixsmp_t));
+			memset(stems[i].outR, 0, samples * sizeof (mixsmp_t));
+		}
+	}
+}
+
+static void stemtoint16(int16_t *buffer, const mixsmp_t *stemL, const mixsmp_t *stemR, int32_t samples)
+{
+	// 8bb: rounded instead of dithered, so that the stems add up to the mix without extra noise
+	for (int32_t i = 0; i < samples; i++)
+	{
+#ifdef ST3_FIXEDPOINT
+		const int32_t outL = ((stemL[i] * audio.mixingVol) + 128) >> 8;
+		const int32_t outR = ((stemR[i] * audio.mixingVol) + 128) >> 8;
+#else
+		const int32_t outL = (int32_t)floorf((stemL[i] * audio.fMixingVol) + 0.5f);
+		const int32_t outR = (int32_t)floorf((stemR[i] * audio.fMixingVol) + 0.5f);
+#endif
+		*buffer++ = (int16_t)(CLAMP(outL, INT16_MIN, INT16_MAX));
+		*buffer++ = (int16_t)(CLAMP(outR, INT16_MIN, INT16_MAX));
+	}
+}
+
+static const char *stemname(int32_t channel) // 8bb: ST3 channel names
+{
+	static const char names[NUM_STEMS][3] =
+	{
+		"L1","L2","L3","L4","L5","L6","L7","L8",
+		"R1","R2","R3","R4","R5","R6","R7","R8",
+		"A1","A2","A3","A4","A5","A6","A7","A8","A9"
+	};
+
+	return names[channel];
+}
+
+bool Dig_RenderStemsToWAV(uint32_t audioRate, uint32_t bufferSize, const char *filenamePrefix)
+{
+	// 8bb: the ST3 channels that the song plays on
+	uint32_t stemMask = 0;
+	for (int32_t i = 0; i < 32; i++)
+	{
+		if (song.header.channel[i] < NUM_STEMS) // 8bb: also skips muted channels (bit 7)
+			stemMask |= 1UL << song.header.channel[i];
+	}
+#ifdef ST3_NO_ADLIB
+	stemMask &= 0xFFFF;
+#endif
+
+	FILE *f[NUM_STEMS] = { NULL };
+	char *filename = (char *)malloc(strlen(filenamePrefix) + 8);
+	int16_t *AudioBuffer = (int16_t *)malloc(bufferSize * 2 * sizeof (int16_t));
+	stemBuffer = (mixsmp_t *)malloc(NUM_STEMS * 2 * bufferSize * sizeof (mixsmp_t));
+	stems = (stem_t *)calloc(NUM_STEMS, sizeof (stem_t));
+	stemBufferSize = bufferSize;
+
+	bool ok = (filename != NULL && AudioBuffer != NULL && stemBuffer != NULL && stems != NULL);
+	for (int32_t i = 0; ok && i < NUM_STEMS; i++)
+	{
+		if (!(stemMask & (1UL << i)))
+			continue;
+
+		sprintf(filename, "%s.%s.wav", filenamePrefix, stemname(i));
+		f[i] = fopen(filename, "wb");
+		if (f[i] == NULL)
+			ok = false;
+		else
+			WAV_WriteHeader(f[i], audioRate);
+	}
+
+#ifndef ST3_NO_ADLIB
+	stemThreadFlag = ok && Worker_Init(); // 8bb: renders without it if it can't be created
+#endif
+
+	uint32_t TotalSamples = 0;
+
+	WAVRender_Flag = ok;
+	while (WAVRender_Flag)
+	{
+		mixticks(bufferSize, renderstems);
+
+		for (int32_t i = 0; i < NUM_STEMS; i++)
+		{
+			if (f[i] == NULL)
+				continue;
+
+			const mixsmp_t *stemL = &stemBuffer[((i * 2) + 0) * stemBufferSize];
+			const mixsmp_t *stemR = &stemBuffer[((i * 2) + 1) * stemBufferSize];
+
+			stemtoint16(AudioBuffer, stemL, stemR, bufferSize);
+			fwrite(AudioBuffer, 2, bufferSize * 2, f[i]);
+		}
+		TotalSamples += bufferSize * 2;
+	}
+	WAVRender_Flag = false;
+
+#ifndef ST3_NO_ADLIB
+	if (stemThreadFlag && !adlibThreadFlag) // 8bb: keep it for setAdLibThread()
+		Worker_Free();
+	stemThreadFlag = false;
+#endif
+
+	for (int32_t i = 0; i < NUM_STEMS; i++)
+	{
+		if (f[i] == NULL)
+			continue;
+
+		if (ok)
+			WAV_WriteEnd(f[i], TotalSamples * sizeof (int16_t));
+		fclose(f[i]);
+	}
+
+	free(filename);
+	free(AudioBuffer);
+	free(stemBuffer);
+	free(stems);
+	stemBuffer = NULL;
+	stems = NULL;
+
+	return ok;
+}
@@ -5,13 +5,22 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include "digdata.h"
 
+#if defined ST3_NO_GUS && !defined FORCE_SOUNDCARD_TYPE
+#define FORCE_SOUNDCARD_TYPE SOUNDCARD_SBPRO
+#endif
+
 // AUDIO DRIVERS
 #if defined AUDIODRIVER_SDL
 #include "audiodrivers/sdl/sdldriver.h"
 #elif defined AUDIODRIVER_WINMM
 #include "audiodrivers/winmm/winmm.h"
+#elif defined AUDIODRIVER_NULL
+#include "audiodrivers/null/nulldriver.h" // 8bb: for the tests and the fuzzer
 #else
 // Read "audiodrivers/how_to_write_drivers.txt"
 #endif
@@ -26,6 +35,7 @@ void updateregs(void); // adlib/gravis
 void shutupsounds(void);
 void zgotosong(int16_t order, int16_t row);
 bool zplaysong(int16_t order);
+void selectrenderfunc(void);
 void musmixer(int16_t *buffer, int32_t samples);
 
 // 8bb: my own custom routines
@@ -36,6 +46,54 @@ void musmixer(int16_t *buffer, int32_t samples);
 
 #define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
 
+// 8bb: index of the lowest set bit, for iterating channel bitmasks (x must not be zero)
+static inline int32_t lowestbit64(uint64_t x)
+{
+#if defined _MSC_VER
+	unsigned long i;
+#if defined _M_X64 || defined _M_ARM64
+	_BitScanForward64(&i, x);
+#else
+	if ((uint32_t)x != 0)
+	{
+		_BitScanForward(&i, (uint32_t)x);
+	}
+	else
+	{
+		_BitScanForward(&i, (uint32_t)(x >> 32));
+		i += 32;
+	}
+#endif
+	return (int32_t)i;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+// 8bb: channels 0..lastachannelused (inclusive), as in the docmd1()/docmd2() loops
+static inline uint64_t lastchannelmask(int32_t last)
+{
+	return (last >= 63) ? UINT64_MAX : (((uint64_t)2 << last) - 1);
+}
+
+// 8bb: for 32-bit values shared with other threads (song refcount, lazy loading, channel mute mask, meters)
+#ifdef _MSC_VER
+#define ATOMIC_INC(x) _InterlockedIncrement((volatile long *)&(x))
+#define ATOMIC_DEC(x) _InterlockedDecrement((volatile long *)&(x))
+#define ATOMIC_CAS(x, old, new) (_InterlockedCompareExchange((volatile long *)&(x), (new), (old)) == (old))
+#define ATOMIC_LOAD(x) _InterlockedOr((volatile long *)&(x), 0)
+#define ATOMIC_STORE(x, val) _InterlockedExchange((volatile long *)&(x), (val))
+#define ATOMIC_XCHG(x, val) _InterlockedExchange((volatile long *)&(x), (val))
+#else
+#define ATOMIC_INC(x) __atomic_add_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_DEC(x) __atomic_sub_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_CAS(x, old, new) __extension__ ({ int32_t _expected = (old); \
+	__atomic_compare_exchange_n(&(x), &_expected, (new), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELEASE)
+#define ATOMIC_XCHG(x, val) __atomic_exchange_n(&(x), (val), __ATOMIC_ACQ_REL)
+#endif
+
 extern bool WAVRender_Flag;
 extern bool renderToWavFlag;
 
@@ -44,10 +102,116 @@ bool initMusic(int32_t audioFrequency, int32_t audioBufferSize);
 void togglePause(void);
 int32_t activePCMVoices(void);
 int32_t activeAdLibVoices(void);
+uint32_t getplayermemusage(void); // 8bb: static replayer/mixer RAM in bytes, see st3_memusage()
 void resetAudioDither(void);
+void setInterpolationQuality(int32_t quality); // 8bb: INTRP_* (for all resamplers), INTRP_SINC16 is the default
+void setAdLibMix(int32_t volume, int32_t panning); // 8bb: AdLib output, volume 0..256 (256 = normal), panning -128..128 (0 = center)
+bool setAdLibThread(bool on); // 8bb: renders AdLib on a helper thread (call after initMusic(), closeMusic() turns it off)
+
+/* 8bb: Channel mute mask, bit n = ST3 channel n (0..7 = L1..L8, 8..15 =
+** R1..R8, 16..24 = A1..A9). Muted channels aren't mixed, but keep playing
+** silently, so unmuting is seamless (for AdLib channels, the DC filter of
+** the OPL2 output settles within a second, see tests/test_mute.c). These
+** don't lock the mixer (call them from one thread only). soloChannel(-1)
+** unmutes all channels.
+*/
+void setChannelMuteMask(uint32_t mask);
+uint32_t getChannelMuteMask(void);
+void muteChannel(int32_t channel, bool mute);
+void soloChannel(int32_t channel);
+
+/* 8bb: Channel meters, the peak and RMS level of every ST3 channel in the
+** last musmixer() block, measured in the mixers (at the rate of the chip,
+** before interpolation). Off by default, and then the mixers don't meter
+** at all. getChannelMeters() doesn't lock the mixer, so it can be called
+** from one other thread (f.ex. the UI), it returns false if no new block
+** was finished since the last call (meters gets the last one anyway).
+*/
+void setChannelMeters(bool on);
+bool getChannelMeters(st3_meters_t *meters);
+
+/* 8bb: Channel scopes, the waveform of every ST3 channel (0..24) as the
+** mixers make it, at the rate of the chip or decimated to rate (hertz, 0
+** = chip rate, see getChannelScopeRate()). Each channel has its own ring
+** of 4096 samples (allocated here), with one writer (the mixer) and one
+** reader. readChannelScope() doesn't lock the mixer, it returns up to
+** maxSamples of the newest samples since the last call (Q15, before the
+** mixing volume), or 0 while the scopes are off. The rings are allocated
+** the first time the scopes are turned on, and are kept until the program
+** ends, so reading is safe at any time, also while setChannelScopes() or
+** closeMusic() (which turns them off) runs. Samples that weren't read
+** before turning the scopes off can still be read after turning them on.
+*/
+bool setChannelScopes(bool on, int32_t rate);
+double getChannelScopeRate(int32_t channel);
+int32_t readChannelScope(int32_t channel, int16_t *buffer, int32_t maxSamples);
+
+/* 8bb: Loudness analysis of the output (EBU R128 integrated loudness and
+** true peak, see st3_loudness_t), so that f.ex. Dig_RenderToWAV() gives the
+** loudness of a song in the same pass. It measures the mixing buffers before
+** the dithering, and starts over when turned on (call after initMusic(),
+** closeMusic() turns it off). getLoudness() returns false if it's off.
+*/
+bool setLoudnessAnalysis(bool on);
+bool getLoudness(st3_loudness_t *info);
+uint16_t getnotemixingspeed(int32_t soundCardType, bool stereomode);
+double gettickrate(int32_t soundCardType, uint16_t notemixingspeed, uint8_t tempo); // 8bb: in hertz
 bool Dig_RenderToWAV(uint32_t audioRate, uint32_t bufferSize, const char *filenameOut);
 
+/* 8bb: Renders every ST3 channel that the song plays on to its own WAV file
+** (filenamePrefix.L1.wav .. .R8.wav, .A1.wav .. .A9.wav), in one pass. The
+** stems add up to the output of Dig_RenderToWAV(), except where that clips
+** and for the 8-bit rounding of the SB Pro mixer.
+*/
+bool Dig_RenderStemsToWAV(uint32_t audioRate, uint32_t bufferSize, const char *filenamePrefix);
+
 // load.c
 bool load_st3_from_ram(const uint8_t *data, uint32_t dataLength, int32_t soundCardType);
 bool load_st3(const char *fileName, int32_t soundCardType);
+
+/* 8bb: Shared song data. A loaded st3_song_t has a refcount of 1, and
+** st3_attachsong() takes its own reference, so the loader's reference
+** can be released right after attaching (or kept for attaching it again).
+**
+** loadFlags: ST3_LOAD_LAZYSAMPLES leaves the sample data in the module
+** data until an instrument is first played. ST3_LOAD_INPLACEPATTERNS plays
+** well-formed patterns directly from the module data instead of copying
+** them (f.ex. module data in ROM). With st3_loadsong_from_ram(), the data
+** has to stay valid for as long as the song exists when any of these are
+** used.
+**
+** The player itself (song/audio in digdata.c) is still one global instance,
+** so a shared song saves loading it again, but it doesn't give several
+** concurrent players. load_st3()/load_st3_from_ram() call closeMusic() when
+** the module can't be loaded.
+*/
+st3_song_t *st3_loadsong_from_ram(const uint8_t *data, uint32_t dataLength, uint32_t loadFlags);
+st3_song_t *st3_loadsong(const char *fileName, uint32_t loadFlags);
+st3_song_t *st3_retainsong(st3_song_t *s);
+void st3_releasesong(st3_song_t *s);
+bool st3_attachsong(st3_song_t *s, int32_t soundCardType);
+void st3_detachsong(void);
+
+// 8bb: memory report for the replayer and a loaded song (s can be NULL)
+void st3_memusage(st3_song_t *s, st3_memusage_t *info);
+
+/* 8bb: For lazily loaded songs. These are thread-safe, so a helper thread
+** can prefetch the instruments of the next row (song.np_pat/song.np_row).
+** insNum is 1..99, as in the pattern data. st3_materializeins() allocates
+** and may wait for another thread, so never call it from the audio thread.
+** The replayer only uses st3_requestins(), which doesn't block: if the
+** sample isn't loaded yet, it's marked as wanted and the channel is silent
+** until st3_materializewanted() (or a prefetch) has loaded it. Call that
+** one periodically from the main thread while playing a lazy song.
+** (When rendering to WAV there's no audio thread, and the replayer loads
+** the samples right away, so the output is the same as with eager loading.)
+*/
+int8_t *st3_materializeins(st3_song_t *s, int32_t insNum);
+bool st3_requestins(st3_song_t *s, int32_t insNum, int8_t **baseptr); // 8bb: true = *baseptr is final
+void st3_materializewanted(st3_song_t *s);
+void st3_prefetchrow(st3_song_t *s, int16_t pattern, int16_t row);
+
+// 8bb: reads module metadata without loading the sample data
+bool st3_probe_from_ram(const uint8_t *data, uint32_t dataLength, st3_probe_t *info);
+bool st3_probe(const char *fileName, st3_probe_t *info);
 // -------------
@@ -11,15 +11,28 @@
 #include <stdbool.h>
 #include <string.h>
 #include "dig.h"
+#include "digevent.h"
 #include "mixer/gus_gf1.h"
 
+#ifndef ST3_NO_GUS // 8bb: small-footprint profile, see digdata.h
+
 static uint8_t stchannelpan[ACHANNELS]; // st channels pan settings
+static uint8_t panpos[ACHANNELS]; // 8bb: zchn_t.apanpos, from the tick events
+static uint32_t oldpos[ACHANNELS]; // 8bb: was zchn_t.m_oldpos
 static int8_t voiceused[32];
+static int8_t voicechannel[32]; // 8bb: the ST3 channel that a GUS voice was last assigned to (for stems)
 static uint8_t channeltrig[32];
 static uint8_t somevoice;
 static uint8_t voicetry; // which voice to try next
 static uint8_t g_maxvoices;
 
+// 8bb: m_speed -> GUS frequency (6.10fp) for the number of active voices, selected in gcmd_setvoices()
+static uint16_t gusfreq16(uint32_t speed) { return (uint16_t)(speed >> 6); }
+static uint16_t gusfreq24(uint32_t speed) { return (uint16_t)((speed + speed) / 85); }
+static uint16_t gusfreq32(uint32_t speed) { return (uint16_t)(speed >> 5); }
+static uint16_t gusfreqraw(uint32_t speed) { return (uint16_t)speed; }
+static uint16_t (*gusfreq)(uint32_t speed) = gusfreq16;
+
 static const uint16_t gusvoltable[64+1] =
 {
 	 4096,36848,40944,43008,45040,46080,47104,48128,49136,49664,50176,
@@ -63,6 +76,16 @@ void gcmd_setvoices(uint8_t numVoices)
 {
 	g_maxvoices = numVoices;
 	shutupgus();
+	memset(voicechannel, -1, sizeof (voicechannel));
+
+	if (numVoices == 16)
+		gusfreq = gusfreq16;
+	else if (numVoices == 24)
+		gusfreq = gusfreq24;
+	else if (numVoices == 32)
+		gusfreq = gusfreq32;
+	else
+		gusfreq = gusfreqraw;
 
 	for (int32_t i = 0; i < 32; i++)
 	{
@@ -97,11 +120,11 @@ void gcmd_setstereo(void) // sets for 16 first dma channels
 	}
 }
 
-static void setvolslide(zchn_t *ch, uint8_t currVol, uint8_t targetVol)
+static void setvolslide(zvoice_t *v, uint8_t currVol, uint8_t targetVol)
 {
 	if (currVol != targetVol)
 	{
-		ch->m_oldvol = targetVol;
+		v->m_oldvol = targetVol;
 
 		const uint16_t currLogVol = gusvoltable[currVol];
 		const uint16_t targetLogVol = gusvoltable[targetVol];
@@ -170,9 +193,30 @@ static void freevoices(void) // finds free voices
 	}
 }
 
-void gcmd_update(zchn_t *ch)
+void gcmd_resetchannels(void)
+{
+	memset(panpos, 0, sizeof (panpos));
+	memset(oldpos, 0xFF, sizeof (oldpos));
+}
+
+void gcmd_setpan(int32_t channel, uint8_t pan)
+{
+	panpos[channel] = pan;
+}
+
+void gcmd_retrig(int32_t channel)
 {
-	if (ch == NULL) // 8bb: handle GUS triggers
+	oldpos[channel] = 0xFFFFFFFF; // 8bb: m_pos is never this, so the voice gets (re)triggered
+}
+
+int32_t gcmd_getvoicechannel(int32_t voice)
+{
+	return voicechannel[voice]; // 8bb: also while it's sliding down after the channel moved on
+}
+
+void gcmd_update(int32_t channel)
+{
+	if (channel < 0) // 8bb: handle GUS triggers
 	{
 		for (int32_t i = 0; i < 32; i++)
 		{
@@ -190,50 +234,45 @@ void gcmd_update(zchn_t *ch)
 		return;
 	}
 
-	if (ch->aguschannel >= 0)
+	zvoice_t *v = &mixvoice[channel];
+
+	if (v->aguschannel >= 0)
 	{
-		GUS_VoiceSelect(ch->aguschannel);
+		GUS_VoiceSelect(v->aguschannel);
 
-		if (ch->m_oldpos == ch->m_pos)
+		if (oldpos[channel] == v->m_pos)
 		{
 			// update m_pos & m_oldpos
 
-			if (ch->m_speed != 0)
+			if (v->m_speed != 0)
 			{
-				uint32_t pos = (uint32_t)(GUS_GetCurrAddress() - ch->m_base);
+				uint32_t pos = (uint32_t)(GUS_GetCurrAddress() - v->m_base);
 				if (pos >= 65536)
 					pos = 0;
 
-				ch->m_oldpos = ch->m_pos = pos;
+				oldpos[channel] = v->m_pos = pos;
 			}
 
 			// hz
-			if (g_maxvoices == 16)
-				GUS_SetFrequency((uint16_t)(ch->m_speed >> 6));
-			else if (g_maxvoices == 24)
-				GUS_SetFrequency((uint16_t)((ch->m_speed + ch->m_speed) / 85));
-			else if (g_maxvoices == 32)
-				GUS_SetFrequency((uint16_t)(ch->m_speed >> 5));
-			else
-				GUS_SetFrequency((uint16_t)ch->m_speed);
+			GUS_SetFrequency(gusfreq(v->m_speed));
 
-			setvolslide(ch, ch->m_oldvol, ch->m_vol);
+			setvolslide(v, v->m_oldvol, v->m_vol);
 
 			return;
 		}
 
 		// slide old channel to zero
-		setvolslide(ch, ch->m_oldvol, 64); // 8bb: 64 (aka. "morezero") is quieter than 0 in gusvoltable
+		setvolslide(v, v->m_oldvol, 64); // 8bb: 64 (aka. "morezero") is quieter than 0 in gusvoltable
 
 		// flip channel
-		voiceused[ch->aguschannel] = -4; // shutting down
+		voiceused[v->aguschannel] = -4; // shutting down
 	}
 
 	// 8bb: find available GUS voice
 	bool nochannel = true;
 	while (nochannel)
 	{
-		ch->m_oldpos = ch->m_pos;
+		oldpos[channel] = v->m_pos;
 		for (int32_t i = 0; i < g_maxvoices; i++)
 		{
 			if (++voicetry >= g_maxvoices)
@@ -251,26 +290,27 @@ void gcmd_update(zchn_t *ch)
 			freevoices(); // changes setvoice
 	}
 
-	if ((uint16_t)ch->m_end == 0) // 8bb: test lower word here
+	if ((uint16_t)v->m_end == 0) // 8bb: test lower word here
 	{
 		voiceused[voicetry] = 0;
-		ch->aguschannel = -1;
+		v->aguschannel = -1;
 		return;
 	}
 
 	// 8bb: assign channel
 
 	voiceused[voicetry] = 1;
-	ch->aguschannel = voicetry;
+	v->aguschannel = voicetry;
+	voicechannel[voicetry] = (int8_t)channel;
 	GUS_VoiceSelect(voicetry);
 
-	if (ch->m_end == 0)
+	if (v->m_end == 0)
 	{
 		// channel quiet, don't mark it used
 		
-		voiceused[ch->aguschannel] = -1;
-		ch->aguschannel = -1;
-		ch->m_oldvol = ch->m_vol = 0;
+		voiceused[v->aguschannel] = -1;
+		v->aguschannel = -1;
+		v->m_oldvol = v->m_vol = 0;
 	}
 
 	// clear volume & stop voice
@@ -278,36 +318,38 @@ void gcmd_update(zchn_t *ch)
 	GUS_SetCurrVolume(0);
 
 	// set pan
-	if (song.stereomode && ch->apanpos >= 0xF0)
-		GUS_SetBalance(ch->apanpos & 0x0F);
+	if (song.stereomode && panpos[channel] >= 0xF0)
+		GUS_SetBalance(panpos[channel] & 0x0F);
 	else
-		GUS_SetBalance(stchannelpan[ch->channelnum]);
+		GUS_SetBalance(stchannelpan[channel]);
 
 	//GUS_SetVoiceCtrl(0b00000010); // stop (8bb: Again. Why?)
 
-	GUS_SetEndAddress(ch->m_base + ch->m_end); // loop end
+	GUS_SetEndAddress(v->m_base + v->m_end); // loop end
 
 	// loop start
-	if ((uint16_t)ch->m_loop == 65535) // 8bb: no loop
-		GUS_SetStartAddress(ch->m_base);
+	if ((uint16_t)v->m_loop == 65535) // 8bb: no loop
+		GUS_SetStartAddress(v->m_base);
 	else
-		GUS_SetStartAddress(ch->m_base + ch->m_loop);
+		GUS_SetStartAddress(v->m_base + v->m_loop);
 
-	GUS_SetCurrAddress(ch->m_base + ch->m_pos); // begin/curpos
+	GUS_SetCurrAddress(v->m_base + v->m_pos); // begin/curpos
 
 	// hz
-	GUS_SetFrequency((uint16_t)(ch->m_speed >> 6));
+	GUS_SetFrequency((uint16_t)(v->m_speed >> 6));
 
-	if (ch->aguschannel >= 0) // 8bb: added protection (yes, <0 can happen!)
+	if (v->aguschannel >= 0) // 8bb: added protection (yes, <0 can happen!)
 	{
-		if (ch->m_end == 0)
-			channeltrig[ch->aguschannel] = 0b00000010; // stop
-		else if ((uint16_t)ch->m_loop == 65535)
-			channeltrig[ch->aguschannel] = 0b00000000; // noloop
+		if (v->m_end == 0)
+			channeltrig[v->aguschannel] = 0b00000010; // stop
+		else if ((uint16_t)v->m_loop == 65535)
+			channeltrig[v->aguschannel] = 0b00000000; // noloop
 		else
-			channeltrig[ch->aguschannel] = 0b00001000; // loop
+			channeltrig[v->aguschannel] = 0b00001000; // loop
 	}
 
 	// finally slide volumeon (8bb: what's this 1->2 volume logic..?)
-	setvolslide(ch, (ch->m_vol == 1) ? 2 : 1, ch->m_vol);
+	setvolslide(v, (v->m_vol == 1) ? 2 : 1, v->m_vol);
 }
+
+#endif
@@ -6,4 +6,8 @@
 void gcmd_inittables(void);
 void gcmd_setvoices(uint8_t numVoices);
 void gcmd_setstereo(void);
-void gcmd_update(zchn_t *ch);
+void gcmd_resetchannels(void);
+void gcmd_setpan(int32_t channel, uint8_t pan); // 8bb: zchn_t.apanpos
+void gcmd_retrig(int32_t channel);
+int32_t gcmd_getvoicechannel(int32_t voice); // 8bb: -1 = never used
+void gcmd_update(int32_t channel); // 8bb: reads mixvoice[channel], -1 = trigger the voices
@@ -14,7 +14,9 @@
 #include <string.h>
 #include "digdata.h"
 #include "dig.h"
-#include "opl2/opl2.h"
+#include "digevent.h"
+
+#ifndef ST3_NO_ADLIB // 8bb: small-footprint profile, see digdata.h
 
 static const uint8_t emptyadlibins[12] = { 0,0,63,63,0,0,0,0,0,0,0,0 };
 static const uint8_t adlibiadd[9] = { 0,1,2,8,9,10,16,17,18 }; // melodic sounds 0..8
@@ -27,7 +29,7 @@ static void outaw(uint8_t reg, uint8_t data)
 
 	adlibmem[reg] = data;
 
-	OPL2_WritePort(reg, data);
+	addopl2event(reg, data); // 8bb: written to the OPL2 in applytickevents() (digevent.c)
 }
 
 static void outnote(uint8_t channel, uint16_t note)
@@ -86,7 +88,11 @@ void doadlib(zchn_t *ch, uint8_t adLibCh)
 {
 	assert(adLibCh <= 8);
 
-	song.adlibused = true;
+	if (!song.adlibused)
+	{
+		song.adlibused = true;
+		selectrenderfunc(); // 8bb: start mixing the OPL2 output
+	}
 
 	// INSTRUMENT***
 	if (ch->ins != 0)
@@ -102,24 +108,20 @@ void doadlib(zchn_t *ch, uint8_t adLibCh)
 				reloadIns = true;
 			}
 
-			ds_adl *ins = (ds_adl *)&song.ins[ch->ins-1];
+			const zins_t *ins = &song.zins[ch->ins-1];
 			if (ins->type != 2) // adlibins
 			{
 				ch->lastadlins = 0;
 				return;
 			}
 
-			uint16_t c2spd = (uint16_t)ins->c2spd; // 8bb: this will cause problems if adlib c2spd > 65535
-			if (c2spd < 1000)
-				c2spd = C2FREQ;
-
-			ch->ac2spd = c2spd;
+			ch->ac2spd = ins->c2spd; // 8bb: <1000 was replaced with C2FREQ by the loader
 
 			ch->avol = ins->vol;
 			setvol(ch);
 
 			if (reloadIns)
-				adlibloadins(adLibCh, (uint8_t *)&ins->D00);
+				adlibloadins(adLibCh, ins->adlib);
 		}
 	}
 
@@ -213,16 +215,16 @@ void updateadlib(void)
 		{
 			// retrig volume
 
-			if (ch->lastadlins > 0) // 8bb: added this protection!
+			if (ch->lastadlins > 0 && ch->lastadlins <= MAX_INSTRUMENTS) // 8bb: added this protection! (lastadlins starts at 101)
 			{
-				ds_adl *ins = (ds_adl *)&song.ins[ch->lastadlins-1];
+				const uint8_t *ins = song.zins[ch->lastadlins-1].adlib; // 8bb: D00..D0B
 
 				// calc volumes
 
 				// modulator
-				if (ins->D0A & 1)
+				if (ins[0x0A] & 1)
 				{
-					uint8_t volOut = (0 - (ins->D02 & 63)) + 63;
+					uint8_t volOut = (0 - (ins[0x02] & 63)) + 63;
 					if (ch->avol < 63)
 					{
 						uint8_t vol = ch->avol;
@@ -233,13 +235,13 @@ void updateadlib(void)
 					}
 
 					volOut = (0 - volOut) + 63;
-					volOut |= ins->D02 & (64 | 128);
+					volOut |= ins[0x02] & (64 | 128);
 
 					outaw(0x40 + adlibiadd[i], volOut);
 				}
 
 				// carrier
-				uint8_t volOut = (0 - (ins->D03 & 63)) + 63;
+				uint8_t volOut = (0 - (ins[0x03] & 63)) + 63;
 				if (ch->avol < 63)
 				{
 					uint8_t vol = ch->avol;
@@ -250,7 +252,7 @@ void updateadlib(void)
 				}
 
 				volOut = (0 - volOut) + 63;
-				volOut |= ins->D03 & (64 | 128);
+				volOut |= ins[0x03] & (64 | 128);
 
 				outaw(0x43 + adlibiadd[i], volOut);
 			}
@@ -259,3 +261,5 @@ void updateadlib(void)
 		ch->addherzretrig = 0;
 	}
 }
+
+#endif
@@ -6,8 +6,10 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "dig.h"
 #include "digdata.h"
+#include "digevent.h"
 
 void doamiga(zchn_t *ch)
 {
@@ -20,46 +22,41 @@ void doamiga(zchn_t *ch)
 		{
 			ch->lastins = ch->ins;
 
-			const ds_smp *ins = &song.ins[ch->ins-1];
+			const zins_t *ins = &song.zins[ch->ins-1];
 			if (ins->type != 0)
 			{
 				if (ins->type == 1) // sample
 				{
-					ch->ac2spd = (uint16_t)ins->c2spd; // 8bb: clamped to 0..65535 in sample loader
-					ch->avol = CLAMP((int8_t)ins->vol, 0, 63);
+					ch->ac2spd = ins->c2spd;
+					ch->avol = ins->vol;
 					ch->aorgvol = ch->avol;
 					setvol(ch);
 
-					ch->m_base = ins->baseptr;
+					song.lazywaitmask &= ~CHANNEL_BIT(ch);
 
-					uint16_t lend = (uint16_t)ins->lend;
-					if ((ins->flags & 1) && lend != 0) // 8bb: loop enabled?
+					// 8bb: loop points were precomputed by the loader (buildins() in load.c)
+					if (ins->baseptr == NULL && song.shared != NULL) // 8bb: lazily loaded sample?
 					{
-						// loop, expand if <500 bytes long
-						const uint16_t lbeg = (uint16_t)ins->lbeg; // loop start
-						ch->m_loop = lbeg;
-
-						if (lend <= 500)
+						if (renderToWavFlag) // 8bb: no audio thread, we can load it right here
 						{
-							int16_t a = lbeg - lend; // -looplen
-							do
-							{
-								lend -= a;
-							}
-							while (lend < 500);
-
-							lend += a;
+							song.zins[ch->ins-1].baseptr = st3_materializeins(song.shared, ch->ins);
+							setvoicesample(ch, ch->ins-1);
+						}
+						else if (st3_requestins(song.shared, ch->ins, &song.zins[ch->ins-1].baseptr))
+						{
+							setvoicesample(ch, ch->ins-1);
+						}
+						else
+						{
+							// 8bb: not loaded yet, keep the voice silent until updatelazyvoices() sees it
+							setvoicesample(ch, ch->ins-1);
+							setvoiceend(ch, 0);
+							song.lazywaitmask |= CHANNEL_BIT(ch);
 						}
-
-						ch->m_end = lend;
 					}
-					else // no loop
+					else
 					{
-						uint16_t length = (uint16_t)ins->length;
-						length += 32; // extra fadeout for GUS (8bb: also applies to SB, and can also overflow)
-
-						ch->m_end = length;
-						ch->m_loop = 65535; // 8bb: disable loop
+						setvoicesample(ch, ch->ins-1);
 					}
 				}
 				else // 8bb: not a PCM sample
@@ -89,8 +86,9 @@ void doamiga(zchn_t *ch)
 		{
 			// end sample
 
-			ch->m_pos = 1;
-			ch->m_poslow = 0; // 8bb: also clear position frac
+			song.lazywaitmask &= ~CHANNEL_BIT(ch);
+
+			setvoicepos(ch, 1, true); // 8bb: also clear position frac
 
 			ch->aspd = 0;
 			setspd(ch);
@@ -98,8 +96,8 @@ void doamiga(zchn_t *ch)
 			ch->avol = 0;
 			setvol(ch);
 
-			ch->m_end = 0;
-			ch->m_loop = 65535; // 8bb: disable loop
+			setvoiceend(ch, 0);
+			setvoiceloop(ch, 65535); // 8bb: disable loop
 
 			ch->asldspd = 65535; // 8bb: accidental label-jump typo in asm code causes this
 		}
@@ -108,10 +106,9 @@ void doamiga(zchn_t *ch)
 			// restart sample
 			if (ch->cmd != 'G'-64 && ch->cmd != 'L'-64)
 			{
-				ch->m_pos = ch->astartoffset;
-				ch->m_poslow = 0; // 8bb: also clear position frac
+				setvoicepos(ch, ch->astartoffset, true); // 8bb: also clear position frac
 
-				ch->m_oldpos = 0x12345678; // 8bb: this forces a GUS retrigger
+				retrigvoice(ch); // 8bb: this forces a GUS retrigger
 			}
 
 			// calc note speed
@@ -139,3 +136,36 @@ void doamiga(zchn_t *ch)
 		ch->aorgvol = ch->vol;
 	}
 }
+
+/* 8bb: Not in ST3. Called on every tick (updateregs()) while channels wait
+** for a lazily loaded sample. Once the main thread has loaded it, the voice
+** gets its sample and starts playing from where it would be by now (the SB
+** mixer doesn't advance silent voices, so that's from the trigger position).
+*/
+void updatelazyvoices(void)
+{
+	uint64_t mask = song.lazywaitmask;
+	while (mask != 0)
+	{
+		zchn_t *ch = &song._zchn[lowestbit64(mask)];
+		mask &= mask - 1;
+
+		if (ch->lastins == 0 || ch->lastins >= MAX_INSTRUMENTS)
+		{
+			song.lazywaitmask &= ~CHANNEL_BIT(ch);
+			continue;
+		}
+
+		int8_t *baseptr;
+		if (!st3_requestins(song.shared, ch->lastins, &baseptr))
+			continue;
+
+		song.lazywaitmask &= ~CHANNEL_BIT(ch);
+		song.zins[ch->lastins-1].baseptr = baseptr;
+		if (baseptr != NULL)
+		{
+			setvoicesample(ch, ch->lastins-1);
+			retrigvoice(ch); // 8bb: GUS only
+		}
+	}
+}
@@ -3,3 +3,4 @@
 #include "digdata.h"
 
 void doamiga(zchn_t *ch);
+void updatelazyvoices(void);
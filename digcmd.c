@@ -10,6 +10,7 @@
 #include "digread.h"
 #include "digdata.h"
 #include "digcmd.h"
+#include "digevent.h"
 
 #define GET_LAST_NFO if (ch->info == 0) ch->info = ch->alastnfo;
 
@@ -155,6 +156,45 @@ static const effect_routine sotherjmp[27] = // when not new note (8bb: tick>0 on
 	s_ret          // Z
 };
 
+// 8bb: docmd1() flags, instead of comparing against 'D'/'I'/'H'/'U'/'K'/'R'
+enum
+{
+	CMD_FIXTRIGGER = 1, // 8bb: D
+	CMD_KEEPTREMOR = 2, // 8bb: I
+	CMD_KEEPVIBCNT = 4  // 8bb: H/U/K/R
+};
+
+static const uint8_t cmdflags[27] =
+{
+	0,              // .
+	0,              // A
+	0,              // B
+	0,              // C
+	CMD_FIXTRIGGER, // D
+	0,              // E
+	0,              // F
+	0,              // G
+	CMD_KEEPVIBCNT, // H
+	CMD_KEEPTREMOR, // I
+	0,              // J
+	CMD_KEEPVIBCNT, // K
+	0,              // L
+	0,              // M
+	0,              // N
+	0,              // O
+	0,              // P
+	0,              // Q
+	CMD_KEEPVIBCNT, // R
+	0,              // S
+	0,              // T
+	CMD_KEEPVIBCNT, // U
+	0,              // V
+	0,              // W
+	0,              // X
+	0,              // Y
+	0               // Z
+};
+
 static void s_ret(zchn_t *ch) // 8bb: dummy effect (for unused effects)
 {
 	(void)ch;
@@ -164,78 +204,56 @@ void docmd1(void) // cmds done once (&0vol cutting) (8bb: tick=0 commands)
 {
 	const int8_t oldKxyLxxVolslideType = song.KxyLxxVolslideType;
 
-	zchn_t *ch = song._zchn;
-	for (uint8_t i = 0; i <= song.lastachannelused; i++, ch++)
+	song.numtickcmds = 0;
+
+	// 8bb: only visit channels with achannelused!=0
+	uint64_t mask = song.usedmask & lastchannelmask(song.lastachannelused);
+	while (mask != 0)
 	{
-		if (ch->achannelused != 0)
-		{
-			// 8bb: "a0clearcnt" handling is not ported, it's triggered by jamming notes in the tracker
+		zchn_t *ch = &song._zchn[lowestbit64(mask)];
+		mask &= mask - 1;
 
-			/* 8bb: "vol0 optimization" flag handling.
-			** There's a label-bug with "ch->cmd != 0" in the original code,
-			** but doing it like this gives the same result.
-			*/
-			if (song.masterflags & 8)
+		// 8bb: "a0clearcnt" handling is not ported, it's triggered by jamming notes in the tracker
+
+		/* 8bb: "vol0 optimization" flag handling.
+		** There's a label-bug with "ch->cmd != 0" in the original code,
+		** but doing it like this gives the same result.
+		*/
+		if (song.masterflags & 8)
+		{
+			if (ch->cmd != 0 || ch->avol != 0 || ch->vol != 255 || ch->ins != 0 || ch->note != 255)
 			{
-				if (ch->cmd != 0 || ch->avol != 0 || ch->vol != 255 || ch->ins != 0 || ch->note != 255)
-				{
-					ch->a0volcut = 3;
-				}
-				else
-				{
-					ch->a0volcut--;
-					if (ch->a0volcut == 0)
-					{
-						// shutdown channel
-						ch->m_end = 0;
-						ch->m_pos = 65535;
-						ch->achannelused = 0;
-						continue;
-					}
-				}
+				ch->a0volcut = 3;
 			}
-
-			if (ch->info > 0)
-				ch->alastnfo = ch->info;
-
-			if (ch->cmd > 0)
+			else
 			{
-				ch->achannelused |= 0x80;
-
-				if (ch->cmd == 'D'-64)
+				ch->a0volcut--;
+				if (ch->a0volcut == 0)
 				{
-					// fix trigger D
+					// shutdown channel
+					setvoiceend(ch, 0);
+					setvoicepos(ch, 65535, false);
+					song.lazywaitmask &= ~CHANNEL_BIT(ch);
+					ch->achannelused = 0;
+					song.usedmask &= ~CHANNEL_BIT(ch);
+					song.dirtymask &= ~CHANNEL_BIT(ch);
+					continue;
+				}
+			}
+		}
 
-					ch->atrigcnt = 0;
+		if (ch->info > 0)
+			ch->alastnfo = ch->info;
 
-					// fix speed if tone port noncomplete
-					if (ch->aspd != ch->aorgspd)
-					{
-						ch->aspd = ch->aorgspd;
-						setspd(ch);
-					}
-				}
-				else
-				{
-					if (ch->cmd != 'I'-64)
-					{
-						ch->atremor = 0;
-						ch->atreon = true;
-					}
-
-					if (ch->cmd != 'H'-64 && ch->cmd != 'U'-64 && ch->cmd != 'K'-64 && ch->cmd != 'R'-64)
-						ch->avibcnt |= 128;
-				}
+		if (ch->cmd > 0)
+		{
+			ch->achannelused |= 0x80;
+			song.dirtymask |= CHANNEL_BIT(ch);
 
-				if (ch->cmd < 27)
-				{
-					song.KxyLxxVolslideType = 0;
-					soncejmp[ch->cmd](ch);
-				}
-			}
-			else
+			const uint8_t flags = (ch->cmd < 27) ? cmdflags[ch->cmd] : 0;
+			if (flags & CMD_FIXTRIGGER)
 			{
-				// fix trigger 0
+				// fix trigger D
 
 				ch->atrigcnt = 0;
 
@@ -245,14 +263,59 @@ void docmd1(void) // cmds done once (&0vol cutting) (8bb: tick=0 commands)
 					ch->aspd = ch->aorgspd;
 					setspd(ch);
 				}
+			}
+			else
+			{
+				if (!(flags & CMD_KEEPTREMOR))
+				{
+					ch->atremor = 0;
+					ch->atreon = true;
+				}
+
+				if (!(flags & CMD_KEEPVIBCNT))
+					ch->avibcnt |= 128;
+			}
+
+			if (ch->cmd < 27)
+			{
+				song.KxyLxxVolslideType = 0;
+				soncejmp[ch->cmd](ch);
+
+				/* 8bb: Resolve the tick>0 routine for docmd2() now. For S commands,
+				** s_scommand1() has already done GET_LAST_NFO, so the info
+				** nibble is the same as what s_scommand2() would see.
+				*/
+				effect_routine routine = sotherjmp[ch->cmd];
+				if (routine == s_scommand2)
+					routine = ssotherjmp[ch->info >> 4];
 
-				if (!song.amigalimits && ch->cmd < 27)
+				if (routine != s_ret)
 				{
-					song.KxyLxxVolslideType = 0;
-					soncejmp[ch->cmd](ch);
+					tickcmd_t *t = &song.tickcmds[song.numtickcmds++];
+					t->ch = ch;
+					t->routine = routine;
 				}
 			}
 		}
+		else
+		{
+			// fix trigger 0
+
+			ch->atrigcnt = 0;
+
+			// fix speed if tone port noncomplete
+			if (ch->aspd != ch->aorgspd)
+			{
+				ch->aspd = ch->aorgspd;
+				setspd(ch);
+			}
+
+			if (!song.amigalimits && ch->cmd < 27)
+			{
+				song.KxyLxxVolslideType = 0;
+				soncejmp[ch->cmd](ch);
+			}
+		}
 	}
 
 	song.KxyLxxVolslideType = oldKxyLxxVolslideType;
@@ -262,18 +325,22 @@ void docmd2(void) // cmds done when not next row (8bb: tick>0 commands)
 {
 	int8_t oldKxyLxxVolslideType = song.KxyLxxVolslideType;
 
-	zchn_t *ch = song._zchn;
-	for (uint8_t i = 0; i <= song.lastachannelused; i++, ch++)
+	/* 8bb: Walk the list made by docmd1(). Channels with a command that does
+	** nothing on tick>0 aren't in it, they would only get bit 7 set in
+	** achannelused, which isn't read by anything but updateregs().
+	*/
+	const tickcmd_t *t = song.tickcmds;
+	for (int32_t i = 0; i < song.numtickcmds; i++, t++)
 	{
-		if (ch->achannelused != 0 && ch->cmd > 0)
-		{
-			ch->achannelused |= 0x80;
-			if (ch->cmd < 27)
-			{
-				song.KxyLxxVolslideType = 0;
-				sotherjmp[ch->cmd](ch);
-			}
-		}
+		zchn_t *ch = t->ch;
+		if (ch->achannelused == 0)
+			continue;
+
+		ch->achannelused |= 0x80;
+		song.dirtymask |= CHANNEL_BIT(ch);
+
+		song.KxyLxxVolslideType = 0;
+		t->routine(ch);
 	}
 
 	song.KxyLxxVolslideType = oldKxyLxxVolslideType;
@@ -871,8 +938,8 @@ static void s_retrig(zchn_t *ch)
 
 	ch->atrigcnt = 0;
 
-	ch->m_pos = 0;
-	ch->m_oldpos = 0xFFFFFFFF; // 8bb: this forces a GUS trigger
+	setvoicepos(ch, 0, false);
+	retrigvoice(ch); // 8bb: this forces a GUS trigger
 
 	if (retrigvoladd[infohi+16] == 0)
 		ch->avol += retrigvoladd[infohi]; // add/sub
@@ -920,7 +987,7 @@ static void s_notecutb(zchn_t *ch)
 	{
 		ch->anotecutcnt--;
 		if (ch->anotecutcnt == 0)
-			ch->m_speed = 0; // 8bb: shut down voice (recoverable by using pitch effects)
+			setvoicespeed(ch, 0); // 8bb: shut down voice (recoverable by using pitch effects)
 	}
 }
 
@@ -997,7 +1064,7 @@ static void s_stereocntr(zchn_t *ch) // SAx
 	*/
 
 	if ((ch->info & 0xF) <= 7)
-		ch->amixtype = ch->info & 0xF;
+		setvoicemixtype(ch, ch->info & 0xF);
 }
 
 static void s_patloop(zchn_t *ch)
@@ -1036,8 +1103,8 @@ static void s_setgliss(zchn_t *ch)
 static void s_setpanpos(zchn_t *ch)
 {
 	// 8bb: the 0xF0 part means that this channel has a pan set
-	ch->apanpos = 0xF0 | (ch->info & 0xF);
+	setvoicepan(ch, 0xF0 | (ch->info & 0xF));
 
 	// 8bb: this forces a GUS update, and sample trigger (pos set to last ch->m_pos (?) ), so you get a click!
-	ch->m_oldpos = 0xFFFFFFFF;
+	retrigvoice(ch);
 }
@@ -9,7 +9,7 @@
 #include "digdata.h"
 
 // 8bb: custom data
-song_t song;
+ALIGN64 song_t song;
 audio_t audio;
 // -----------------------------------------
 
@@ -10,20 +10,111 @@
 // 9 LAdlib + 5 LAdlibDrums + 2 unused
 // 9 RAdlib + 5 RAdlibDrums + 2 unused
 #define ACHANNELS 48
+#define ALLCHANNELS_MASK (((uint64_t)1 << ACHANNELS) - 1)
+#define CHANNEL_BIT(ch) ((uint64_t)1 << (ch)->channelnum)
 
 // 8bb: custom defines
 
-#define MAX_ORDERS 256
+// 8bb: FORCEINLINE is for the "template" functions of the mixers (constant NULL parameters)
+#ifdef _MSC_VER
+#define ALIGN64 __declspec(align(64))
+#define FORCEINLINE __forceinline
+#else
+#define ALIGN64 __attribute__ ((aligned(64)))
+#define FORCEINLINE inline __attribute__ ((always_inline))
+#endif
+
+/* 8bb: Define this (f.ex. with -DST3_FIXEDPOINT) to use integer math for
+** the whole output chain (mixing buffers, resampling, OPL2 DC filter and
+** dither), for targets without an FPU. The mixing buffers are then Q15.
+*/
+//#define ST3_FIXEDPOINT
+
+#ifdef ST3_FIXEDPOINT
+typedef int32_t mixsmp_t; // 8bb: Q15 (32768 = 1.0)
+#else
+typedef float mixsmp_t;
+#endif
+
+/* 8bb: Small-footprint profile, for embedded targets. Define these on the
+** command line (or here), ST3_SMALLFOOTPRINT turns them all on:
+**
+** ST3_NO_GUS         - no GUS driver/mixer, always plays in SB Pro mode
+** ST3_NO_ADLIB       - no AdLib driver and OPL2 emulator (AdLib channels are silent)
+** ST3_NO_EXTRA_INTRP - only ZOH, linear and 16-tap sinc interpolation (no RAM
+**                      tables for cubic and 8/32-tap sinc, smaller resampler buffers)
+** ST3_NO_SPDTABLES   - setspd()/roundspd() calculate instead of using 320kB of tables
+**
+** MAX_INSTRUMENTS (1..99) and MAX_PATTERNS (1..100) can also be lowered,
+** songs with more instruments/patterns are then rejected by the loader.
+** Use ST3_LOAD_INPLACEPATTERNS to play patterns directly from (ROM) module
+** data, and st3_memusage() to see the resulting sizes.
+*/
+//#define ST3_SMALLFOOTPRINT
+
+#ifdef ST3_SMALLFOOTPRINT
+#ifndef ST3_NO_GUS
+#define ST3_NO_GUS
+#endif
+#ifndef ST3_NO_ADLIB
+#define ST3_NO_ADLIB
+#endif
+#ifndef ST3_NO_EXTRA_INTRP
+#define ST3_NO_EXTRA_INTRP
+#endif
+#ifndef ST3_NO_SPDTABLES
+#define ST3_NO_SPDTABLES
+#endif
+#endif
+
+#define MAX_ORDERS 256 // 8bb: not configurable, Bxx can jump to any order
+#ifndef MAX_INSTRUMENTS
 #define MAX_INSTRUMENTS 99
+#endif
+#ifndef MAX_PATTERNS
 #define MAX_PATTERNS 100
+#endif
+
+#if MAX_INSTRUMENTS < 1 || MAX_INSTRUMENTS > 99 || MAX_PATTERNS < 1 || MAX_PATTERNS > 100
+#error MAX_INSTRUMENTS must be 1..99 and MAX_PATTERNS 1..100
+#endif
 
 enum
 {
 	SOUNDCARD_GUS = 0,
 	SOUNDCARD_SBPRO = 1,
 };
+
+enum // 8bb: interpolation qualities for setInterpolationQuality()
+{
+	INTRP_ZOH = 0, // 8bb: zero-order hold (no interpolation)
+	INTRP_LINEAR = 1,
+	INTRP_CUBIC = 2, // 8bb: 4-tap cubic (Catmull-Rom)
+	INTRP_SINC8 = 3,
+	INTRP_SINC16 = 4, // 8bb: default
+	INTRP_SINC32 = 5
+};
+
+enum // 8bb: flags for st3_loadsong()
+{
+	ST3_LOAD_LAZYSAMPLES = 1, // 8bb: convert/unroll sample data on first use
+	ST3_LOAD_INPLACEPATTERNS = 2, // 8bb: play well-formed patterns directly from the module data
+};
 // ---------------------------------
 
+/* 8bb: The voice state read by the SB mixer and the GUS driver, split out
+** of zchn_t so that the mixer loop only touches these. 32 bytes, so two
+** voices share a cache line (song._zvoice is 64-byte aligned). The mixers
+** use their own copy (mixvoice[], updated by the tick events in digevent.c).
+*/
+typedef struct zvoice_t
+{
+	int8_t *m_base;
+	uint32_t m_pos, m_poslow, m_end, m_loop, m_speed;
+	uint8_t m_vol, m_oldvol;
+	int8_t amixtype, aguschannel;
+} zvoice_t;
+
 typedef struct zchn_t
 {
 	int8_t aorgvol, avol;
@@ -38,11 +129,8 @@ typedef struct zchn_t
 	uint16_t addherzlo, addherzhi;
 
 	// 8bb: for mixer and GUS
-	int8_t amixtype, aguschannel;
+	zvoice_t *v; // 8bb: = &song._zvoice[channelnum] (set in shutupsounds())
 	uint8_t apanpos;
-	int8_t *m_base;
-	uint8_t m_vol, m_oldvol;
-	uint32_t m_pos, m_poslow, m_oldpos, m_end, m_loop, m_speed;
 } zchn_t;
 
 #ifdef _MSC_VER
@@ -97,8 +185,6 @@ typedef struct ds_smp // instrument block, sample
 	uint32_t lastused; // in ilib, used as time/datestamp (8bb: not used in st3play)
 	char name[28];
 	char _magic[4]; // "SCRS"
-
-	int8_t *baseptr; // 8bb: added this since we don't work with 16-bit segments
 }
 #ifdef __GNUC__
 __attribute__ ((packed))
@@ -141,11 +227,92 @@ ds_adl;
 
 // 8bb: custom structs for convenience
 
+/* 8bb: Runtime instrument, made from the ds_smp/ds_adl header by the loader
+** (see buildins() in load.c). The packed structs are only used for parsing.
+*/
+typedef struct zins_t
+{
+	int8_t *baseptr; // 8bb: sample data (added this since we don't work with 16-bit segments)
+	uint32_t m_loop, m_end; // 8bb: for the voice, <500 byte loops are expanded. m_loop=65535 = no loop
+	uint16_t c2spd; // 8bb: clamped, and AdLib c2spd <1000 is replaced with C2FREQ
+	uint8_t type; // 8bb: 1=sample, 2=AdLib melody, ...
+	int8_t vol; // 8bb: initial channel volume (0..63 for samples)
+	uint8_t adlib[12]; // 8bb: AdLib register block (D00..D0B)
+} zins_t;
+
+typedef struct tickcmd_t // 8bb: a tick>0 effect routine, resolved by docmd1()
+{
+	zchn_t *ch;
+	void (*routine)(zchn_t *ch);
+} tickcmd_t;
+
+/* 8bb: Immutable data of a loaded module. This is reference-counted and
+** read-only after loading, so that several players can share the same
+** patterns and (converted/unrolled) sample data.
+*/
+typedef struct st3_song_t
+{
+	ds_fileheader header;
+	uint8_t order[MAX_ORDERS+1], *patp[MAX_PATTERNS+1];
+	uint16_t patlen[MAX_PATTERNS]; // 8bb: packed pattern data length in bytes
+	uint16_t patrowoffs[MAX_PATTERNS][64]; // 8bb: byte offset of every row in the pattern data
+	bool patinplace[MAX_PATTERNS]; // 8bb: patp points into the module data (ST3_LOAD_INPLACEPATTERNS)
+	ds_smp ins[MAX_INSTRUMENTS+1]; // 8bb: the parsed (and checked) headers
+	zins_t zins[MAX_INSTRUMENTS+1]; // 8bb: owns the sample data
+	uint8_t defaultpan[32];
+	int32_t soundcardtype; // 8bb: detected sound card type
+	volatile int32_t refcount;
+
+	// 8bb: for ST3_LOAD_LAZYSAMPLES
+	const uint8_t *lazydata; // 8bb: module data (owned by the song when loaded from a file)
+	uint8_t *filebuffer;
+	uint32_t datalength;
+	uint32_t lazyoffs[MAX_INSTRUMENTS], lazylength[MAX_INSTRUMENTS]; // 8bb: lazylength is set for all samples
+	uint16_t lazylend512[MAX_INSTRUMENTS]; // 8bb: lend512 from the file, checkins() changes it
+	volatile int32_t lazystate[MAX_INSTRUMENTS];
+} st3_song_t;
+
+typedef struct st3_memusage_t // 8bb: filled by st3_memusage(), in bytes
+{
+	uint32_t player; // 8bb: static replayer/mixer state (song, audio and tables in RAM)
+	uint32_t song; // 8bb: the st3_song_t struct
+	uint32_t patterns, samples; // 8bb: heap memory owned by the song
+	uint32_t filebuffer; // 8bb: module data kept by st3_loadsong() for lazy/in-place loading
+} st3_memusage_t;
+
+typedef struct st3_meters_t // 8bb: filled by getChannelMeters()
+{
+	uint32_t block; // 8bb: counts the metered blocks (musmixer() calls), 0 = none yet
+	uint32_t samples; // 8bb: output samples in the block
+	float peak[32], rms[32]; // 8bb: per ST3 channel, 1.0 = full scale (before the mixing volume)
+} st3_meters_t;
+
+typedef struct st3_loudness_t // 8bb: filled by getLoudness(), -HUGE_VAL = nothing measured (or only silence) yet
+{
+	double integrated; // 8bb: integrated loudness in LUFS (gated), since setLoudnessAnalysis()
+	double momentary, shortTerm; // 8bb: the last 400ms/3s in LUFS (ungated)
+	double maxMomentary, maxShortTerm; // 8bb: in LUFS
+	double truePeak, samplePeak; // 8bb: in dBTP/dBFS, after the mixing volume (unclipped)
+	uint64_t samples; // 8bb: analyzed output samples
+} st3_loudness_t;
+
+typedef struct st3_probe_t // 8bb: module metadata, filled by st3_probe()
+{
+	ds_fileheader header; // 8bb: sanitized the same way as in the loader
+	char insname[MAX_INSTRUMENTS][28]; // 8bb: always zero-terminated
+	uint8_t instype[MAX_INSTRUMENTS]; // 8bb: 1=sample, 2=AdLib melody, ...
+	int32_t numsamples, numadlibins, soundcardtype;
+	bool adlibused; // 8bb: AdLib channels are actually played
+	double dDuration; // 8bb: in seconds, until the song ends or loops
+} st3_probe_t;
+
 typedef struct song_t
 {
+	zvoice_t _zvoice[ACHANNELS]; // 8bb: first, so that it gets the alignment of "song"
+	st3_song_t *shared; // 8bb: the attached song data (patp/zins.baseptr point into this)
 	ds_fileheader header;
 	uint8_t order[MAX_ORDERS+1], *patp[MAX_PATTERNS+1];
-	ds_smp ins[MAX_INSTRUMENTS+1];
+	zins_t zins[MAX_INSTRUMENTS+1];
 	zchn_t _zchn[ACHANNELS];
 
 	bool oldstvib, fastvolslide, amigalimits, stereomode, adlibused;
@@ -160,6 +327,19 @@ typedef struct song_t
 	uint8_t defaultpan[32]; // 8bb: GUS initial channel pans (ST3.20 & ST3.21)
 
 	uint8_t KxyLxxVolslideType; // 8bb: added this, temporary variable used by Kxy/Lxx (instead of bp register)
+
+	/* 8bb: Channel bitmasks (bit n = song._zchn[n]), so that the tick loops
+	** only visit channels that need it. Kept in sync with the fields:
+	** usedmask = achannelused!=0, dirtymask = achannelused&128,
+	** cellmask = note/ins/vol/cmd/info not cleared, cmdmask = cmd!=0.
+	*/
+	uint64_t usedmask, dirtymask, cellmask, cmdmask;
+	uint64_t lazywaitmask; // 8bb: channels waiting for a lazily loaded sample (see updatelazyvoices())
+
+	// 8bb: the effects to run on tick>0 of the current row, in channel order
+	tickcmd_t tickcmds[ACHANNELS];
+	int32_t numtickcmds;
+
 	volatile bool moduleLoaded; // 8bb: added this
 	
 } song_t;
@@ -173,7 +353,13 @@ typedef struct audio_t
 	uint32_t outputFreq; // 8bb: actual audio output speed
 	uint32_t tickSampleCounter, samplesPerTickInt, bpm2SamplesPerTickInt[256], bpm2SamplesPerTickFrac[256];
 	uint64_t tickSampleCounterFrac, samplesPerTickFrac;
-	float *fMixBufferL, *fMixBufferR, fMixingVol;
+	uint64_t samplePos; // 8bb: output samples mixed since zplaysong(), for the tick event timestamps
+	mixsmp_t *mixBufferL, *mixBufferR;
+#ifdef ST3_FIXEDPOINT
+	int32_t mixingVol; // 8bb: 256 = 1.0
+#else
+	float fMixingVol;
+#endif
 } audio_t;
 
 // ------------------------------------------------------------
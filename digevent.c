@@ -0,0 +1,187 @@
+/***********************************************************************
+ **
+ **  Tick events (8bb: replayer -> mixers, see digevent.h)
+ **
+ ***********************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "digdata.h"
+#include "digevent.h"
+#include "dig_gus.h"
+#include "opl2/opl2.h"
+
+ALIGN64 zvoice_t mixvoice[ACHANNELS];
+static tickevents_t tickevents;
+
+static void flushevents(void)
+{
+	const tickevent_t *e = tickevents.list;
+	for (int32_t i = 0; i < tickevents.count; i++, e++)
+	{
+		zvoice_t *v = &mixvoice[e->channel];
+		switch (e->type)
+		{
+			case EV_SAMPLE:
+			{
+				const zins_t *ins = &song.zins[e->value];
+				v->m_base = ins->baseptr;
+				v->m_loop = ins->m_loop;
+				v->m_end = ins->m_end;
+			}
+			break;
+
+			case EV_POS:
+			{
+				v->m_pos = e->value;
+				if (e->arg)
+					v->m_poslow = 0;
+			}
+			break;
+
+			case EV_END: v->m_end = e->value; break;
+			case EV_LOOP: v->m_loop = e->value; break;
+			case EV_SPEED: v->m_speed = e->value; break;
+			case EV_VOLUME: v->m_vol = (uint8_t)e->value; break;
+			case EV_MIXTYPE: v->amixtype = (int8_t)e->value; break;
+
+#ifndef ST3_NO_GUS
+			case EV_PAN: gcmd_setpan(e->channel, (uint8_t)e->value); break;
+			case EV_RETRIG: gcmd_retrig(e->channel); break;
+#endif
+
+#ifndef ST3_NO_ADLIB
+			case EV_OPL2: OPL2_WritePort(e->arg, (uint8_t)e->value); break;
+#endif
+
+			default: break;
+		}
+	}
+
+	tickevents.count = 0;
+}
+
+static void addevent(uint8_t type, const zchn_t *ch, uint16_t arg, uint32_t value)
+{
+	if (tickevents.count >= MAX_TICKEVENTS)
+		flushevents(); // 8bb: same result, since the mixers don't run during a tick
+
+	tickevent_t *e = &tickevents.list[tickevents.count++];
+	e->type = type;
+	e->channel = (ch != NULL) ? ch->channelnum : 0;
+	e->arg = arg;
+	e->value = value;
+}
+
+void setvoicesample(zchn_t *ch, int32_t insNum)
+{
+	const zins_t *ins = &song.zins[insNum];
+	ch->v->m_base = ins->baseptr;
+	ch->v->m_loop = ins->m_loop;
+	ch->v->m_end = ins->m_end;
+
+	addevent(EV_SAMPLE, ch, 0, insNum);
+}
+
+void setvoicepos(zchn_t *ch, uint32_t pos, bool clearFrac)
+{
+	ch->v->m_pos = pos;
+	if (clearFrac)
+		ch->v->m_poslow = 0;
+
+	addevent(EV_POS, ch, clearFrac, pos);
+}
+
+void setvoiceend(zchn_t *ch, uint32_t end)
+{
+	ch->v->m_end = end;
+	addevent(EV_END, ch, 0, end);
+}
+
+void setvoiceloop(zchn_t *ch, uint32_t loop)
+{
+	ch->v->m_loop = loop;
+	addevent(EV_LOOP, ch, 0, loop);
+}
+
+void setvoicespeed(zchn_t *ch, uint32_t speed)
+{
+	ch->v->m_speed = speed;
+	addevent(EV_SPEED, ch, 0, speed);
+}
+
+void setvoicevol(zchn_t *ch, uint8_t vol)
+{
+	ch->v->m_vol = vol;
+	addevent(EV_VOLUME, ch, 0, vol);
+}
+
+void setvoicemixtype(zchn_t *ch, int8_t mixtype)
+{
+	ch->v->amixtype = mixtype;
+	addevent(EV_MIXTYPE, ch, 0, (uint8_t)mixtype);
+}
+
+void setvoicepan(zchn_t *ch, uint8_t panpos)
+{
+	ch->apanpos = panpos;
+	addevent(EV_PAN, ch, 0, panpos);
+}
+
+void retrigvoice(zchn_t *ch)
+{
+	addevent(EV_RETRIG, ch, 0, 0);
+}
+
+void addopl2event(uint8_t reg, uint8_t data)
+{
+	addevent(EV_OPL2, NULL, reg, data);
+}
+
+void begintickevents(uint64_t time)
+{
+	tickevents.time = time;
+}
+
+void applytickevents(void)
+{
+	flushevents();
+
+#ifndef ST3_NO_GUS
+	if (audio.soundcardtype == SOUNDCARD_GUS)
+	{
+		/* 8bb: This has to visit all channels, since gcmd_update() advances
+		** the GUS voice allocator (voicetry) even for idle channels.
+		*/
+		for (int32_t i = 0; i < ACHANNELS; i++)
+			gcmd_update(i); // 8bb: update GUS registers (dig_gus.c)
+
+		gcmd_update(-1); // 8bb: trigger GUS voices (dig_gus.c)
+	}
+#endif
+}
+
+void cleartickevents(void)
+{
+	tickevents.count = 0;
+}
+
+void resetmixvoices(void)
+{
+	memset(mixvoice, 0, sizeof (mixvoice));
+	for (int32_t i = 0; i < ACHANNELS; i++)
+	{
+		mixvoice[i].aguschannel = -1;
+		mixvoice[i].m_oldvol = 255; // 8bb: from shutupsounds2() (GUS)
+	}
+
+#ifndef ST3_NO_GUS
+	gcmd_resetchannels();
+#endif
+}
+
+uint32_t geteventmemusage(void)
+{
+	return sizeof (mixvoice) + sizeof (tickevents);
+}
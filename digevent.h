@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "digdata.h"
+
+/* 8bb: The replayer (dorow()/updateregs()) doesn't change the mixer state
+** directly. Every voice change and OPL2 port write is appended to the
+** event list of the current tick, and applytickevents() hands the list
+** over to the mixers. The SB mixer and the GUS driver only read mixvoice[]
+** (and the OPL2 emulator only gets its port writes) from there, so the
+** replayer could also run ahead of the mixing. song._zvoice is what the
+** replayer has set, the mixers change their own copy (f.ex. the position).
+*/
+
+#define MAX_TICKEVENTS 512 // 8bb: applied early if full (the mixers don't run during a tick)
+
+enum // 8bb: tickevent_t.type
+{
+	EV_SAMPLE = 0, // 8bb: value = song.zins index, sets m_base, m_loop and m_end
+	EV_POS, // 8bb: arg = 1: also clear the position fraction
+	EV_END,
+	EV_LOOP,
+	EV_SPEED,
+	EV_VOLUME,
+	EV_MIXTYPE,
+	EV_PAN, // 8bb: zchn_t.apanpos (GUS)
+	EV_RETRIG, // 8bb: forces a GUS voice retrigger
+	EV_OPL2 // 8bb: arg = register, value = data
+};
+
+typedef struct tickevent_t
+{
+	uint8_t type, channel;
+	uint16_t arg;
+	uint32_t value;
+} tickevent_t;
+
+typedef struct tickevents_t
+{
+	uint64_t time; // 8bb: output sample position of the tick (audio.samplePos)
+	int32_t count;
+	tickevent_t list[MAX_TICKEVENTS];
+} tickevents_t;
+
+extern ALIGN64 zvoice_t mixvoice[ACHANNELS]; // 8bb: voice i = channel i
+
+// 8bb: replayer side, these also update song._zvoice/zchn_t
+void setvoicesample(zchn_t *ch, int32_t insNum); // 8bb: insNum = song.zins index
+void setvoicepos(zchn_t *ch, uint32_t pos, bool clearFrac);
+void setvoiceend(zchn_t *ch, uint32_t end);
+void setvoiceloop(zchn_t *ch, uint32_t loop);
+void setvoicespeed(zchn_t *ch, uint32_t speed);
+void setvoicevol(zchn_t *ch, uint8_t vol);
+void setvoicemixtype(zchn_t *ch, int8_t mixtype);
+void setvoicepan(zchn_t *ch, uint8_t panpos);
+void retrigvoice(zchn_t *ch);
+void addopl2event(uint8_t reg, uint8_t data);
+
+// 8bb: mixer side
+void begintickevents(uint64_t time); // 8bb: stamps the list, events from before the first tick (zplaysong()) are kept
+void applytickevents(void);
+void cleartickevents(void);
+void resetmixvoices(void);
+uint32_t geteventmemusage(void);
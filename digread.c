@@ -4,6 +4,7 @@
  **
  ***********************************************************************/
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "digdata.h"
@@ -134,30 +135,15 @@ static void seekpat(void)
 	if (song.np_patoff != -1)
 		return;
 
-	song.np_patseg = song.patp[song.np_pat];
+	// 8bb: the order list can point to non-existing patterns
+	song.np_patseg = (song.np_pat < song.header.patnum) ? song.patp[song.np_pat] : NULL;
 	if (song.np_patseg != NULL)
 	{
-		int16_t j = 0;
-		if (song.np_row > 0)
-		{
-			int16_t i = song.np_row;
-			while (i > 0)
-			{
-				const uint8_t dat = song.np_patseg[j++];
-				if (dat == 0)
-				{
-					i--;
-				}
-				else
-				{
-					if (dat & 0x20) j += 2;
-					if (dat & 0x40) j += 1;
-					if (dat & 0x80) j += 2;
-				}
-			}
-		}
-
-		song.np_patoff = j;
+		// 8bb: the loader validated the pattern and stored the row offsets (load.c, checkpattern())
+		if (song.np_row < 64)
+			song.np_patoff = song.shared->patrowoffs[song.np_pat][song.np_row];
+		else
+			song.np_patoff = song.shared->patlen[song.np_pat] - 1; // 8bb: the last row terminator (empty row)
 	}
 }
 
@@ -197,6 +183,7 @@ static uint8_t getnote1(void) // getnote for DA notes
 	}
 
 	zchn_t *ch = &song._zchn[channel];
+	song.cellmask |= CHANNEL_BIT(ch);
 
 	// NOTE/INSTRUMENT
 	if (dat & 32)
@@ -220,6 +207,11 @@ static uint8_t getnote1(void) // getnote for DA notes
 	{
 		ch->cmd = song.np_patseg[i++];
 		ch->info = song.np_patseg[i++];
+
+		if (ch->cmd > 0)
+			song.cmdmask |= CHANNEL_BIT(ch);
+		else
+			song.cmdmask &= ~CHANNEL_BIT(ch);
 	}
 
 	song.np_patoff = i;
@@ -228,15 +220,21 @@ static uint8_t getnote1(void) // getnote for DA notes
 
 static void clearnotes(void)
 {
-	zchn_t *ch = song._zchn;
-	for (int32_t i = 0; i < ACHANNELS; i++, ch++)
+	// 8bb: only channels that got pattern data since the last call
+	uint64_t mask = song.cellmask;
+	while (mask != 0)
 	{
+		zchn_t *ch = &song._zchn[lowestbit64(mask)];
+		mask &= mask - 1;
+
 		ch->note = 255;
 		ch->vol = 255;
 		ch->ins = 0;
 		ch->cmd = 0;
 		ch->info = 0;
 	}
+
+	song.cellmask = song.cmdmask = 0;
 }
 
 static void donotes(void)
@@ -258,9 +256,12 @@ void donewnote(uint8_t channel, bool fromNoteDelayEfx)
 {
 	zchn_t *ch = &song._zchn[channel];
 
+	song.usedmask |= CHANNEL_BIT(ch);
+
 	if (fromNoteDelayEfx)
 	{
 		ch->achannelused = 1 | 128;
+		song.dirtymask |= CHANNEL_BIT(ch);
 	}
 	else
 	{
@@ -268,6 +269,7 @@ void donewnote(uint8_t channel, bool fromNoteDelayEfx)
 			song.lastachannelused = ch->channelnum + 1;
 
 		ch->achannelused = 1;
+		song.dirtymask &= ~CHANNEL_BIT(ch);
 
 		if (ch->cmd == 'S'-64 && (ch->info & 0xF0) == 0xD0)
 			return; // we have a note delay, do nothing yet
@@ -282,6 +284,8 @@ void donewnote(uint8_t channel, bool fromNoteDelayEfx)
 
 	if (ch->channelnum <= 15)
 		doamiga(ch);
-	else if (ch->channelnum <= 16+9)
+#ifndef ST3_NO_ADLIB
+	else if (ch->channelnum < 16+9) // 8bb: was "<= 16+9", which gave an out-of-range AdLib channel
 		doadlib(ch, ch->channelnum-16); // melody 0..8
+#endif
 }
@@ -0,0 +1,206 @@
+/* 8bb: Fuzzer for the module loaders and the replayer (libFuzzer/AFL++, or
+** the standalone main() below), see make-fuzz.sh. Every input is probed,
+** loaded with load_st3_from_ram() and with the shared-song loader (lazy
+** samples and in-place patterns, in the other sound card mode), and each
+** time played for FUZZ_BLOCKS musmixer() calls, so that the pattern reader
+** and the effects run on the loaded data. The shared song is played like
+** st3play does it in realtime (samples requested by the replayer, loaded
+** by st3_materializewanted() between the blocks). Run it with ASan/UBSan.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dig.h"
+#include "../tests/testutil.h" // 8bb: renderToWavFlag, and the seeds for the standalone build
+
+#define FUZZ_FREQ 44100
+#define FUZZ_BLOCK 512
+#define FUZZ_BLOCKS 64 // 8bb: 0.74 seconds, ~37 ticks at tempo 125
+
+static void playSong(st3_song_t *s) // 8bb: s = lazy song, or NULL
+{
+	int16_t buffer[FUZZ_BLOCK * 2];
+
+	renderToWavFlag = (s == NULL);
+
+	zplaysong(0);
+	for (int32_t i = 0; i < FUZZ_BLOCKS; i++)
+	{
+		WAVRender_Flag = true; // 8bb: keep going if the song ends
+		musmixer(buffer, FUZZ_BLOCK);
+
+		if (s != NULL)
+			st3_materializewanted(s);
+	}
+
+	renderToWavFlag = true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size > 0x7FFFFFFF)
+		return 0;
+
+	const uint32_t length = (uint32_t)size;
+
+	st3_probe_t info;
+	st3_probe_from_ram(data, length, &info);
+
+	if (!initMusic(FUZZ_FREQ, FUZZ_BLOCK))
+		return 0;
+
+	int32_t soundCardType = SOUNDCARD_SBPRO;
+	if (load_st3_from_ram(data, length, -1))
+	{
+		soundCardType = audio.soundcardtype;
+		playSong(NULL);
+	}
+
+	st3_song_t *s = st3_loadsong_from_ram(data, length, ST3_LOAD_LAZYSAMPLES|ST3_LOAD_INPLACEPATTERNS);
+	if (s != NULL)
+	{
+		if (initMusic(FUZZ_FREQ, FUZZ_BLOCK) && st3_attachsong(s, (soundCardType == SOUNDCARD_GUS) ? SOUNDCARD_SBPRO : SOUNDCARD_GUS))
+			playSong(s);
+
+		st3_releasesong(s);
+	}
+
+	closeMusic(); // 8bb: also detaches the song, the in-place patterns point into data
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+/* 8bb: For compilers without libFuzzer:
+**
+** fuzz_load file...             runs the files (f.ex. a crash or a corpus)
+** fuzz_load -seeds dir          writes the test modules (tests/testutil.c) to dir
+** fuzz_load -mutate n file...   runs n random mutations of each file
+*/
+
+static uint8_t *readFile(const char *fileName, uint32_t *length)
+{
+	FILE *f = fopen(fileName, "rb");
+	if (f == NULL)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	const long fileSize = ftell(f);
+	rewind(f);
+
+	uint8_t *data = (uint8_t *)malloc((fileSize > 0) ? fileSize : 1);
+	if (data == NULL || fread(data, 1, fileSize, f) != (size_t)fileSize)
+	{
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+	*length = (uint32_t)fileSize;
+	return data;
+}
+
+static uint32_t randState = 1;
+
+static uint32_t rnd(uint32_t range) // 8bb: xorshift32
+{
+	randState ^= randState << 13;
+	randState ^= randState >> 17;
+	randState ^= randState << 5;
+	return randState % range;
+}
+
+static void mutateFile(const uint8_t *data, uint32_t length, int32_t iterations)
+{
+	uint8_t *mutated = (uint8_t *)malloc(length);
+	if (mutated == NULL || length == 0)
+	{
+		free(mutated);
+		return;
+	}
+
+	for (int32_t i = 0; i < iterations; i++)
+	{
+		// 8bb: sometimes truncated, most changes in the header/parapointers
+		const uint32_t mutatedLength = ((i & 3) == 0) ? 1 + rnd(length) : length;
+		memcpy(mutated, data, mutatedLength);
+
+		const int32_t numChanges = 1 + rnd(40);
+		for (int32_t j = 0; j < numChanges; j++)
+		{
+			const uint32_t range = (rnd(3) == 0 && mutatedLength > 1200) ? 1200 : mutatedLength;
+			mutated[rnd(range)] = (uint8_t)rnd(256);
+		}
+
+		LLVMFuzzerTestOneInput(mutated, mutatedLength);
+	}
+
+	free(mutated);
+}
+
+static bool writeSeeds(const char *dir)
+{
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		uint32_t length;
+		uint8_t *data = makeTestModule(&testModules[i], &length);
+		if (data == NULL)
+			return false;
+
+		char fileName[1024];
+		snprintf(fileName, sizeof (fileName), "%s/%s.s3m", dir, testModules[i].name);
+
+		FILE *f = fopen(fileName, "wb");
+		if (f == NULL)
+		{
+			free(data);
+			return false;
+		}
+
+		fwrite(data, 1, length, f);
+		fclose(f);
+		free(data);
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && !strcmp(argv[1], "-seeds"))
+		return writeSeeds(argv[2]) ? 0 : 1;
+
+	int32_t iterations = 0, firstFile = 1;
+	if (argc > 2 && !strcmp(argv[1], "-mutate"))
+	{
+		iterations = atoi(argv[2]);
+		firstFile = 3;
+	}
+
+	for (int32_t i = firstFile; i < argc; i++)
+	{
+		uint32_t length;
+		uint8_t *data = readFile(argv[i], &length);
+		if (data == NULL)
+		{
+			printf("Couldn't read %s\n", argv[i]);
+			return 1;
+		}
+
+		if (iterations > 0)
+			mutateFile(data, length, iterations);
+		else
+			LLVMFuzzerTestOneInput(data, length);
+
+		free(data);
+		printf("%s: OK\n", argv[i]);
+	}
+
+	return 0;
+}
+
+#endif
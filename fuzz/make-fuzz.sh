@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Builds the loader/replayer fuzzer (Linux/macOS), run it from the fuzz folder.
+# With clang it's a libFuzzer binary (also usable by AFL++, build it with
+# CC=afl-clang-fast), run it like "bin/fuzz_load bin/corpus bin/seeds".
+# "./make-fuzz.sh gcc" builds the standalone version instead (no libFuzzer),
+# run it like "bin/fuzz_load -mutate 1000 bin/seeds/*.s3m".
+
+SRC="../*.c ../mixer/*.c ../opl2/*.c ../audiodrivers/null/*.c ../tests/testutil.c fuzz_load.c"
+FLAGS="-DNDEBUG -DAUDIODRIVER_NULL -g -O1 -Wall -Wextra -Wshadow -Wno-unused-result -Wno-missing-field-initializers"
+LIBS="-lm -lpthread"
+
+mkdir -p bin/corpus bin/seeds
+
+if [ "$1" == "gcc" ]; then
+	CC=${CC:-gcc}
+	$CC $FLAGS -DFUZZ_STANDALONE -fsanitize=address,undefined $SRC $LIBS -o bin/fuzz_load || exit 1
+	bin/fuzz_load -seeds bin/seeds
+else
+	CC=${CC:-clang}
+	$CC $FLAGS -fsanitize=fuzzer,address,undefined $SRC $LIBS -o bin/fuzz_load || exit 1
+
+	# the seeds are written by a standalone build
+	$CC $FLAGS -DFUZZ_STANDALONE $SRC $LIBS -o bin/fuzz_seeds || exit 1
+	bin/fuzz_seeds -seeds bin/seeds
+fi
@@ -5,6 +5,7 @@
 #include <string.h>
 #include "dig.h"
 #include "digread.h"
+#include "mixer/worker.h" // 8bb: Worker_Yield()
 
 // 8bb: added these so that we can have a "load from RAM" loader as well
 typedef struct
@@ -22,16 +23,225 @@ static void mseek(MEMFILE *buf, int32_t offset, int32_t whence);
 static void mrewind(MEMFILE *buf);
 // ------------------------------------------------------------------------
 
-static void checkins(ds_smp *ins)
+// 8bb: pattern data is clamped to this, so that the 16-bit song.np_patoff can't overflow (see checkpattern())
+#define MAX_PATTERN_DATA (32767-(64+1))
+
+// 8bb: st3_song_t.lazystate[] values
+enum
+{
+	LAZY_READY = 0, // 8bb: baseptr is final (also for non-PCM instruments)
+	LAZY_PENDING = 1,
+	LAZY_BUSY = 2,
+	LAZY_WANTED = 3 // 8bb: the replayer asked for it (st3_requestins()), still pending
+};
+
+static void fixheader(ds_fileheader *h)
+{
+	const bool songMadeWithST3 = (h->cwtv >> 12) == 1;
+
+	h->name[27] = '\0'; // 8bb: added sanitation, so that it's always safe to print this string
+
+	if (h->cwtv == 0x1300)
+		h->flags |= 64; // 8bb: fast volslide flag
+
+	if (!songMadeWithST3 || h->cwtv < 0x1310)
+		h->ultraclick = 16; // 8bb: controls the number of GUS voices to use
+
+	if (h->ffv == 1)
+	{
+		switch (h->mastermul)
+		{
+			case 0: h->mastermul = 0x10; break;
+			case 1: h->mastermul = 0x20; break;
+			case 2: h->mastermul = 0x30; break;
+			case 3: h->mastermul = 0x40; break;
+			case 4: h->mastermul = 0x50; break;
+			case 5: h->mastermul = 0x60; break;
+			case 6: h->mastermul = 0x70; break;
+			case 7: h->mastermul = 0x7F; break;
+			default: break;
+		}
+	}
+
+	if (h->mastermul == 2)
+		h->mastermul = 0x20;
+
+	if (h->mastermul == 2+16)
+		h->mastermul = 0x20+128;
+}
+
+static int32_t detectsoundcard(const ds_fileheader *h, const ds_smp *insList)
+{
+	const ds_smp *ins;
+	bool songMadeWithST3 = (h->cwtv >> 12) == 1;
+
+	/* 8bb: detect if we want to use SB Pro mode (for S3Ms saved by ST3 only).
+	** Thanks to Saga_Musix for this detection idea!
+	**
+	** Apparently the guspos field in the sample headers are all 1 when saved
+	** by ST3 w/ SB. (or all zeroes in some very early ST3.00 modules).
+	*/
+	if (songMadeWithST3 && h->cwtv == 0x1320)
+	{
+		/* 8bb: Some non-ST3 trackers spoof as ST3.20, so do
+		** some extra heuristics to determine if this really
+		** wasn't saved by ST3.
+		*/
+		int32_t gusposOR = 0;
+
+		ins = insList;
+		for (int32_t i = 0; i < h->insnum; i++, ins++)
+		{
+			if (ins->type == 1)
+				gusposOR |= ins->guspos;
+		}
+
+		if (gusposOR == 0) // 8bb: all guspos entries were zero, this is not ST3
+			songMadeWithST3 = false;
+	}
+
+	if (songMadeWithST3)
+	{
+		// 8bb: find out how many PCM samples we have
+		uint32_t numSamples = 0;
+
+		ins = insList;
+		for (int32_t i = 0; i < h->insnum; i++, ins++)
+		{
+			if (ins->type == 1)
+				numSamples++;
+		}
+
+		/* 8bb: we need an ST3 song with at least two PCM samples to reliably
+		** detect if this song was made with an SB Pro.
+		*/
+		if (numSamples >= 2)
+		{
+			int32_t gusposOR = 0;
+
+			ins = insList;
+			for (int32_t i = 0; i < h->insnum; i++, ins++)
+			{
+				if (ins->type == 1)
+					gusposOR |= ins->guspos;
+			}
+
+			/* 8bb: ST3 stored a one in guspos when saved with Sound Blaster.
+			** However, there are early cwtv 0x1300 (ST3.00) modules in the wild where
+			** they are zero. Test for both 0 and 1 in the final ORed value.
+			**/
+			if (gusposOR <= 1)
+				return SOUNDCARD_SBPRO;
+		}
+	}
+
+	return SOUNDCARD_GUS;
+}
+
+/* 8bb: Validates packed pattern data once at load time, so that
+** getnote1() can read it without any bounds checking. The output has
+** exactly 64 row terminators (missing ones are added), truncated cells
+** are dropped. rowoffs[] gets the offset of every row, for seekpat().
+** Rows >=64 (Cxx can start at row 99) are read from the last row
+** terminator (*outLength-1), as empty rows.
+*/
+static uint8_t *checkpattern(const uint8_t *src, uint32_t srcLength, uint16_t *rowoffs, uint16_t *outLength)
+{
+	uint8_t *dst = (uint8_t *)malloc(srcLength + 64);
+	if (dst == NULL)
+		return NULL;
+
+	uint32_t i = 0, j = 0;
+	for (int32_t row = 0; row < 64; row++)
+	{
+		rowoffs[row] = (uint16_t)j;
+
+		while (i < srcLength)
+		{
+			const uint8_t dat = src[i];
+			if (dat == 0)
+			{
+				i++;
+				break;
+			}
+
+			uint32_t cellLength = 1;
+			if (dat &  32) cellLength += 2;
+			if (dat &  64) cellLength += 1;
+			if (dat & 128) cellLength += 2;
+
+			if (i+cellLength > srcLength)
+			{
+				i = srcLength; // 8bb: truncated cell, drop it
+				break;
+			}
+
+			memcpy(&dst[j], &src[i], cellLength);
+			i += cellLength;
+			j += cellLength;
+		}
+
+		dst[j++] = 0; // end of row
+	}
+
+	*outLength = (uint16_t)j;
+
+	uint8_t *p = (uint8_t *)realloc(dst, j); // 8bb: give back the unused part
+	if (p != NULL)
+		dst = p;
+
+	return dst;
+}
+
+/* 8bb: For ST3_LOAD_INPLACEPATTERNS. Returns true if the pattern data is
+** already in the form that checkpattern() makes (64 row terminators, no
+** truncated cells), so that it can be played without a copy.
+*/
+static bool scanpattern(const uint8_t *src, uint32_t srcLength, uint16_t *rowoffs, uint16_t *outLength)
+{
+	uint32_t i = 0;
+	for (int32_t row = 0; row < 64; row++)
+	{
+		rowoffs[row] = (uint16_t)i;
+
+		while (true)
+		{
+			if (i >= srcLength)
+				return false; // 8bb: missing row terminator
+
+			const uint8_t dat = src[i];
+			if (dat == 0)
+			{
+				i++;
+				break;
+			}
+
+			uint32_t cellLength = 1;
+			if (dat &  32) cellLength += 2;
+			if (dat &  64) cellLength += 1;
+			if (dat & 128) cellLength += 2;
+
+			if (i+cellLength > srcLength)
+				return false; // 8bb: truncated cell
+
+			i += cellLength;
+		}
+	}
+
+	*outLength = (uint16_t)i;
+	return true;
+}
+
+static bool checkins(ds_smp *ins) // 8bb: returns true if the sample data needs to be unrolled with unrollins()
 {
 	// 8bb: only check PCM samples (nasty, AdLib c2spd isn't clamped and is read as uint16_t in digadl.c)
 	if (ins->type != 1)
-		return;
+		return false;
 
 	if (ins->length == 0)
 	{
 		ins->flags &= 0xFE;
-		return;
+		return false;
 	}
 
 	if (ins->vol > 64) ins->vol = 64;
@@ -48,17 +258,31 @@ static void checkins(ds_smp *ins)
 	if (ins->lbeg > ins->length) ins->lbeg = ins->length;
 	if (ins->lend > ins->length) ins->lend = ins->length;
 
+	if (ins->lend <= ins->lbeg)
+		ins->flags &= 0xFE; // 8bb: empty loop after clamping (would hang the <500 loop expansion in doamiga())
+
+	// 8bb: the sample data is changed by unrollins(), which needs the old lend512 value
+	if (ins->flags & 1)
+		ins->lend512 = (uint16_t)ins->lend;
+	else
+		ins->lend512 = 0;
+
+	return true;
+}
+
+static void unrollins(const ds_smp *ins, int8_t *baseptr, uint16_t lend512) // 8bb: lend512 = the value before checkins()
+{
 	// do sample continuing for fast looping
 	if (ins->flags & 1) // 8bb: loop enabled?
 	{
 		uint16_t u = (uint16_t)ins->lend;
 		uint16_t v = (uint16_t)ins->lbeg;
 
-		int8_t *p = ins->baseptr;
+		int8_t *p = baseptr;
 
-		if (ins->lend512 > 0)
+		if (lend512 > 0)
 		{
-			for (uint32_t i = ins->lend512; i < ins->length; i++)
+			for (uint32_t i = lend512; i < ins->length; i++)
 				p[i] = p[i+512];
 		}
 
@@ -67,21 +291,20 @@ static void checkins(ds_smp *ins)
 
 		for (uint32_t i = 0; i < 512; i++)
 			p[u+i] = p[v+i];
-
-		ins->lend512 = (uint16_t)ins->lend;
 	}
 	else
 	{
-		int8_t *p = ins->baseptr + ins->length;
+		int8_t *p = baseptr;
 
-		if (ins->lend512 > 0)
+		if (lend512 > 0)
 		{
-			for (uint32_t i = ins->lend512; i < ins->length; i++)
+			// 8bb: this used p+length (out of bounds), undo the unrolled loop like above instead
+			for (uint32_t i = lend512; i < ins->length; i++)
 				p[i] = p[i+512];
-
-			ins->lend512 = 0;
 		}
 
+		p += ins->length;
+
 		// 8bb: fade-out non-looping sample
 
 		int8_t a = p[-1];
@@ -104,254 +327,978 @@ static void checkins(ds_smp *ins)
 	}
 }
 
-static void checkinstruments(void)
+static void checkinstruments(st3_song_t *s)
 {
-	if (song.header.ultraclick == 0)
-		song.header.ultraclick = 16;
+	if (s->header.ultraclick == 0)
+		s->header.ultraclick = 16;
 
-	ds_smp *ins = song.ins;
+	ds_smp *ins = s->ins;
 	for (int32_t i = 0; i < MAX_INSTRUMENTS; i++, ins++)
-		checkins(ins);
+	{
+		const uint16_t lend512 = ins->lend512;
+		if (checkins(ins) && s->lazystate[i] == LAZY_READY)
+			unrollins(ins, s->zins[i].baseptr, lend512);
+	}
 }
 
-bool load_st3_from_ram(const uint8_t *data, uint32_t dataLength, int32_t soundCardType)
+static void buildins(st3_song_t *s) // 8bb: makes the runtime instrument table from the checked headers
+{
+	const ds_smp *ins = s->ins;
+	zins_t *z = s->zins;
+	for (int32_t i = 0; i < MAX_INSTRUMENTS; i++, ins++, z++)
+	{
+		z->type = ins->type;
+
+		if (ins->type == 1) // sample
+		{
+			z->c2spd = (uint16_t)ins->c2spd; // 8bb: clamped to 0..65535 in checkins()
+			z->vol = CLAMP((int8_t)ins->vol, 0, 63);
+
+			uint16_t lend = (uint16_t)ins->lend;
+			if ((ins->flags & 1) && lend != 0) // 8bb: loop enabled?
+			{
+				// loop, expand if <500 bytes long
+				const uint16_t lbeg = (uint16_t)ins->lbeg; // loop start
+				z->m_loop = lbeg;
+
+				if (lend <= 500)
+				{
+					int16_t a = lbeg - lend; // -looplen
+					do
+					{
+						lend -= a;
+					}
+					while (lend < 500);
+
+					lend += a;
+				}
+
+				z->m_end = lend;
+			}
+			else // no loop
+			{
+				uint16_t length = (uint16_t)ins->length;
+				length += 32; // extra fadeout for GUS (8bb: also applies to SB, and can also overflow)
+
+				z->m_end = length;
+				z->m_loop = 65535; // 8bb: disable loop
+			}
+		}
+		else if (ins->type >= 2) // 8bb: AdLib
+		{
+			const ds_adl *adl = (const ds_adl *)ins;
+
+			z->c2spd = (uint16_t)adl->c2spd; // 8bb: this will cause problems if adlib c2spd > 65535
+			if (z->c2spd < 1000)
+				z->c2spd = C2FREQ;
+
+			z->vol = adl->vol;
+			memcpy(z->adlib, &adl->D00, 12);
+		}
+	}
+}
+
+static void checkchannels(ds_fileheader *h)
+{
+	// 8bb: channel types >=32 are invalid and would index outside of song._zchn[], turn them off
+	for (int32_t i = 0; i < 32; i++)
+	{
+		if (!(h->channel[i] & 128) && h->channel[i] >= 32)
+			h->channel[i] = 255;
+	}
+}
+
+static int8_t *loadsampledata(const st3_song_t *s, const uint8_t *src, uint32_t length)
+{
+	int8_t *p = (int8_t *)malloc(length+512+1); // 8bb: +1 for GUS intrp. safety (ST3 doesn't do this)
+	if (p == NULL)
+		return NULL;
+
+	memcpy(p, src, length);
+	memset(&p[length], 0, 512+1); // 8bb: don't leave uninitialized bytes for the unrolling/interpolation
+
+	// 8bb: we use signed samples, unlike ST3.01 and later. Convert to signed.
+	if (s->header.ffv != 1)
+	{
+		for (uint32_t j = 0; j < length; j++)
+			p[j] ^= 0x80;
+	}
+
+	return p;
+}
+
+int8_t *st3_materializeins(st3_song_t *s, int32_t insNum)
+{
+	if (s == NULL || insNum < 1 || insNum > MAX_INSTRUMENTS)
+		return NULL;
+
+	const int32_t i = insNum - 1;
+	const ds_smp *ins = &s->ins[i];
+	zins_t *z = &s->zins[i];
+
+	int32_t state;
+	while ((state = ATOMIC_LOAD(s->lazystate[i])) != LAZY_READY)
+	{
+		if (state == LAZY_BUSY)
+		{
+			Worker_Yield(); // 8bb: another thread is doing it (a short memcpy+unroll)
+			continue;
+		}
+
+		if (!ATOMIC_CAS(s->lazystate[i], state, LAZY_BUSY))
+			continue; // 8bb: raced with another thread or st3_requestins() (PENDING->WANTED)
+
+		int8_t *p = loadsampledata(s, &s->lazydata[s->lazyoffs[i]], s->lazylength[i]);
+		if (p != NULL)
+		{
+			/* 8bb: The header was already checked at load time, so just do
+			** the unrolling. On allocation failure the sample stays silent.
+			*/
+			z->baseptr = p;
+			if (ins->length > 0)
+				unrollins(ins, p, s->lazylend512[i]);
+		}
+
+		ATOMIC_STORE(s->lazystate[i], LAZY_READY); // 8bb: publishes baseptr
+		break;
+	}
+
+	return z->baseptr;
+}
+
+bool st3_requestins(st3_song_t *s, int32_t insNum, int8_t **baseptr)
+{
+	if (s == NULL || insNum < 1 || insNum > MAX_INSTRUMENTS)
+	{
+		*baseptr = NULL;
+		return true;
+	}
+
+	const int32_t i = insNum - 1;
+	if (ATOMIC_LOAD(s->lazystate[i]) == LAZY_READY)
+	{
+		*baseptr = s->zins[i].baseptr;
+		return true;
+	}
+
+	ATOMIC_CAS(s->lazystate[i], LAZY_PENDING, LAZY_WANTED); // 8bb: fails harmlessly if already wanted/busy
+	return false;
+}
+
+void st3_materializewanted(st3_song_t *s)
+{
+	if (s == NULL)
+		return;
+
+	for (int32_t i = 0; i < s->header.insnum && i < MAX_INSTRUMENTS; i++)
+	{
+		if (ATOMIC_LOAD(s->lazystate[i]) == LAZY_WANTED)
+			st3_materializeins(s, i+1);
+	}
+}
+
+void st3_prefetchrow(st3_song_t *s, int16_t pattern, int16_t row)
+{
+	if (s == NULL || pattern < 0 || pattern >= s->header.patnum || row < 0 || row >= 64)
+		return;
+
+	const uint8_t *p = s->patp[pattern];
+	if (p == NULL)
+		return;
+
+	uint32_t j = s->patrowoffs[pattern][row];
+	while (true)
+	{
+		const uint8_t dat = p[j++];
+		if (dat == 0)
+			break; // end of row
+
+		if (dat & 0x20)
+		{
+			if (!(s->header.channel[dat & 0x1F] & 128))
+				st3_materializeins(s, p[j+1]);
+
+			j += 2;
+		}
+
+		if (dat & 0x40) j += 1;
+		if (dat & 0x80) j += 2;
+	}
+}
+
+static void freesongmem(st3_song_t *s)
+{
+	// free pattern data
+	for (int32_t i = 0; i < MAX_PATTERNS; i++)
+	{
+		if (s->patp[i] != NULL)
+		{
+			if (!s->patinplace[i])
+				free(s->patp[i]);
+
+			s->patp[i] = NULL;
+		}
+	}
+
+	// free sample data
+	zins_t *z = s->zins;
+	for (int32_t i = 0; i < MAX_INSTRUMENTS; i++, z++)
+	{
+		if (z->baseptr != NULL)
+		{
+			free(z->baseptr);
+			z->baseptr = NULL;
+		}
+	}
+
+	if (s->filebuffer != NULL)
+		free(s->filebuffer);
+
+	free(s);
+}
+
+st3_song_t *st3_loadsong_from_ram(const uint8_t *data, uint32_t dataLength, uint32_t loadFlags)
 {
 	uint16_t insoff[101], patoff[101];
 	ds_smp *ins;
 
+	st3_song_t *s = (st3_song_t *)calloc(1, sizeof (st3_song_t));
+	if (s == NULL)
+		return NULL;
+
 	// 8bb: custom stuff not present in ST3.21 code...
-	song.moduleLoaded = false;
-	memset(&song.header, 0, sizeof (song.header)); // 8bb: clear song
-	memset(song.order, 255, MAX_ORDERS); // 8bb: pad orderlist with 255
+	s->refcount = 1;
+	memset(s->order, 255, MAX_ORDERS+1); // 8bb: pad orderlist with 255 (also the extra entry, read by neworder() at np_ord=257)
 	// ---------------------------------------------
 
 	MEMFILE *f = mopen(data, dataLength);
 	if (f == NULL)
 		goto loadError;
 
-	mread(&song.header, sizeof (song.header), 1, f);
+	mread(&s->header, sizeof (s->header), 1, f);
 	if (meof(f))
 		goto loadError;
 
-	if (memcmp(song.header._magic_signature, "SCRM", 4) != 0)
+	if (memcmp(s->header._magic_signature, "SCRM", 4) != 0)
 		goto loadError; // 8bb: not a valid S3M
 
 	// 8bb: added sanity checking (ST3 doesn't do this!)
-	if (song.header.ordnum > MAX_ORDERS || song.header.insnum > MAX_INSTRUMENTS || song.header.patnum > MAX_PATTERNS)
+	if (s->header.ordnum > MAX_ORDERS || s->header.insnum > MAX_INSTRUMENTS || s->header.patnum > MAX_PATTERNS)
 		goto loadError; // incompatible S3M
 
-	bool songMadeWithST3 = (song.header.cwtv >> 12) == 1;
-
-	song.header.name[27] = '\0'; // 8bb: added sanitation, so that it's always safe to print this string
-
-	if (song.header.cwtv == 0x1300)
-		song.header.flags |= 64; // 8bb: fast volslide flag
-
-	if (!songMadeWithST3 || song.header.cwtv < 0x1310)
-		song.header.ultraclick = 16; // 8bb: controls the number of GUS voices to use
-
-	if (song.header.ffv == 1)
-	{
-		switch (song.header.mastermul)
-		{
-			case 0: song.header.mastermul = 0x10; break;
-			case 1: song.header.mastermul = 0x20; break;
-			case 2: song.header.mastermul = 0x30; break;
-			case 3: song.header.mastermul = 0x40; break;
-			case 4: song.header.mastermul = 0x50; break;
-			case 5: song.header.mastermul = 0x60; break;
-			case 6: song.header.mastermul = 0x70; break;
-			case 7: song.header.mastermul = 0x7F; break;
-			default: break;
-		}
-	}
-
-	if (song.header.mastermul == 2)
-		song.header.mastermul = 0x20;
+	fixheader(&s->header);
 
-	if (song.header.mastermul == 2+16)
-		song.header.mastermul = 0x20+128;
+	memset(insoff, 0, sizeof (insoff));
+	memset(patoff, 0, sizeof (patoff));
 
-	mread(song.order, 1, song.header.ordnum, f);
-	mread(insoff, 2, song.header.insnum, f);
-	mread(patoff, 2, song.header.patnum, f);
+	mread(s->order, 1, s->header.ordnum, f);
+	mread(insoff, 2, s->header.insnum, f);
+	mread(patoff, 2, s->header.patnum, f);
 
-	if (song.header.defaultpan252 == 252)
-		mread(song.defaultpan, 1, 32, f);
+	if (s->header.defaultpan252 == 252)
+		mread(s->defaultpan, 1, 32, f);
 
 	// 8bb: load instrument headers
-	ins = song.ins;
-	for (int32_t i = 0; i < song.header.insnum; i++, ins++)
+	ins = s->ins;
+	for (int32_t i = 0; i < s->header.insnum; i++, ins++)
 	{
 		mseek(f, insoff[i] << 4, SEEK_SET);
 		mread(ins, 0x50, 1, f);
 	}
 
 	// 8bb: load pattern data
-	for (int32_t i = 0; i < song.header.patnum; i++)
+	for (int32_t i = 0; i < s->header.patnum; i++)
 	{
-		uint16_t patDataLen;
+		uint16_t patDataLen = 0;
 
 		if (patoff[i] != 0)
 		{
 			mseek(f, patoff[i] << 4, SEEK_SET);
 			mread(&patDataLen, 2, 1, f);
 
-			song.patp[i] = (uint8_t *)malloc(patDataLen);
-			if (song.patp[i] == NULL)
+			// 8bb: patDataLen includes the length field itself
+			uint32_t patLen = (patDataLen >= 2) ? patDataLen-2 : 0;
+			if (patLen > MAX_PATTERN_DATA)
+				patLen = MAX_PATTERN_DATA;
+
+			const uint32_t offs = (patoff[i] << 4) + 2;
+			if ((loadFlags & ST3_LOAD_INPLACEPATTERNS) && offs <= dataLength)
+			{
+				const uint32_t srcLen = (patLen < dataLength-offs) ? patLen : dataLength-offs;
+				if (scanpattern(&data[offs], srcLen, s->patrowoffs[i], &s->patlen[i]))
+				{
+					// 8bb: well-formed, play it from the module data (it's never written to)
+					s->patp[i] = (uint8_t *)&data[offs];
+					s->patinplace[i] = true;
+					continue;
+				}
+			}
+
+			uint8_t *patData = (uint8_t *)malloc(patLen+1);
+			if (patData == NULL)
 				goto loadError;
 
-			mread(song.patp[i], 1, patDataLen-2, f);
+			patLen = (uint32_t)mread(patData, 1, patLen, f);
+
+			s->patp[i] = checkpattern(patData, patLen, s->patrowoffs[i], &s->patlen[i]);
+			free(patData);
+
+			if (s->patp[i] == NULL)
+				goto loadError;
 		}
 	}
 
 	// 8bb: load sample data
-	ins = song.ins;
-	for (int32_t i = 0; i < song.header.insnum; i++, ins++)
+	ins = s->ins;
+	for (int32_t i = 0; i < s->header.insnum; i++, ins++)
 	{
-		if (ins->type == 1 && ins->memseg != 0)
+		if (ins->type == 1)
 		{
 			uint32_t offs = ins->memseg << 4;
 			offs += ins->memseg2 << 20;
-			mseek(f, offs, SEEK_SET);
 
 			/* 8bb: clamp overflown sample lengths (f.ex. "miracle man.s3m").
 			** ST3.21 doesn't do this, but we have to, or else it plays back wrongly.
 			*/
-			if (offs+ins->length > dataLength) // 8bb: dataLength is the filesize
+			if (ins->memseg == 0 || offs >= dataLength)
+			{
+				// 8bb: no sample data (or it's outside of the file), use an empty (silent) sample
+				offs = 0;
+				ins->length = 0;
+			}
+			else if (offs+ins->length > dataLength) // 8bb: dataLength is the filesize
+			{
 				ins->length = dataLength-offs;
+			}
 
-			ins->baseptr = (int8_t *)malloc(ins->length+512+1); // 8bb: +1 for GUS intrp. safety (ST3 doesn't do this)
-			if (ins->baseptr == NULL)
-				goto loadError;
-
-			mread(ins->baseptr, 1, ins->length, f);
-
-			// 8bb: we use signed samples, unlike ST3.01 and later. Convert to signed.
-			if (song.header.ffv != 1)
+			s->lazylength[i] = ins->length; // 8bb: also for st3_memusage()
+			if ((loadFlags & ST3_LOAD_LAZYSAMPLES) && ins->length > 0)
 			{
-				for (uint32_t j = 0; j < ins->length; j++)
-					ins->baseptr[j] ^= 0x80;
+				// 8bb: just remember where the data is, see st3_materializeins()
+				s->lazyoffs[i] = offs;
+				s->lazylend512[i] = ins->lend512;
+				s->lazystate[i] = LAZY_PENDING;
+				continue;
 			}
+
+			s->zins[i].baseptr = loadsampledata(s, &data[offs], ins->length);
+			if (s->zins[i].baseptr == NULL)
+				goto loadError;
 		}
 	}
 
-	checkinstruments();
+	s->lazydata = data;
+	s->datalength = dataLength;
+
+	mclose(&f);
+	checkinstruments(s);
+	buildins(s);
+	checkchannels(&s->header);
 
 	// 8bb: custom stuff not present in ST3.21 loader code...
+	s->soundcardtype = detectsoundcard(&s->header, s->ins);
 
-	audio.soundcardtype = SOUNDCARD_GUS;
-	
-	/* 8bb: detect if we want to use SB Pro mode (for S3Ms saved by ST3 only).
-	** Thanks to Saga_Musix for this detection idea!
-	**
-	** Apparently the guspos field in the sample headers are all 1 when saved
-	** by ST3 w/ SB. (or all zeroes in some very early ST3.00 modules).
-	*/
-	if (songMadeWithST3 && song.header.cwtv == 0x1320)
-	{
-		/* 8bb: Some non-ST3 trackers spoof as ST3.20, so do
-		** some extra heuristics to determine if this really
-		** wasn't saved by ST3.
-		*/
-		int32_t gusposOR = 0;
+	return s;
 
-		ins = song.ins;
-		for (int32_t i = 0; i < song.header.insnum; i++, ins++)
-		{
-			if (ins->type == 1)
-				gusposOR |= ins->guspos;
-		}
+loadError:
+	if (f != NULL) mclose(&f);
+	freesongmem(s);
+	return NULL;
+}
 
-		if (gusposOR == 0) // 8bb: all guspos entries were zero, this is not ST3
-			songMadeWithST3 = false;
+st3_song_t *st3_loadsong(const char *fileName, uint32_t loadFlags)
+{
+	FILE *f = fopen(fileName, "rb");
+	if (f == NULL)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	const uint32_t fileSize = (uint32_t)ftell(f);
+	rewind(f);
+
+	uint8_t *fileBuffer = (uint8_t *)malloc(fileSize);
+	if (fileBuffer == NULL)
+	{
+		fclose(f);
+		return NULL;
 	}
 
-	if (songMadeWithST3)
+	if (fread(fileBuffer, 1, fileSize, f) != fileSize)
 	{
-		// 8bb: find out how many PCM samples we have
-		uint32_t numSamples = 0;
+		free(fileBuffer);
+		fclose(f);
+		return NULL;
+	}
 
-		ins = song.ins;
-		for (int32_t i = 0; i < song.header.insnum; i++, ins++)
-		{
-			if (ins->type == 1)
-				numSamples++;
-		}
+	fclose(f);
 
-		/* 8bb: we need an ST3 song with at least two PCM samples to reliably
-		** detect if this song was made with an SB Pro.
-		*/
-		if (numSamples >= 2)
-		{
-			int32_t gusposOR = 0;
+	st3_song_t *s = st3_loadsong_from_ram((const uint8_t *)fileBuffer, fileSize, loadFlags);
 
-			ins = song.ins;
-			for (int32_t i = 0; i < song.header.insnum; i++, ins++)
-			{
-				if (ins->type == 1)
-					gusposOR |= ins->guspos;
-			}
+	if (s != NULL && (loadFlags & (ST3_LOAD_LAZYSAMPLES | ST3_LOAD_INPLACEPATTERNS)))
+		s->filebuffer = fileBuffer; // 8bb: the song reads sample/pattern data from this later
+	else
+		free(fileBuffer);
 
-			/* 8bb: ST3 stored a one in guspos when saved with Sound Blaster.
-			** However, there are early cwtv 0x1300 (ST3.00) modules in the wild where
-			** they are zero. Test for both 0 and 1 in the final ORed value.
-			**/
-			if (gusposOR <= 1)
-				audio.soundcardtype = SOUNDCARD_SBPRO;
-		}
+	return s;
+}
+
+void st3_memusage(st3_song_t *s, st3_memusage_t *info)
+{
+	memset(info, 0, sizeof (st3_memusage_t));
+	info->player = getplayermemusage();
+
+	if (s == NULL)
+		return;
+
+	info->song = sizeof (st3_song_t);
+
+	for (int32_t i = 0; i < s->header.patnum; i++)
+	{
+		if (s->patp[i] != NULL && !s->patinplace[i])
+			info->patterns += s->patlen[i]; // 8bb: checkpattern() shrinks the copy to this
+	}
+
+	for (int32_t i = 0; i < s->header.insnum; i++)
+	{
+		if (ATOMIC_LOAD(s->lazystate[i]) == LAZY_READY && s->zins[i].baseptr != NULL)
+			info->samples += s->lazylength[i] + 512 + 1; // 8bb: see loadsampledata()
 	}
 
+	if (s->filebuffer != NULL)
+		info->filebuffer = s->datalength;
+}
+
+st3_song_t *st3_retainsong(st3_song_t *s)
+{
+	if (s != NULL)
+		ATOMIC_INC(s->refcount);
+
+	return s;
+}
+
+void st3_releasesong(st3_song_t *s)
+{
+	if (s != NULL && ATOMIC_DEC(s->refcount) == 0)
+		freesongmem(s);
+}
+
+void st3_detachsong(void)
+{
+	lockMixer();
+
+	song.moduleLoaded = false;
+	audio.playing = false;
+
+	st3_song_t *s = song.shared;
+	song.shared = NULL;
+
+	memset(&song.header, 0, sizeof (song.header));
+	memset(song.order, 255, MAX_ORDERS+1);
+	memset(song.patp, 0, sizeof (song.patp));
+	memset(song.zins, 0, sizeof (song.zins));
+	memset(song.defaultpan, 0, sizeof (song.defaultpan));
+
+	unlockMixer();
+
+	st3_releasesong(s);
+}
+
+bool st3_attachsong(st3_song_t *s, int32_t soundCardType)
+{
+	if (s == NULL)
+		return false;
+
+	st3_retainsong(s); // 8bb: retain first, in case the same song is attached twice
+	st3_detachsong();
+
+	lockMixer();
+
+	// 8bb: the per-player copies are cheap, patterns and sample data are shared
+	song.shared = s;
+	memcpy(&song.header, &s->header, sizeof (song.header));
+	memcpy(song.order, s->order, sizeof (song.order));
+	memcpy(song.patp, s->patp, sizeof (song.patp));
+	memcpy(song.zins, s->zins, sizeof (song.zins));
+	memcpy(song.defaultpan, s->defaultpan, sizeof (song.defaultpan));
+
 #ifdef FORCE_SOUNDCARD_TYPE
 	audio.soundcardtype = FORCE_SOUNDCARD_TYPE;
+	(void)soundCardType;
 #else
 	if (soundCardType != -1)
 		audio.soundcardtype = soundCardType;
+	else
+		audio.soundcardtype = s->soundcardtype;
 #endif
 
 	song.moduleLoaded = true;
+
+	unlockMixer();
 	return true;
+}
 
-loadError:
-	if (f != NULL) mclose(&f);
-	closeMusic();
-	return false;
+bool load_st3_from_ram(const uint8_t *data, uint32_t dataLength, int32_t soundCardType)
+{
+	st3_song_t *s = st3_loadsong_from_ram(data, dataLength, 0);
+	if (s == NULL)
+	{
+		closeMusic();
+		return false;
+	}
+
+	const bool result = st3_attachsong(s, soundCardType);
+	st3_releasesong(s); // 8bb: the player holds its own reference now
+
+	return result;
 }
 
 bool load_st3(const char *fileName, int32_t soundCardType)
 {
-	FILE *f = fopen(fileName, "rb");
-	if (f == NULL)
+	st3_song_t *s = st3_loadsong(fileName, 0);
+	if (s == NULL)
+	{
+		closeMusic(); // 8bb: same as load_st3_from_ram()
 		return false;
+	}
 
-	fseek(f, 0, SEEK_END);
-	const uint32_t fileSize = (uint32_t)ftell(f);
-	rewind(f);
+	const bool result = st3_attachsong(s, soundCardType);
+	st3_releasesong(s);
 
-	uint8_t *fileBuffer = (uint8_t *)malloc(fileSize);
-	if (fileBuffer == NULL)
+	return result;
+}
+
+// 8bb: st3_probe() routines (reads only headers and patterns, never sample data)
+
+#define PROBE_MAX_ROWS (1 << 20) // 8bb: safety limit for songs with endless pattern loops
+
+typedef struct probereader_t
+{
+	const uint8_t *data;
+	FILE *f;
+	uint32_t length;
+} probereader_t;
+
+static void preadat(probereader_t *r, uint32_t offset, void *buffer, uint32_t length) // 8bb: zero-fills past the end
+{
+	uint8_t *dst = (uint8_t *)buffer;
+
+	uint32_t bytesRead = 0;
+	if (offset < r->length)
 	{
-		fclose(f);
-		return false;
+		bytesRead = r->length - offset;
+		if (bytesRead > length)
+			bytesRead = length;
+
+		if (r->data != NULL)
+			memcpy(dst, &r->data[offset], bytesRead);
+		else if (fseek(r->f, offset, SEEK_SET) != 0 || fread(dst, 1, bytesRead, r->f) != bytesRead)
+			bytesRead = 0;
 	}
 
-	if (fread(fileBuffer, 1, fileSize, f) != fileSize)
+	if (bytesRead < length)
+		memset(&dst[bytesRead], 0, length-bytesRead);
+}
+
+static bool probeneworder(const uint8_t *order, uint16_t ordnum, int16_t *ord, int16_t *pat) // 8bb: same as neworder()
+{
+	uint16_t numSep = 0;
+	while (true)
 	{
-		free(fileBuffer);
-		fclose(f);
-		return false;
+		(*ord)++;
+
+		const uint8_t patt = (*ord <= MAX_ORDERS) ? order[*ord-1] : 255;
+		if (patt == 254)
+		{
+			numSep++;
+			if (numSep >= ordnum)
+				return false;
+
+			continue;
+		}
+
+		if (patt == 255)
+			return false; // 8bb: the song would restart here
+
+		*pat = patt;
+		return true;
 	}
+}
 
-	fclose(f);
+/* 8bb: Follows the order list the same way dorow()/docmd1() does, but only at
+** row granularity, and only for the commands that change the song flow or
+** timing (Axx, Bxx, Cxx, SBx, SEx and Txx). Stops when the song restarts or
+** when a row is visited twice (song loops).
+*/
+static double probeduration(st3_probe_t *info, const uint8_t *order, uint8_t **patp, const uint16_t *patlen, uint16_t (*patrowoffs)[64])
+{
+	uint8_t cmd[ACHANNELS], nfo[ACHANNELS], lastnfo[ACHANNELS];
+	uint64_t visited[MAX_ORDERS];
+	int16_t ord = 0, pat = 0, row, patloopstart = -1, jumptorow = -1, jmptoord = -1;
+	uint8_t patterndelay = 0, patloopcount = 0, breakpat = 0, startrow = 0;
+
+	memset(cmd, 0, sizeof (cmd));
+	memset(nfo, 0, sizeof (nfo));
+	memset(lastnfo, 0, sizeof (lastnfo));
+	memset(visited, 0, sizeof (visited));
+
+	const ds_fileheader *h = &info->header;
+	const uint16_t notemixingspeed = getnotemixingspeed(info->soundcardtype, !!(h->mastermul & 128));
+
+	uint8_t tempo = (h->inittempo != 0) ? h->inittempo : 125;
+	if (info->soundcardtype == SOUNDCARD_SBPRO && tempo <= 0x20)
+		tempo = 125;
+
+	uint8_t musicmax = 6;
+	if (h->initspeed != 255 && h->initspeed > 0)
+		musicmax = h->initspeed;
+
+	double dTime = 0.0;
+
+	if (!probeneworder(order, h->ordnum, &ord, &pat))
+		return dTime;
 
-	if (!load_st3_from_ram((const uint8_t *)fileBuffer, fileSize, soundCardType))
+	row = 0;
+	for (int32_t rows = 0; rows < PROBE_MAX_ROWS; rows++)
 	{
-		free(fileBuffer);
+		const bool repeatRow = (patterndelay > 0);
+		if (repeatRow)
+		{
+			row--; // 8bb: pattern delay, redo the previous row's commands
+		}
+		else
+		{
+			if (row >= 0 && row < 64)
+			{
+				const uint64_t bit = (uint64_t)1 << row;
+				if (visited[ord-1] & bit)
+					break; // 8bb: song loops
+
+				visited[ord-1] |= bit;
+			}
+
+			memset(cmd, 0, sizeof (cmd));
+			memset(nfo, 0, sizeof (nfo));
+
+			if (pat < h->patnum && patp[pat] != NULL)
+			{
+				const uint8_t *p = patp[pat];
+
+				// 8bb: the patterns went through checkpattern(), so no bounds checking is needed
+				uint32_t i = (row < 64) ? patrowoffs[pat][row] : patlen[pat]-1;
+				while (true)
+				{
+					const uint8_t dat = p[i++];
+					if (dat == 0)
+						break;
+
+					const uint8_t channel = h->channel[dat & 0x1F];
+					const bool used = !(channel & 128);
+
+					if (used && channel >= 16 && channel < 16+9)
+						info->adlibused = true;
+
+					if (dat & 32) i += 2;
+					if (dat & 64) i += 1;
+
+					if (dat & 128)
+					{
+						if (used)
+						{
+							cmd[channel] = p[i+0];
+							nfo[channel] = p[i+1];
+						}
+
+						i += 2;
+					}
+				}
+			}
+		}
+
+		for (int32_t i = 0; i < ACHANNELS; i++)
+		{
+			if (cmd[i] == 0 || cmd[i] >= 27)
+				continue;
+
+			if (nfo[i] > 0)
+				lastnfo[i] = nfo[i];
+
+			const uint8_t param = nfo[i];
+			switch (cmd[i] + 64)
+			{
+				case 'A':
+				{
+					if (param > 0)
+						musicmax = param;
+				}
+				break;
+
+				case 'B':
+				{
+					if (param == 0xFF)
+					{
+						breakpat = 255;
+					}
+					else
+					{
+						breakpat = 1;
+						jmptoord = param;
+					}
+				}
+				break;
+
+				case 'C':
+				{
+					if ((param >> 4) <= 9 && (param & 0x0F) <= 9)
+					{
+						startrow = ((param >> 4) * 10) + (param & 0x0F);
+						breakpat = 1;
+					}
+				}
+				break;
+
+				case 'S':
+				{
+					if (param == 0)
+						nfo[i] = lastnfo[i]; // 8bb: GET_LAST_NFO
+
+					if ((nfo[i] >> 4) == 0xB) // 8bb: pattern loop
+					{
+						if ((nfo[i] & 0xF) == 0)
+						{
+							patloopstart = row;
+						}
+						else
+						{
+							if (patloopcount == 0)
+							{
+								patloopcount = (nfo[i] & 0xF) + 1;
+								if (patloopstart == -1)
+									patloopstart = 0;
+							}
+
+							if (patloopcount > 1)
+							{
+								patloopcount--;
+								jumptorow = patloopstart;
+
+								// 8bb: the looped rows are allowed to be visited again
+								for (int16_t j = patloopstart; j <= row && j < 64; j++)
+									visited[ord-1] &= ~((uint64_t)1 << j);
+							}
+							else
+							{
+								patloopcount = 0;
+								patloopstart = row + 1;
+							}
+						}
+					}
+					else if ((nfo[i] >> 4) == 0xE) // 8bb: pattern delay
+					{
+						if (patterndelay == 0)
+							patterndelay = nfo[i] & 0xF;
+					}
+				}
+				break;
+
+				case 'T':
+				{
+					if (!(info->soundcardtype == SOUNDCARD_SBPRO && param <= 0x20))
+						tempo = param;
+				}
+				break;
+
+				default: break;
+			}
+		}
+
+		if (repeatRow)
+			patterndelay--;
+
+		const double dTickTime = 1.0 / gettickrate(info->soundcardtype, notemixingspeed, tempo);
+		dTime += musicmax * dTickTime;
+
+		// 8bb: next row
+		row++;
+		if (jumptorow != -1)
+		{
+			row = jumptorow;
+			jumptorow = -1;
+		}
+
+		if (row >= 64 || (patloopcount == 0 && breakpat > 0))
+		{
+			if (breakpat == 255)
+			{
+				/* 8bb: dorow() returns without resetting musiccount here, so the
+				** remaining rows are skipped at a rate of one tick per row.
+				*/
+				breakpat = 0;
+				do
+				{
+					row++;
+					dTime += dTickTime;
+				}
+				while (row < 64);
+			}
+
+			breakpat = 0;
+			if (jmptoord != -1)
+			{
+				ord = jmptoord;
+				jmptoord = -1;
+			}
+
+			if (!probeneworder(order, h->ordnum, &ord, &pat))
+				break;
+
+			row = startrow;
+			startrow = 0;
+			patloopstart = -1;
+			jumptorow = -1;
+		}
+	}
+
+	return dTime;
+}
+
+static bool probesong(probereader_t *r, st3_probe_t *info)
+{
+	uint16_t insoff[MAX_INSTRUMENTS], patoff[MAX_PATTERNS];
+	uint8_t order[MAX_ORDERS], *patp[MAX_PATTERNS];
+	uint16_t patlen[MAX_PATTERNS], patrowoffs[MAX_PATTERNS][64];
+	ds_smp ins[MAX_INSTRUMENTS];
+
+	memset(info, 0, sizeof (st3_probe_t));
+
+	ds_fileheader *h = &info->header;
+	if (r->length < sizeof (ds_fileheader))
 		return false;
+
+	preadat(r, 0, h, sizeof (ds_fileheader));
+	if (memcmp(h->_magic_signature, "SCRM", 4) != 0)
+		return false; // 8bb: not a valid S3M
+
+	if (h->ordnum > MAX_ORDERS || h->insnum > MAX_INSTRUMENTS || h->patnum > MAX_PATTERNS)
+		return false; // incompatible S3M
+
+	fixheader(h);
+	checkchannels(h);
+	if (h->ultraclick == 0)
+		h->ultraclick = 16;
+
+	uint32_t offset = sizeof (ds_fileheader);
+
+	memset(order, 255, sizeof (order));
+	preadat(r, offset, order, h->ordnum); offset += h->ordnum;
+	preadat(r, offset, insoff, h->insnum * 2); offset += h->insnum * 2;
+	preadat(r, offset, patoff, h->patnum * 2);
+
+	memset(ins, 0, sizeof (ins));
+	for (int32_t i = 0; i < h->insnum; i++)
+	{
+		preadat(r, insoff[i] << 4, &ins[i], 0x50);
+
+		memcpy(info->insname[i], ins[i].name, 28);
+		info->insname[i][27] = '\0';
+		info->instype[i] = ins[i].type;
+
+		if (ins[i].type == 1)
+			info->numsamples++;
+		else if (ins[i].type >= 2)
+			info->numadlibins++;
 	}
 
-	free(fileBuffer);
-	return true;
+#ifdef FORCE_SOUNDCARD_TYPE
+	info->soundcardtype = FORCE_SOUNDCARD_TYPE;
+#else
+	info->soundcardtype = detectsoundcard(h, ins);
+#endif
+
+	// 8bb: pattern data is needed for the duration
+	bool result = true;
+
+	memset(patp, 0, sizeof (patp));
+	memset(patlen, 0, sizeof (patlen));
+	for (int32_t i = 0; i < h->patnum; i++)
+	{
+		if (patoff[i] == 0)
+			continue;
+
+		uint16_t patDataLen;
+		preadat(r, patoff[i] << 4, &patDataLen, 2);
+
+		uint32_t patLen = (patDataLen >= 2) ? patDataLen-2 : 0;
+		if (patLen > MAX_PATTERN_DATA)
+			patLen = MAX_PATTERN_DATA;
+
+		uint8_t *patData = (uint8_t *)malloc(patLen+1);
+		if (patData == NULL)
+		{
+			result = false;
+			goto probeEnd;
+		}
+
+		const uint32_t patDataOffs = ((uint32_t)patoff[i] << 4) + 2;
+		if (patDataOffs + patLen > r->length) // 8bb: the loader doesn't get zeroes past the end
+			patLen = (patDataOffs < r->length) ? r->length - patDataOffs : 0;
+
+		preadat(r, patDataOffs, patData, patLen);
+		patp[i] = checkpattern(patData, patLen, patrowoffs[i], &patlen[i]);
+		free(patData);
+
+		if (patp[i] == NULL)
+		{
+			result = false;
+			goto probeEnd;
+		}
+	}
+
+	info->dDuration = probeduration(info, order, patp, patlen, patrowoffs);
+
+probeEnd:
+	for (int32_t i = 0; i < h->patnum; i++)
+	{
+		if (patp[i] != NULL)
+			free(patp[i]);
+	}
+
+	return result;
+}
+
+bool st3_probe_from_ram(const uint8_t *data, uint32_t dataLength, st3_probe_t *info)
+{
+	if (data == NULL || info == NULL)
+		return false;
+
+	probereader_t r;
+	r.data = data;
+	r.f = NULL;
+	r.length = dataLength;
+
+	return probesong(&r, info);
+}
+
+bool st3_probe(const char *fileName, st3_probe_t *info)
+{
+	if (info == NULL)
+		return false;
+
+	FILE *f = fopen(fileName, "rb");
+	if (f == NULL)
+		return false;
+
+	fseek(f, 0, SEEK_END);
+	const uint32_t fileSize = (uint32_t)ftell(f);
+
+	probereader_t r;
+	r.data = NULL;
+	r.f = f;
+	r.length = fileSize;
+
+	const bool result = probesong(&r, info);
+
+	fclose(f);
+	return result;
 }
 
 // 8bb: added these so that we can have a "load from RAM" loader as well
@@ -425,7 +1372,7 @@ static void mseek(MEMFILE *buf, int32_t offset, int32_t whence)
 	{
 		switch (whence)
 		{
-			case SEEK_SET: buf->_ptr = buf->_base + offset; break;
+			case SEEK_SET: buf->_ptr = buf->_base + (((uint32_t)offset < buf->_bufsiz) ? (uint32_t)offset : buf->_bufsiz); break;
 			case SEEK_CUR: buf->_ptr += offset; break;
 			case SEEK_END: buf->_ptr = buf->_base + buf->_bufsiz + offset; break;
 			default: break;
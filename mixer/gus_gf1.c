@@ -22,6 +22,8 @@
 #include "../digread.h"
 #include "sinc.h"
 
+#ifndef ST3_NO_GUS // 8bb: small-footprint profile, see digdata.h
+
 #define GF1_MIN_VOICES 14
 #define GF1_MAX_VOICES 32
 #define GF1_SMP_ADD_FRAC_BITS 9
@@ -69,10 +71,12 @@ static const uint16_t panOffsTable[16] =
 
 static int32_t activeVoices = 14;
 static uint64_t resamplingFrac, resamplingDelta;
-static float fSampleBufferL[SINC_TAPS], fSampleBufferR[SINC_TAPS];
+static mixsmp_t sampleBufferL[INTRP_MAX_TAPS+INTRP_BLOCK], sampleBufferR[INTRP_MAX_TAPS+INTRP_BLOCK];
 static double dGUSOutputRate = 44100.0;
 static gusVoice_t gusVoice[GF1_MAX_VOICES];
 static gusVoice_t *gv = gusVoice; // initialize to voice #0
+static uint32_t muteMask; // 8bb: bit n = GUS voice n, see GUS_SetMuteMask()
+static mixtap_t mixTap; // 8bb: see GUS_SetMeters()/GUS_SetScope()
 
 void GUS_VoiceSelect(int32_t voiceNum)
 {
@@ -177,6 +181,10 @@ void GUS_Init(int32_t audioOutputFrequency, int32_t numVoices)
 	resamplingDelta = (uint64_t)round(RESAMPLING_FRAC_SCALE * (dGUSOutputRate / audioOutputFrequency));
 	resamplingFrac = 0;
 
+	// 8bb: start with empty ring buffers, so that the song always renders the same
+	memset(sampleBufferL, 0, sizeof (sampleBufferL));
+	memset(sampleBufferR, 0, sizeof (sampleBufferR));
+
 	unlockMixer();
 }
 
@@ -190,6 +198,26 @@ int32_t GUS_GetNumberOfVoices(void)
 	return activeVoices;
 }
 
+uint32_t GUS_GetMemUsage(void)
+{
+	return sizeof (gusVoice) + sizeof (sampleBufferL) + sizeof (sampleBufferR);
+}
+
+void GUS_SetMuteMask(uint32_t mask)
+{
+	muteMask = mask;
+}
+
+void GUS_SetMeters(mixmeter_t *voiceMeters)
+{
+	mixTap.meters = voiceMeters;
+}
+
+void GUS_SetScope(scope_t *scope)
+{
+	mixTap.scope = scope;
+}
+
 int32_t GUS_GetNumberOfRunningVoices(void)
 {
 	int32_t voices = 0;
@@ -204,9 +232,16 @@ int32_t GUS_GetNumberOfRunningVoices(void)
 	return voices;
 }
 
-static void outputGUSSample(float *fOutL, float *fOutR)
+/* 8bb: voiceStem is NULL except for GUS_RenderStems(), where every voice
+** also goes to the newest ring buffer entry of its stem (cleared by the
+** caller). tap is NULL except for meters/scopes, where a voice is taken
+** from its louder side.
+*/
+static FORCEINLINE void outputGUSSample(mixsmp_t *outL, mixsmp_t *outR, stem_t *const *voiceStem, const mixtap_t *tap)
 {
 	int32_t L = 0, R = 0;
+	const uint32_t muted = muteMask; // 8bb: load once, the voice stores below could alias it
+	const bool capture = (tap != NULL && tap->scope != NULL && Scope_Begin(tap->scope));
 
 	gusVoice_t *v = gusVoice;
 	for (int32_t i = 0; i < activeVoices; i++, v++)
@@ -237,7 +272,14 @@ static void outputGUSSample(float *fOutL, float *fOutR)
 					}
 				}
 
-				if (!(v->SACI & SACI_STOPPED))
+				if (!(v->SACI & SACI_STOPPED) && (muted & (1UL << i)))
+				{
+					// 8bb: muted, only advance (the engines keep running, for seamless unmuting)
+					v->SA_frac += v->SFCI;
+					v->SA += v->SA_frac >> GF1_SMP_ADD_FRAC_BITS;
+					v->SA_frac &= GF1_SMP_ADD_FRAC_MASK;
+				}
+				else if (!(v->SACI & SACI_STOPPED))
 				{
 					// linear interpolation
 					int16_t smp = v->SA[0] << 8, smp2 = v->SA[1] << 8;
@@ -249,8 +291,32 @@ static void outputGUSSample(float *fOutL, float *fOutR)
 					int16_t volR = vol - v->ROff;
 					volL &= ~((int16_t)volL >> 15); // if (volL < 0) volL = 0;
 					volR &= ~((int16_t)volR >> 15); // if (volR < 0) volR = 0;
-					L += (smp * (256 + (volL & 0xFF))) >> (24 - (volL >> 8));
-					R += (smp * (256 + (volR & 0xFF))) >> (24 - (volR >> 8));
+					const int32_t voiceL = (smp * (256 + (volL & 0xFF))) >> (24 - (volL >> 8));
+					const int32_t voiceR = (smp * (256 + (volR & 0xFF))) >> (24 - (volR >> 8));
+					L += voiceL;
+					R += voiceR;
+
+					if (tap != NULL)
+					{
+						const int32_t voiceOut = (volL > volR) ? voiceL : voiceR;
+						if (tap->meters != NULL)
+							Meter_Add(&tap->meters[i], voiceOut);
+
+						if (capture)
+							Scope_Add(tap->scope, i, voiceOut);
+					}
+
+					if (voiceStem != NULL && voiceStem[i] != NULL)
+					{
+						stem_t *s = voiceStem[i];
+#ifdef ST3_FIXEDPOINT
+						s->bufL[intrpTaps-1] += voiceL;
+						s->bufR[intrpTaps-1] += voiceR;
+#else
+						s->bufL[intrpTaps-1] += (float)voiceL * (1.0f / 32768.0f);
+						s->bufR[intrpTaps-1] += (float)voiceR * (1.0f / 32768.0f);
+#endif
+					}
 
 					v->SA_frac += v->SFCI;
 					v->SA += v->SA_frac >> GF1_SMP_ADD_FRAC_BITS;
@@ -282,60 +348,94 @@ static void outputGUSSample(float *fOutL, float *fOutR)
 		}
 	}
 
+	if (capture)
+		Scope_End(tap->scope);
+
 	L = CLAMP(L, INT16_MIN, INT16_MAX);
 	R = CLAMP(R, INT16_MIN, INT16_MAX);
 
-	*fOutL = (float)L * (1.0f / 32768.0f);
-	*fOutR = (float)R * (1.0f / 32768.0f);
+#ifdef ST3_FIXEDPOINT
+	*outL = L; // 8bb: Q15
+	*outR = R;
+#else
+	*outL = (float)L * (1.0f / 32768.0f);
+	*outR = (float)R * (1.0f / 32768.0f);
+#endif
 }
 
-static void GUS_Output(float *outL, float *outR)
+/* 8bb: Makes the GUS samples for up to INTRP_BLOCK output samples at a
+** time after the last intrpTaps ones (see Intrp_ResampleStereo() in
+** mixer/sinc.h), and resamples them with the kernel of the selected
+** interpolation quality.
+*/
+static FORCEINLINE void GUS_Output(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples, const mixtap_t *tap)
 {
-	resamplingFrac += resamplingDelta;
-	while (resamplingFrac >= RESAMPLING_FRAC_SCALE)
+	const int32_t taps = intrpTaps;
+
+	while (numSamples > 0)
 	{
-		resamplingFrac -= RESAMPLING_FRAC_SCALE;
+		int32_t numInput;
+		const int32_t samples = Intrp_BlockSize(resamplingFrac, resamplingDelta, numSamples, &numInput);
 
-		// advance resampling ring buffer
-		for (int32_t i = 0; i < SINC_TAPS-1; i++)
-		{
-			fSampleBufferL[i] = fSampleBufferL[1+i];
-			fSampleBufferR[i] = fSampleBufferR[1+i];
-		}
+		for (int32_t i = 0; i < numInput; i++)
+			outputGUSSample(&sampleBufferL[taps+i], &sampleBufferR[taps+i], NULL, tap);
+
+		Intrp_ResampleStereo(sampleBufferL, sampleBufferR, resamplingFrac, resamplingDelta, mixBufL, mixBufR, samples);
+		resamplingFrac = (resamplingFrac + (samples * resamplingDelta)) & RESAMPLING_FRAC_MASK;
 
-		float inL, inR;
-		outputGUSSample(&inL, &inR);
+		// 8bb: keep the last taps samples for the next block
+		memmove(sampleBufferL, &sampleBufferL[numInput], taps * sizeof (mixsmp_t));
+		memmove(sampleBufferR, &sampleBufferR[numInput], taps * sizeof (mixsmp_t));
 
-		fSampleBufferL[SINC_TAPS-1] = inL;
-		fSampleBufferR[SINC_TAPS-1] = inR;
+		mixBufL += samples;
+		mixBufR += samples;
+		numSamples -= samples;
 	}
+}
 
-	const uint32_t frac32 = (uint32_t)resamplingFrac;
-	const uint32_t lutPhase = frac32 >> INTRP_PHASE_SHIFT; // 0 .. SINC_OVERSAMPLING-1
-	const float fIntrpFrac = (int32_t)(frac32 & INTRP_PHASE_MASK) * (1.0f / INTRP_PHASE_SCALE);
+void GUS_RenderSamples(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
+{
+	if (mixTap.meters != NULL || mixTap.scope != NULL)
+		GUS_Output(mixBufL, mixBufR, numSamples, &mixTap);
+	else
+		GUS_Output(mixBufL, mixBufR, numSamples, NULL);
+}
 
-	// it may look like we go out of bounds for fSinc_2, but we have an extra phase after LUT
-	const float *fSinc_1 = fSincLUT + ( lutPhase    << SINC_TAPS_BITS);
-	const float *fSinc_2 = fSincLUT + ((lutPhase+1) << SINC_TAPS_BITS);
+/* 8bb: Stem render. The stems add up to the normal output, except where
+** that clips.
+*/
+void GUS_RenderStems(stem_t *stems, int32_t numStems, stem_t *const *voiceStem, int32_t numSamples)
+{
+	const int32_t taps = intrpTaps;
 
-	float fSumL = 0.0f, fSumR = 0.0f;
-	for (int32_t i = 0; i < SINC_TAPS; i++)
+	for (int32_t i = 0; i < numSamples; i++)
 	{
-		// do linear interpolation between phases
-		const float y1 = fSinc_1[i];
-		const float y2 = fSinc_2[i];
-		const float y = y1 + ((y2 - y1) * fIntrpFrac);
+		resamplingFrac += resamplingDelta;
+		while (resamplingFrac >= RESAMPLING_FRAC_SCALE)
+		{
+			resamplingFrac -= RESAMPLING_FRAC_SCALE;
+
+			// advance resampling ring buffers
+			stem_t *s = stems;
+			for (int32_t j = 0; j < numStems; j++, s++)
+			{
+				for (int32_t k = 0; k < taps-1; k++)
+				{
+					s->bufL[k] = s->bufL[1+k];
+					s->bufR[k] = s->bufR[1+k];
+				}
+
+				s->bufL[taps-1] = s->bufR[taps-1] = 0;
+			}
+
+			mixsmp_t inL, inR;
+			outputGUSSample(&inL, &inR, voiceStem, NULL);
+		}
 
-		fSumL += fSampleBufferL[i] * y;
-		fSumR += fSampleBufferR[i] * y;
+		stem_t *s = stems;
+		for (int32_t j = 0; j < numStems; j++, s++)
+			Intrp_Stereo(s->bufL, s->bufR, (uint32_t)resamplingFrac, &s->outL[i], &s->outR[i]);
 	}
-	
-	*outL = fSumL;
-	*outR = fSumR;
 }
 
-void GUS_RenderSamples(float *fMixBufL, float *fMixBufR, int32_t numSamples)
-{
-	for (int32_t i = 0; i < numSamples; i++)
-		GUS_Output(fMixBufL++, fMixBufR++);
-}
+#endif
@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../digdata.h" // 8bb: mixsmp_t
+#include "stem.h"
+#include "tap.h"
 
 // these are NOT thread-safe and must only be called from the thread that calls GUS_Mix()!
 void GUS_VoiceSelect(int32_t voiceNum);
@@ -24,5 +27,10 @@ void GUS_Init(int32_t audioOutputFrequency, int32_t numVoices);
 double GUS_GetOutputRate(void);
 int32_t GUS_GetNumberOfVoices(void);
 int32_t GUS_GetNumberOfRunningVoices(void);
-void GUS_RenderSamples(float *fMixBufL, float *fMixBufR, int32_t numSamples);
+uint32_t GUS_GetMemUsage(void); // 8bb: bytes of static mixer state
+void GUS_SetMuteMask(uint32_t mask); // 8bb: bit n = GUS voice n, muted voices aren't mixed (only advanced)
+void GUS_SetMeters(mixmeter_t *voiceMeters); // 8bb: voiceMeters[0..31] (GUS voices), NULL = off
+void GUS_SetScope(scope_t *scope); // 8bb: scope->map[] = GUS voice -> channel, NULL = off
+void GUS_RenderSamples(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples);
+void GUS_RenderStems(stem_t *stems, int32_t numStems, stem_t *const *voiceStem, int32_t numSamples); // 8bb: voiceStem[GUS voice] can be NULL
 
@@ -0,0 +1,384 @@
+// EBU R128 loudness and true-peak analysis (8bb: see loudness.h)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "loudness.h"
+
+#ifndef PI
+#define PI 3.14159265358979323846264338327950288
+#endif
+
+#define CHUNK_SIZE 256 // 8bb: samples per pass (the true-peak loops work on whole chunks)
+
+#define TP_PHASES 4 // 8bb: 4x oversampling
+#define TP_TAPS 12 // 8bb: per phase (48-tap windowed sinc)
+#define TP_HISTORY (TP_TAPS-1) // 8bb: samples from the last chunk
+
+#define STEPS_MOMENTARY 4 // 8bb: 400ms gating blocks, overlapping by 75%
+#define STEPS_SHORTTERM 30 // 8bb: 3s
+
+#define ABS_GATE (-70.0) // 8bb: LUFS
+#define REL_GATE (-10.0) // 8bb: LU
+#define HIST_BINS_PER_LU 10
+#define HIST_BINS (100 * HIST_BINS_PER_LU) // 8bb: -70..+30 LUFS
+
+typedef struct biquad_t
+{
+	double b0, b1, b2, a1, a2;
+} biquad_t;
+
+typedef struct loudness_t
+{
+	// 8bb: true peak, x[ch][0..TP_HISTORY-1] are the last samples of the previous chunk
+	float x[2][TP_HISTORY+CHUNK_SIZE], acc[CHUNK_SIZE];
+	float coeffs[TP_PHASES][TP_TAPS];
+	float samplePeak, truePeak;
+
+	// 8bb: K-weighting (pre-filter and RLB filter), transposed direct form II
+	biquad_t preFilter, rlbFilter;
+	double z[2][4];
+
+	// 8bb: 100ms steps, in mean square (sum of L and R)
+	double stepEnergy, steps[STEPS_SHORTTERM];
+	int32_t stepLength, stepSamples;
+	uint32_t numSteps;
+	double momentary, shortTerm, maxMomentary, maxShortTerm;
+
+	// 8bb: gating blocks above the absolute gate (mean square sum and count, per 0.1 LU)
+	double histEnergy[HIST_BINS];
+	uint32_t histBlocks[HIST_BINS];
+
+	uint64_t samples;
+} loudness_t;
+
+static loudness_t *ld; // 8bb: NULL = off
+
+static void setupKFilter(int32_t audioOutputFrequency)
+{
+	// 8bb: the filters of ITU-R BS.1770, transformed to any rate
+
+	double K = tan(PI * 1681.974450955533 / audioOutputFrequency);
+	double Q = 0.7071752369554196;
+	const double Vh = pow(10.0, 3.999843853973347 / 20.0);
+	const double Vb = pow(Vh, 0.4996667741545416);
+
+	double a0 = 1.0 + (K / Q) + (K * K);
+	ld->preFilter.b0 = (Vh + ((Vb * K) / Q) + (K * K)) / a0;
+	ld->preFilter.b1 = (2.0 * ((K * K) - Vh)) / a0;
+	ld->preFilter.b2 = (Vh - ((Vb * K) / Q) + (K * K)) / a0;
+	ld->preFilter.a1 = (2.0 * ((K * K) - 1.0)) / a0;
+	ld->preFilter.a2 = (1.0 - (K / Q) + (K * K)) / a0;
+
+	K = tan(PI * 38.13547087602444 / audioOutputFrequency);
+	Q = 0.5003270373238773;
+
+	a0 = 1.0 + (K / Q) + (K * K);
+	ld->rlbFilter.b0 = 1.0;
+	ld->rlbFilter.b1 = -2.0;
+	ld->rlbFilter.b2 = 1.0;
+	ld->rlbFilter.a1 = (2.0 * ((K * K) - 1.0)) / a0;
+	ld->rlbFilter.a2 = (1.0 - (K / Q) + (K * K)) / a0;
+}
+
+static void setupOversampler(void)
+{
+	// 8bb: Hann-windowed sinc, phase p gets taps p, p+4, p+8 ...
+	const int32_t length = TP_TAPS * TP_PHASES;
+	for (int32_t p = 0; p < TP_PHASES; p++)
+	{
+		double sum = 0.0;
+		for (int32_t k = 0; k < TP_TAPS; k++)
+		{
+			const int32_t i = (k * TP_PHASES) + p;
+			const double t = (i - (length / 2)) / (double)TP_PHASES;
+			const double sinc = (t == 0.0) ? 1.0 : (sin(PI * t) / (PI * t));
+			const double window = 0.5 - (0.5 * cos((2.0 * PI * i) / length));
+
+			ld->coeffs[p][k] = (float)(sinc * window);
+			sum += ld->coeffs[p][k];
+		}
+
+		for (int32_t k = 0; k < TP_TAPS; k++) // 8bb: unity gain for every phase
+			ld->coeffs[p][k] = (float)(ld->coeffs[p][k] / sum);
+	}
+}
+
+static double toLUFS(double meanSquare)
+{
+	return (meanSquare > 0.0) ? (-0.691 + (10.0 * log10(meanSquare))) : -HUGE_VAL;
+}
+
+static double toDB(float peak)
+{
+	return (peak > 0.0f) ? (20.0 * log10(peak)) : -HUGE_VAL;
+}
+
+static double meanOfSteps(int32_t numSteps) // 8bb: the last numSteps
+{
+	double sum = 0.0;
+	for (int32_t i = 1; i <= numSteps; i++)
+		sum += ld->steps[(ld->numSteps - i) % STEPS_SHORTTERM];
+
+	return sum / numSteps;
+}
+
+static void endStep(void)
+{
+	ld->steps[ld->numSteps % STEPS_SHORTTERM] = ld->stepEnergy / ld->stepLength;
+	ld->numSteps++;
+	ld->stepEnergy = 0.0;
+	ld->stepSamples = 0;
+
+	// 8bb: the filters would decay into (slow) denormals in silence
+	for (int32_t i = 0; i < 4; i++)
+	{
+		if (fabs(ld->z[0][i]) < 1e-30) ld->z[0][i] = 0.0;
+		if (fabs(ld->z[1][i]) < 1e-30) ld->z[1][i] = 0.0;
+	}
+
+	if (ld->numSteps >= STEPS_MOMENTARY)
+	{
+		const double block = meanOfSteps(STEPS_MOMENTARY);
+		ld->momentary = block;
+		if (block > ld->maxMomentary)
+			ld->maxMomentary = block;
+
+		const double lufs = toLUFS(block);
+		if (lufs > ABS_GATE)
+		{
+			int32_t bin = (int32_t)((lufs - ABS_GATE) * HIST_BINS_PER_LU);
+			if (bin > HIST_BINS-1)
+				bin = HIST_BINS-1;
+
+			ld->histEnergy[bin] += block;
+			ld->histBlocks[bin]++;
+		}
+	}
+
+	if (ld->numSteps >= STEPS_SHORTTERM)
+	{
+		ld->shortTerm = meanOfSteps(STEPS_SHORTTERM);
+		if (ld->shortTerm > ld->maxShortTerm)
+			ld->maxShortTerm = ld->shortTerm;
+	}
+}
+
+static inline double filterSample(const biquad_t *f, double *z, double x)
+{
+	const double y = (f->b0 * x) + z[0];
+	z[0] = (f->b1 * x) - (f->a1 * y) + z[1];
+	z[1] = (f->b2 * x) - (f->a2 * y);
+
+	return y;
+}
+
+static void kWeight(int32_t numSamples)
+{
+	const float *xL = &ld->x[0][TP_HISTORY], *xR = &ld->x[1][TP_HISTORY];
+	const biquad_t pre = ld->preFilter, rlb = ld->rlbFilter;
+
+	int32_t i = 0;
+	while (i < numSamples)
+	{
+		int32_t samples = ld->stepLength - ld->stepSamples;
+		if (samples > numSamples-i)
+			samples = numSamples-i;
+
+		double zL[4], zR[4], energy = 0.0;
+		memcpy(zL, ld->z[0], sizeof (zL));
+		memcpy(zR, ld->z[1], sizeof (zR));
+
+		for (int32_t j = 0; j < samples; j++, i++)
+		{
+			const double L = filterSample(&rlb, &zL[2], filterSample(&pre, &zL[0], xL[i]));
+			const double R = filterSample(&rlb, &zR[2], filterSample(&pre, &zR[0], xR[i]));
+			energy += (L * L) + (R * R); // 8bb: channel weights are 1.0 for L/R
+		}
+
+		memcpy(ld->z[0], zL, sizeof (zL));
+		memcpy(ld->z[1], zR, sizeof (zR));
+
+		ld->stepEnergy += energy;
+		ld->stepSamples += samples;
+		if (ld->stepSamples == ld->stepLength)
+			endStep();
+	}
+}
+
+static float peakOf(const float *x, int32_t numSamples)
+{
+	float peak = 0.0f;
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		const float a = fabsf(x[i]);
+		peak = (a > peak) ? a : peak;
+	}
+
+	return peak;
+}
+
+/* 8bb: The filter loop below works on whole arrays (one tap at a time), so
+** that the compiler can vectorize it. The K-weighting can't be, since IIR
+** filters depend on the previous sample.
+*/
+static float oversampledPeak(int32_t ch, int32_t numSamples)
+{
+	float *acc = ld->acc;
+
+	float peak = 0.0f;
+	for (int32_t p = 1; p < TP_PHASES; p++) // 8bb: phase 0 is the input sample itself (delayed)
+	{
+		for (int32_t i = 0; i < numSamples; i++)
+			acc[i] = 0.0f;
+
+		for (int32_t k = 0; k < TP_TAPS; k++)
+		{
+			const float c = ld->coeffs[p][k];
+			const float *x = &ld->x[ch][TP_HISTORY-k];
+
+			for (int32_t i = 0; i < numSamples; i++)
+				acc[i] += c * x[i];
+		}
+
+		const float a = peakOf(acc, numSamples);
+		if (a > peak)
+			peak = a;
+	}
+
+	return peak;
+}
+
+static void processChunk(const mixsmp_t *mixBufL, const mixsmp_t *mixBufR, int32_t numSamples, float gain)
+{
+	float *xL = &ld->x[0][TP_HISTORY], *xR = &ld->x[1][TP_HISTORY];
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		xL[i] = mixBufL[i] * gain;
+		xR[i] = mixBufR[i] * gain;
+	}
+
+	kWeight(numSamples);
+
+	for (int32_t ch = 0; ch < 2; ch++)
+	{
+		const float samplePeak = peakOf(&ld->x[ch][TP_HISTORY], numSamples);
+		if (samplePeak > ld->samplePeak)
+			ld->samplePeak = samplePeak;
+
+		const float truePeak = oversampledPeak(ch, numSamples);
+		if (truePeak > ld->truePeak)
+			ld->truePeak = truePeak;
+
+		if (samplePeak > ld->truePeak) // 8bb: the phase that oversampledPeak() skips
+			ld->truePeak = samplePeak;
+
+		memmove(ld->x[ch], &ld->x[ch][numSamples], TP_HISTORY * sizeof (float));
+	}
+
+	ld->samples += numSamples;
+}
+
+static double integratedLoudness(void)
+{
+	double energy = 0.0;
+	uint32_t blocks = 0;
+
+	for (int32_t i = 0; i < HIST_BINS; i++)
+	{
+		energy += ld->histEnergy[i];
+		blocks += ld->histBlocks[i];
+	}
+
+	if (blocks == 0)
+		return -HUGE_VAL;
+
+	// 8bb: relative gate (to the precision of the histogram, 0.1 LU)
+	const double gate = toLUFS(energy / blocks) + REL_GATE;
+
+	int32_t first = (int32_t)((gate - ABS_GATE) * HIST_BINS_PER_LU);
+	if (first < 0)
+		first = 0;
+
+	energy = 0.0;
+	blocks = 0;
+
+	for (int32_t i = first; i < HIST_BINS; i++)
+	{
+		energy += ld->histEnergy[i];
+		blocks += ld->histBlocks[i];
+	}
+
+	return (blocks > 0) ? toLUFS(energy / blocks) : -HUGE_VAL;
+}
+
+bool Loudness_Init(int32_t audioOutputFrequency)
+{
+	if (ld == NULL)
+	{
+		ld = (loudness_t *)malloc(sizeof (loudness_t));
+		if (ld == NULL)
+			return false;
+	}
+
+	memset(ld, 0, sizeof (loudness_t));
+	ld->stepLength = (int32_t)((audioOutputFrequency / 10.0) + 0.5); // 8bb: 100ms
+
+	setupKFilter(audioOutputFrequency);
+	setupOversampler();
+
+	return true;
+}
+
+void Loudness_Free(void)
+{
+	if (ld != NULL)
+	{
+		free(ld);
+		ld = NULL;
+	}
+}
+
+void Loudness_Process(const mixsmp_t *mixBufL, const mixsmp_t *mixBufR, int32_t numSamples, float gain)
+{
+	if (ld == NULL)
+		return;
+
+	while (numSamples > 0)
+	{
+		const int32_t samples = (numSamples > CHUNK_SIZE) ? CHUNK_SIZE : numSamples;
+		processChunk(mixBufL, mixBufR, samples, gain);
+
+		mixBufL += samples;
+		mixBufR += samples;
+		numSamples -= samples;
+	}
+}
+
+void Loudness_Get(st3_loudness_t *info)
+{
+	if (ld == NULL)
+	{
+		info->integrated = info->momentary = info->shortTerm = -HUGE_VAL;
+		info->maxMomentary = info->maxShortTerm = -HUGE_VAL;
+		info->truePeak = info->samplePeak = -HUGE_VAL;
+		info->samples = 0;
+		return;
+	}
+
+	info->integrated = integratedLoudness();
+	info->momentary = toLUFS(ld->momentary);
+	info->shortTerm = toLUFS(ld->shortTerm);
+	info->maxMomentary = toLUFS(ld->maxMomentary);
+	info->maxShortTerm = toLUFS(ld->maxShortTerm);
+	info->truePeak = toDB(ld->truePeak);
+	info->samplePeak = toDB(ld->samplePeak);
+	info->samples = ld->samples;
+}
+
+uint32_t Loudness_GetMemUsage(void)
+{
+	return (ld != NULL) ? sizeof (loudness_t) : 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../digdata.h" // 8bb: mixsmp_t, st3_loudness_t
+
+/* 8bb: EBU R128 analysis of the stereo output (ITU-R BS.1770-4): K-weighted
+** loudness with the absolute/relative gating, and the true peak (4x
+** oversampled). Loudness_Process() takes the mixing buffers before the
+** dithering, gain scales them to 1.0 = full scale. The state is on the heap
+** while the analysis is on. Not thread-safe, lock the mixer first.
+*/
+bool Loudness_Init(int32_t audioOutputFrequency); // 8bb: (re)starts the analysis
+void Loudness_Free(void);
+void Loudness_Process(const mixsmp_t *mixBufL, const mixsmp_t *mixBufR, int32_t numSamples, float gain);
+void Loudness_Get(st3_loudness_t *info);
+uint32_t Loudness_GetMemUsage(void); // 8bb: bytes of heap state (0 = off)
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+/* 8bb: One voice in the channel meters (see setChannelMeters()). The
+** mixers add every sample of a voice they mix at the rate of the chip,
+** in Q15 units of their output (32768 = full scale). The caller reads
+** and clears these between the mixer calls.
+*/
+typedef struct mixmeter_t
+{
+	uint32_t peak; // 8bb: largest |sample|
+	uint64_t sumSq; // 8bb: sum of the squared samples
+} mixmeter_t;
+
+static inline void Meter_Add(mixmeter_t *m, int32_t smp)
+{
+	const uint32_t a = (smp < 0) ? -smp : smp;
+	if (a > m->peak)
+		m->peak = a;
+
+	m->sumSq += (uint64_t)a * a;
+}
@@ -5,7 +5,10 @@
 #include <string.h>
 #include <math.h>
 #include "../dig.h"
+#include "../digevent.h"
 #include "sinc.h"
+#include "stem.h"
+#include "tap.h"
 
 #define ST3_PCM_CHANNELS 16
 
@@ -22,8 +25,33 @@ static const uint8_t xvol_st3[64+1] =
 
 static int8_t postTable[2048];
 static uint64_t resamplingFrac, resamplingDelta;
-static float fSampleBufferL[SINC_TAPS], fSampleBufferR[SINC_TAPS];
+static mixsmp_t sampleBufferL[INTRP_MAX_TAPS+INTRP_BLOCK], sampleBufferR[INTRP_MAX_TAPS+INTRP_BLOCK];
 static double dSBProOutputRate;
+static mixsmp_t stemGain; // 8bb: slope of postTable[], for stems
+static int32_t tapGain; // 8bb: the same in Q15, for meters and scopes
+
+static bool sbStereo;
+static uint16_t muteMask; // 8bb: bit n = channel n, see SBPro_SetMuteMask()
+static mixtap_t mixTap; // 8bb: see SBPro_SetMeters()/SBPro_SetScope()
+
+static void renderSamplesMono(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples);
+static void renderSamplesStereo(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples);
+static void renderSamplesMonoTapped(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples);
+static void renderSamplesStereoTapped(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples);
+
+// 8bb: [sbStereo][tapped]
+static void (*const renderFuncs[2][2])(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples) =
+{
+	{ renderSamplesMono,   renderSamplesMonoTapped   },
+	{ renderSamplesStereo, renderSamplesStereoTapped }
+};
+
+static void (*renderSamples)(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples) = renderSamplesMono; // 8bb: set in SBPro_Init()
+
+static void selectRenderFunc(void)
+{
+	renderSamples = renderFuncs[sbStereo][mixTap.meters != NULL || mixTap.scope != NULL];
+}
 
 void SBPro_Init(int32_t audioOutputFrequency, uint8_t timeConstant)
 {
@@ -31,6 +59,14 @@ void SBPro_Init(int32_t audioOutputFrequency, uint8_t timeConstant)
 	resamplingDelta = (uint64_t)round(RESAMPLING_FRAC_SCALE * (dSBProOutputRate / audioOutputFrequency));
 	resamplingFrac = 0;
 
+	// 8bb: start with empty ring buffers, so that the song always renders the same (not in ST3)
+	memset(sampleBufferL, 0, sizeof (sampleBufferL));
+	memset(sampleBufferR, 0, sizeof (sampleBufferR));
+
+	// 8bb: select the mixer for the mode once, instead of testing song.stereomode for every sample
+	sbStereo = song.stereomode;
+	selectRenderFunc();
+
 	// create post table (aka. "squeeze volume table")
 
 	uint8_t mastervol = song.header.mastermul & 127;
@@ -59,6 +95,14 @@ void SBPro_Init(int32_t audioOutputFrequency, uint8_t timeConstant)
 			postTable[i] = 127;
 		}
 	}
+
+	// 8bb: the stems get the linear part of postTable[] (one step is delta16/256 in 8-bit units)
+#ifdef ST3_FIXEDPOINT
+	stemGain = delta16; // 8bb: Q15
+#else
+	stemGain = delta16 * (1.0f / 32768.0f);
+#endif
+	tapGain = delta16;
 }
 
 double SBPro_GetOutputRate(void)
@@ -66,31 +110,86 @@ double SBPro_GetOutputRate(void)
 	return dSBProOutputRate;
 }
 
-static void outputSBProSample(float *fOutL, float *fOutR)
+uint32_t SBPro_GetMemUsage(void)
+{
+	return sizeof (postTable) + sizeof (sampleBufferL) + sizeof (sampleBufferR);
+}
+
+void SBPro_SetMuteMask(uint16_t mask)
+{
+	muteMask = mask;
+}
+
+void SBPro_SetMeters(mixmeter_t *channelMeters)
+{
+	mixTap.meters = channelMeters;
+	selectRenderFunc();
+}
+
+void SBPro_SetScope(scope_t *scope)
+{
+	mixTap.scope = scope;
+	selectRenderFunc();
+}
+
+/* 8bb: "Template" for the mono and stereo mixers below. stereo is a constant
+** in both, so the compiler removes the mode test from the inner loop. In
+** mono mode, L and R would always be equal, so only L is mixed. stems is
+** NULL except for SBPro_RenderStems(), where every channel also goes to the
+** newest ring buffer entry of its stem (cleared by the caller). tap is
+** NULL except for the tapped mixers (meters/scopes).
+*/
+static FORCEINLINE void mixSBProSample(mixsmp_t *outL, mixsmp_t *outR, const bool stereo, stem_t *stems, const mixtap_t *tap)
 {
 	uint16_t L = 1024, R = 1024;
+	const bool capture = (tap != NULL && tap->scope != NULL && Scope_Begin(tap->scope));
 
-	zchn_t *ch = song._zchn;
-	for (int32_t i = 0; i < ST3_PCM_CHANNELS; i++, ch++)
+	zvoice_t *v = mixvoice; // 8bb: voice i = channel i (see digevent.h)
+	for (int32_t i = 0; i < ST3_PCM_CHANNELS; i++, v++)
 	{
-		if (ch->m_speed == 0 || ch->m_pos == 0xFFFFFFFF || ch->m_base == NULL || ch->m_pos >= ch->m_end)
+		if (v->m_speed == 0 || v->m_pos == 0xFFFFFFFF || v->m_base == NULL || v->m_pos >= v->m_end)
 			continue;
 
-		const int16_t smp = (ch->m_base[ch->m_pos] * (int16_t)xvol_st3[ch->m_vol]) >> 8;
-		if (song.stereomode)
+		const int16_t smp = (v->m_base[v->m_pos] * (int16_t)xvol_st3[v->m_vol]) >> 8;
+		if (tap != NULL)
 		{
-			if (ch->amixtype == 0 || ch->amixtype == 2)
+			if (tap->meters != NULL)
+				Meter_Add(&tap->meters[i], smp * tapGain);
+
+			if (capture)
+				Scope_Add(tap->scope, i, smp * tapGain);
+		}
+
+		if (stems != NULL) // 8bb: the same panning as below
+		{
+			mixsmp_t *stemL = &stems[i].bufL[intrpTaps-1];
+			mixsmp_t *stemR = &stems[i].bufR[intrpTaps-1];
+			const mixsmp_t out = smp * stemGain;
+
+			if (!stereo)
+				*stemL = out;
+			else if (v->amixtype == 0 || v->amixtype == 2)
+				*((i >= 8) ? stemL : stemR) = out;
+			else if (v->amixtype == 1 || v->amixtype == 3)
+				*((i < 8) ? stemL : stemR) = out;
+			else
+				*stemL = *stemR = out;
+		}
+
+		if (stereo)
+		{
+			if (v->amixtype == 0 || v->amixtype == 2)
 			{
 				// normal mix
-				if (ch->channelnum >= 8)
+				if (i >= 8)
 					L += smp;
 				else
 					R += smp;
 			}
-			else if (ch->amixtype == 1 || ch->amixtype == 3)
+			else if (v->amixtype == 1 || v->amixtype == 3)
 			{
 				// swap L/R channels
-				if (ch->channelnum < 8)
+				if (i < 8)
 					L += smp;
 				else
 					R += smp;
@@ -106,82 +205,238 @@ static void outputSBProSample(float *fOutL, float *fOutR)
 		{
 			// centered (mono mode)
 			L += smp;
-			R += smp;
 		}
 
-		ch->m_poslow += ch->m_speed;
-		ch->m_pos += ch->m_poslow >> 16;
-		ch->m_poslow &= 0xFFFF;
+		v->m_poslow += v->m_speed;
+		v->m_pos += v->m_poslow >> 16;
+		v->m_poslow &= 0xFFFF;
 
-		if (ch->m_pos >= ch->m_end)
+		if (v->m_pos >= v->m_end)
 		{
-			if ((uint16_t)ch->m_loop != 65535) // loop enabled?
+			if ((uint16_t)v->m_loop != 65535) // loop enabled?
 			{
 				// ST3 does it like this. Safe because of loop unrolling in loader.
-				ch->m_pos += (int16_t)(ch->m_loop - ch->m_end);
+				v->m_pos += (int16_t)(v->m_loop - v->m_end);
 			}
 			else // no loop
 			{
-				ch->m_speed = 0; // stop sample
+				v->m_speed = 0; // stop sample
 			}
 		}
 	}
 
+	if (capture)
+		Scope_End(tap->scope);
+
 	// just in case of non-ST3 channel mapping (mix overflow)
 	L &= 2047;
-	R &= 2047;
+#ifdef ST3_FIXEDPOINT
+	*outL = postTable[L] * 256; // 8bb: Q15
+#else
+	*outL = postTable[L] * (1.0f / 128.0f);
+#endif
 
-	*fOutL = postTable[L] * (1.0f / 128.0f);
-	*fOutR = postTable[R] * (1.0f / 128.0f);
+	if (stereo)
+	{
+		R &= 2047;
+#ifdef ST3_FIXEDPOINT
+		*outR = postTable[R] * 256;
+#else
+		*outR = postTable[R] * (1.0f / 128.0f);
+#endif
+	}
 }
 
-static void SBPro_Output(float *outL, float *outR)
+/* 8bb: Makes the SB Pro samples for up to INTRP_BLOCK output samples at a
+** time after the last intrpTaps ones (see Intrp_ResampleMono() in
+** mixer/sinc.h), and resamples them with the kernel of the selected
+** interpolation quality.
+*/
+static FORCEINLINE void SBPro_Output(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples, const bool stereo, const mixtap_t *tap)
 {
-	resamplingFrac += resamplingDelta;
-	while (resamplingFrac >= RESAMPLING_FRAC_SCALE)
+	const int32_t taps = intrpTaps;
+
+	while (numSamples > 0)
 	{
-		resamplingFrac -= RESAMPLING_FRAC_SCALE;
+		int32_t numInput;
+		const int32_t samples = Intrp_BlockSize(resamplingFrac, resamplingDelta, numSamples, &numInput);
 
-		// advance resampling ring buffer
-		for (int32_t i = 0; i < SINC_TAPS-1; i++)
+		for (int32_t i = 0; i < numInput; i++)
 		{
-			fSampleBufferL[i] = fSampleBufferL[1+i];
-			fSampleBufferR[i] = fSampleBufferR[1+i];
+			if (stereo)
+				mixSBProSample(&sampleBufferL[taps+i], &sampleBufferR[taps+i], true, NULL, tap);
+			else
+				mixSBProSample(&sampleBufferL[taps+i], NULL, false, NULL, tap);
+		}
+
+		if (stereo)
+		{
+			Intrp_ResampleStereo(sampleBufferL, sampleBufferR, resamplingFrac, resamplingDelta, mixBufL, mixBufR, samples);
+		}
+		else
+		{
+			Intrp_ResampleMono(sampleBufferL, resamplingFrac, resamplingDelta, mixBufL, samples);
+			memcpy(mixBufR, mixBufL, samples * sizeof (mixsmp_t)); // 8bb: duplicate to stereo at the output
 		}
 
-		float inL, inR;
-		outputSBProSample(&inL, &inR);
+		resamplingFrac = (resamplingFrac + (samples * resamplingDelta)) & RESAMPLING_FRAC_MASK;
+
+		// 8bb: keep the last taps samples for the next block
+		memmove(sampleBufferL, &sampleBufferL[numInput], taps * sizeof (mixsmp_t));
+		if (stereo)
+			memmove(sampleBufferR, &sampleBufferR[numInput], taps * sizeof (mixsmp_t));
 
-		fSampleBufferL[SINC_TAPS-1] = inL;
-		fSampleBufferR[SINC_TAPS-1] = inR;
+		mixBufL += samples;
+		mixBufR += samples;
+		numSamples -= samples;
 	}
+}
+
+static void renderSamplesMono(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
+{
+	SBPro_Output(mixBufL, mixBufR, numSamples, false, NULL);
+}
 
-	const uint32_t frac32 = (uint32_t)resamplingFrac;
-	const uint32_t lutPhase = frac32 >> INTRP_PHASE_SHIFT; // 0 .. SINC_OVERSAMPLING-1
-	const float fIntrpFrac = (int32_t)(frac32 & INTRP_PHASE_MASK) * (1.0f / INTRP_PHASE_SCALE);
+static void renderSamplesStereo(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
+{
+	SBPro_Output(mixBufL, mixBufR, numSamples, true, NULL);
+}
 
-	// it may look like we go out of bounds for fSinc_2, but we have an extra phase after LUT
-	const float *fSinc_1 = fSincLUT + ( lutPhase    << SINC_TAPS_BITS);
-	const float *fSinc_2 = fSincLUT + ((lutPhase+1) << SINC_TAPS_BITS);
+static void renderSamplesMonoTapped(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
+{
+	SBPro_Output(mixBufL, mixBufR, numSamples, false, &mixTap);
+}
+
+static void renderSamplesStereoTapped(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
+{
+	SBPro_Output(mixBufL, mixBufR, numSamples, true, &mixTap);
+}
 
-	float fSumL = 0.0f, fSumR = 0.0f;
-	for (int32_t i = 0; i < SINC_TAPS; i++)
+/* 8bb: Advances a voice like mixSBProSample() would do in numMixes calls,
+** but a whole stretch at a time (the speed only changes between ticks).
+*/
+static void skipVoice(zvoice_t *v, uint64_t numMixes)
+{
+	while (numMixes > 0)
 	{
-		// do linear interpolation between phases
-		const float y1 = fSinc_1[i];
-		const float y2 = fSinc_2[i];
-		const float y = y1 + ((y2 - y1) * fIntrpFrac);
+		if (v->m_speed == 0 || v->m_pos == 0xFFFFFFFF || v->m_base == NULL || v->m_pos >= v->m_end)
+			return; // 8bb: not advanced by the mixer either
+
+		// 8bb: mixes until m_pos reaches m_end (at least one)
+		const uint64_t distance = ((uint64_t)(v->m_end - v->m_pos) << 16) - v->m_poslow;
+		uint64_t mixes = (distance + v->m_speed - 1) / v->m_speed;
+		if (mixes > numMixes)
+			mixes = numMixes;
+
+		const uint64_t poslow = v->m_poslow + (mixes * v->m_speed);
+		v->m_pos += (uint32_t)(poslow >> 16);
+		v->m_poslow = (uint32_t)poslow & 0xFFFF;
+		numMixes -= mixes;
 
-		fSumL += fSampleBufferL[i] * y;
-		fSumR += fSampleBufferR[i] * y;
+		if (v->m_pos >= v->m_end)
+		{
+			if ((uint16_t)v->m_loop != 65535) // loop enabled?
+				v->m_pos += (int16_t)(v->m_loop - v->m_end);
+			else
+				v->m_speed = 0; // stop sample
+		}
 	}
+}
+
+/* 8bb: Muted voices aren't mixed, but they still have to move on, so
+** that unmuting them is seamless. They don't depend on the other voices,
+** so they are advanced by the number of mixSBProSample() calls that the
+** next numSamples will do, and then hidden from the mixer (speed 0) until
+** showMutedVoices(). This keeps the mute test out of the mixer loop.
+*/
+static void hideMutedVoices(int32_t numSamples, uint32_t *savedSpeed)
+{
+	const uint64_t numMixes = (resamplingFrac + ((uint64_t)numSamples * resamplingDelta)) >> RESAMPLING_FRAC_BITS;
+
+	for (uint32_t mask = muteMask; mask != 0; mask &= mask - 1)
+	{
+		const int32_t i = lowestbit64(mask);
+
+		skipVoice(&mixvoice[i], numMixes);
+		savedSpeed[i] = mixvoice[i].m_speed;
+		mixvoice[i].m_speed = 0;
+	}
+}
 
-	*outL = fSumL;
-	*outR = fSumR;
+static void showMutedVoices(const uint32_t *savedSpeed)
+{
+	for (uint32_t mask = muteMask; mask != 0; mask &= mask - 1)
+	{
+		const int32_t i = lowestbit64(mask);
+		mixvoice[i].m_speed = savedSpeed[i];
+	}
 }
 
-void SBPro_RenderSamples(float *fMixBufL, float *fMixBufR, int32_t numSamples)
+void SBPro_RenderSamples(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
 {
+	if (muteMask != 0)
+	{
+		uint32_t savedSpeed[ST3_PCM_CHANNELS];
+
+		hideMutedVoices(numSamples, savedSpeed);
+		renderSamples(mixBufL, mixBufR, numSamples);
+		showMutedVoices(savedSpeed);
+	}
+	else
+	{
+		renderSamples(mixBufL, mixBufR, numSamples);
+	}
+}
+
+/* 8bb: Stem render. postTable[] isn't linear (it clips), so the stems get
+** its linear part instead, and add up to the normal output within its 8-bit
+** rounding (as long as the mix doesn't clip).
+*/
+void SBPro_RenderStems(stem_t *stems, int32_t numSamples)
+{
+	const int32_t taps = intrpTaps;
+
+	uint32_t savedSpeed[ST3_PCM_CHANNELS];
+	if (muteMask != 0)
+		hideMutedVoices(numSamples, savedSpeed);
+
 	for (int32_t i = 0; i < numSamples; i++)
-		SBPro_Output(fMixBufL++, fMixBufR++);
+	{
+		resamplingFrac += resamplingDelta;
+		while (resamplingFrac >= RESAMPLING_FRAC_SCALE)
+		{
+			resamplingFrac -= RESAMPLING_FRAC_SCALE;
+
+			// advance resampling ring buffers
+			stem_t *s = stems;
+			for (int32_t j = 0; j < ST3_PCM_CHANNELS; j++, s++)
+			{
+				for (int32_t k = 0; k < taps-1; k++)
+				{
+					s->bufL[k] = s->bufL[1+k];
+					s->bufR[k] = s->bufR[1+k];
+				}
+
+				s->bufL[taps-1] = s->bufR[taps-1] = 0;
+			}
+
+			mixsmp_t L, R;
+			if (sbStereo)
+				mixSBProSample(&L, &R, true, stems, NULL);
+			else
+				mixSBProSample(&L, NULL, false, stems, NULL);
+		}
+
+		stem_t *s = stems;
+		for (int32_t j = 0; j < ST3_PCM_CHANNELS; j++, s++)
+		{
+			if (sbStereo)
+				Intrp_Stereo(s->bufL, s->bufR, (uint32_t)resamplingFrac, &s->outL[i], &s->outR[i]);
+			else
+				s->outL[i] = s->outR[i] = Intrp_Mono(s->bufL, (uint32_t)resamplingFrac);
+		}
+	}
+
+	if (muteMask != 0)
+		showMutedVoices(savedSpeed);
 }
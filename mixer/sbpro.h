@@ -2,7 +2,15 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../digdata.h" // 8bb: mixsmp_t
+#include "stem.h"
+#include "tap.h"
 
 void SBPro_Init(int32_t audioOutputFrequency, uint8_t timeConstant);
 double SBPro_GetOutputRate(void);
-void SBPro_RenderSamples(float *fMixBufL, float *fMixBufR, int32_t numSamples);
+uint32_t SBPro_GetMemUsage(void); // 8bb: bytes of static mixer state
+void SBPro_SetMuteMask(uint16_t mask); // 8bb: bit n = channel n, muted voices aren't mixed (only advanced)
+void SBPro_SetMeters(mixmeter_t *channelMeters); // 8bb: channelMeters[0..15], NULL = off
+void SBPro_SetScope(scope_t *scope); // 8bb: voice i = channel i, NULL = off (without meters and scope, the mixer has no taps at all)
+void SBPro_RenderSamples(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples);
+void SBPro_RenderStems(stem_t *stems, int32_t numSamples); // 8bb: stems[0..15] = ST3 channels 0..15
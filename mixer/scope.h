@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCOPE_SIZE 4096 // 8bb: samples per channel ring (power of two)
+#define SCOPE_MAX_RINGS 16 // 8bb: channels of one mixer
+#define SCOPE_MAX_VOICES 32
+
+/* 8bb: One channel of the oscilloscope capture (see setChannelScopes()).
+** Single producer (the mixer), single consumer (f.ex. the UI thread).
+** The positions count up and are only written by their own side, with
+** ATOMIC_STORE(). The mixer drops samples while the ring is full.
+*/
+typedef struct scopering_t
+{
+	int16_t data[SCOPE_SIZE];
+	uint32_t writePos, readPos;
+} scopering_t;
+
+/* 8bb: The rings of one mixer. The mixer captures every voice at its
+** chip rate, decimated by step (16.16fp, 1.0 = every sample), in Q15 units
+** of its output. map[] is set by the caller (voice -> ring, numRings =
+** not captured), as are pos[] (the mixer's writePos) and end[] (where
+** the free space ends) before each mixer call.
+*/
+typedef struct scope_t
+{
+	scopering_t *rings;
+	int32_t numRings;
+	uint32_t step, phase;
+	uint8_t map[SCOPE_MAX_VOICES];
+	int32_t acc[SCOPE_MAX_RINGS+1]; // 8bb: the voices of the current sample (+1 for unmapped voices)
+	uint32_t pos[SCOPE_MAX_RINGS], end[SCOPE_MAX_RINGS];
+} scope_t;
+
+static inline bool Scope_Begin(scope_t *s) // 8bb: once per mixer sample, true = capture this one
+{
+	s->phase += s->step;
+	if (s->phase < 65536)
+		return false;
+
+	s->phase -= 65536;
+	for (int32_t i = 0; i <= s->numRings; i++)
+		s->acc[i] = 0;
+
+	return true;
+}
+
+static inline void Scope_Add(scope_t *s, int32_t voice, int32_t smp)
+{
+	s->acc[s->map[voice]] += smp;
+}
+
+static inline void Scope_End(scope_t *s) // 8bb: after the voices of a captured sample
+{
+	for (int32_t i = 0; i < s->numRings; i++)
+	{
+		if (s->pos[i] == s->end[i])
+			continue; // 8bb: ring is full
+
+		const int32_t smp = s->acc[i];
+		s->rings[i].data[s->pos[i] & (SCOPE_SIZE-1)] = (int16_t)((smp > INT16_MAX) ? INT16_MAX : ((smp < INT16_MIN) ? INT16_MIN : smp));
+		s->pos[i]++;
+	}
+}
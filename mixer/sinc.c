@@ -1,5 +1,13 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
 #include "sinc.h"
 
+#ifndef PI
+#define PI 3.14159265358979323846264338327950288
+#endif
+
 /* Pre-computed 16kB windowed-sinc table (has unity gain).
 **
 ** Number of taps: 16
@@ -1045,3 +1053,547 @@ const float fSincLUT[(SINC_OVERSAMPLING+1) * SINC_TAPS] =
 	 1.00000000000000f,  0.00000000000000f,  0.00000000000000f,  0.00000000000000f,
 	 0.00000000000000f,  0.00000000000000f,  0.00000000000000f,  0.00000000000000f
 };
+
+// 8bb: the other interpolation qualities, the tables are made on first use
+
+int32_t intrpQuality = INTRP_SINC16, intrpTaps = SINC_TAPS;
+
+#ifdef ST3_FIXEDPOINT
+static int16_t iIntrpLUT[(SINC_OVERSAMPLING+1) * INTRP_MAX_TAPS];
+#endif
+
+#ifndef ST3_NO_EXTRA_INTRP
+static float fSinc8LUT[(SINC_OVERSAMPLING+1) * 8], fSinc32LUT[(SINC_OVERSAMPLING+1) * 32];
+static float fCubicLUT[CUBIC_PHASES * 4];
+
+static bool sinc8Made, sinc32Made, cubicMade;
+
+static double besselI0(double x) // 8bb: zeroth order modified Bessel function of the first kind
+{
+	double s = 1.0, ds = 1.0, d = 0.0;
+	do
+	{
+		d += 2.0;
+		ds *= (x * x) / (d * d);
+		s += ds;
+	}
+	while (ds > s*1E-15);
+
+	return s;
+}
+
+/* 8bb: Same layout as fSincLUT: SINC_OVERSAMPLING phases plus the extra
+** phase for the interpolation, Kaiser window, unity gain for every phase.
+*/
+static void makeSincLUT(float *fLUT, int32_t taps, double beta)
+{
+	const double R = taps / 2;
+	const double dI0Beta = besselI0(beta);
+
+	for (int32_t p = 0; p <= SINC_OVERSAMPLING; p++)
+	{
+		double dKernel[INTRP_MAX_TAPS], dSum = 0.0;
+
+		for (int32_t i = 0; i < taps; i++)
+		{
+			const double x = i - (R-1.0) - (p / (double)SINC_OVERSAMPLING);
+
+			double dWindow = 0.0;
+			if (fabs(x) < R)
+				dWindow = besselI0(beta * sqrt(1.0 - ((x / R) * (x / R)))) / dI0Beta;
+
+			const double dSinc = (x == 0.0) ? 1.0 : sin(PI * x) / (PI * x);
+
+			dKernel[i] = dSinc * dWindow;
+			dSum += dKernel[i];
+		}
+
+		for (int32_t i = 0; i < taps; i++)
+			fLUT[(p * taps) + i] = (float)(dKernel[i] / dSum);
+	}
+}
+
+static void makeCubicLUT(void) // 8bb: Catmull-Rom spline
+{
+	float *fLUT = fCubicLUT;
+	for (int32_t p = 0; p < CUBIC_PHASES; p++)
+	{
+		const double t1 = p / (double)CUBIC_PHASES;
+		const double t2 = t1 * t1;
+		const double t3 = t2 * t1;
+
+		*fLUT++ = (float)((-0.5 * t3) + (       t2) - (0.5 * t1));
+		*fLUT++ = (float)(( 1.5 * t3) - (2.5 * t2) + 1.0);
+		*fLUT++ = (float)((-1.5 * t3) + (2.0 * t2) + (0.5 * t1));
+		*fLUT++ = (float)(( 0.5 * t3) - (0.5 * t2));
+	}
+}
+#endif
+
+// 8bb: the kernels, one mono and one stereo function for every quality
+
+#ifdef ST3_FIXEDPOINT
+
+/* 8bb: Integer kernels. iIntrpLUT holds the table of the selected quality
+** in Q14, converted by Intrp_SetQuality(). Samples are Q15.
+*/
+static FORCEINLINE int32_t sincKernel(const int32_t *buf, const int32_t taps, const int32_t tapsBits, uint32_t frac32)
+{
+	const uint32_t lutPhase = frac32 >> INTRP_PHASE_SHIFT; // 0 .. SINC_OVERSAMPLING-1
+	const int32_t intrpFrac = (frac32 & INTRP_PHASE_MASK) >> (INTRP_PHASE_SHIFT-16); // 0.16fp
+
+	// it may look like we go out of bounds for iSinc_2, but we have an extra phase after LUT
+	const int16_t *iSinc_1 = iIntrpLUT + ( lutPhase    << tapsBits);
+	const int16_t *iSinc_2 = iIntrpLUT + ((lutPhase+1) << tapsBits);
+
+	int64_t sum = 0;
+	for (int32_t i = 0; i < taps; i++)
+	{
+		// do linear interpolation between phases
+		const int32_t y1 = iSinc_1[i];
+		const int32_t y2 = iSinc_2[i];
+		const int32_t y = y1 + (((y2 - y1) * intrpFrac) >> 16);
+
+		sum += (int64_t)buf[i] * y;
+	}
+
+	return (int32_t)(sum >> 14);
+}
+
+static FORCEINLINE mixsmp_t intrpZOH(const mixsmp_t *buf, uint32_t frac32)
+{
+	(void)frac32;
+	return buf[0];
+}
+
+static FORCEINLINE mixsmp_t intrpLinear(const mixsmp_t *buf, uint32_t frac32)
+{
+	return buf[0] + (int32_t)(((int64_t)(buf[1] - buf[0]) * (frac32 >> 16)) >> 16);
+}
+
+#ifndef ST3_NO_EXTRA_INTRP
+static FORCEINLINE mixsmp_t intrpCubic(const mixsmp_t *buf, uint32_t frac32)
+{
+	const int16_t *c = &iIntrpLUT[(frac32 >> (32-CUBIC_PHASES_BITS)) << 2];
+	const int64_t sum = ((int64_t)buf[0] * c[0]) + ((int64_t)buf[1] * c[1]) + ((int64_t)buf[2] * c[2]) + ((int64_t)buf[3] * c[3]);
+
+	return (int32_t)(sum >> 14);
+}
+
+static FORCEINLINE mixsmp_t intrpSinc8(const mixsmp_t *buf, uint32_t frac32)
+{
+	return sincKernel(buf, 8, 3, frac32);
+}
+
+static FORCEINLINE mixsmp_t intrpSinc32(const mixsmp_t *buf, uint32_t frac32)
+{
+	return sincKernel(buf, 32, 5, frac32);
+}
+#endif
+
+static FORCEINLINE mixsmp_t intrpSinc16(const mixsmp_t *buf, uint32_t frac32)
+{
+	return sincKernel(buf, SINC_TAPS, SINC_TAPS_BITS, frac32);
+}
+
+// 8bb: the integer kernels are the same for both sides
+
+static FORCEINLINE void intrpZOHStereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	(void)frac32;
+	*outL = bufL[0];
+	*outR = bufR[0];
+}
+
+static FORCEINLINE void intrpLinearStereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	*outL = intrpLinear(bufL, frac32);
+	*outR = intrpLinear(bufR, frac32);
+}
+
+#ifndef ST3_NO_EXTRA_INTRP
+static FORCEINLINE void intrpCubicStereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	*outL = intrpCubic(bufL, frac32);
+	*outR = intrpCubic(bufR, frac32);
+}
+
+static FORCEINLINE void intrpSinc8Stereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	*outL = sincKernel(bufL, 8, 3, frac32);
+	*outR = sincKernel(bufR, 8, 3, frac32);
+}
+
+static FORCEINLINE void intrpSinc32Stereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	*outL = sincKernel(bufL, 32, 5, frac32);
+	*outR = sincKernel(bufR, 32, 5, frac32);
+}
+#endif
+
+static FORCEINLINE void intrpSinc16Stereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	*outL = sincKernel(bufL, SINC_TAPS, SINC_TAPS_BITS, frac32);
+	*outR = sincKernel(bufR, SINC_TAPS, SINC_TAPS_BITS, frac32);
+}
+
+#else
+
+static FORCEINLINE float sincKernel(const float *buf, const float *lut, const int32_t taps, const int32_t tapsBits, uint32_t frac32)
+{
+	const uint32_t lutPhase = frac32 >> INTRP_PHASE_SHIFT; // 0 .. SINC_OVERSAMPLING-1
+	const float fIntrpFrac = (int32_t)(frac32 & INTRP_PHASE_MASK) * (1.0f / INTRP_PHASE_SCALE);
+
+	// it may look like we go out of bounds for fSinc_2, but we have an extra phase after LUT
+	const float *fSinc_1 = lut + ( lutPhase    << tapsBits);
+	const float *fSinc_2 = lut + ((lutPhase+1) << tapsBits);
+
+	float fSum = 0.0f;
+	for (int32_t i = 0; i < taps; i++)
+	{
+		// do linear interpolation between phases
+		const float y1 = fSinc_1[i];
+		const float y2 = fSinc_2[i];
+		const float y = y1 + ((y2 - y1) * fIntrpFrac);
+
+		fSum += buf[i] * y;
+	}
+
+	return fSum;
+}
+
+static FORCEINLINE void sincKernelStereo(const float *bufL, const float *bufR, const float *lut, const int32_t taps,
+	const int32_t tapsBits, uint32_t frac32, float *outL, float *outR)
+{
+	const uint32_t lutPhase = frac32 >> INTRP_PHASE_SHIFT; // 0 .. SINC_OVERSAMPLING-1
+	const float fIntrpFrac = (int32_t)(frac32 & INTRP_PHASE_MASK) * (1.0f / INTRP_PHASE_SCALE);
+
+	// it may look like we go out of bounds for fSinc_2, but we have an extra phase after LUT
+	const float *fSinc_1 = lut + ( lutPhase    << tapsBits);
+	const float *fSinc_2 = lut + ((lutPhase+1) << tapsBits);
+
+	float fSumL = 0.0f, fSumR = 0.0f;
+	for (int32_t i = 0; i < taps; i++)
+	{
+		// do linear interpolation between phases
+		const float y1 = fSinc_1[i];
+		const float y2 = fSinc_2[i];
+		const float y = y1 + ((y2 - y1) * fIntrpFrac);
+
+		fSumL += bufL[i] * y;
+		fSumR += bufR[i] * y;
+	}
+
+	*outL = fSumL;
+	*outR = fSumR;
+}
+
+static FORCEINLINE mixsmp_t intrpZOH(const mixsmp_t *buf, uint32_t frac32)
+{
+	(void)frac32;
+	return buf[0];
+}
+
+static FORCEINLINE mixsmp_t intrpLinear(const mixsmp_t *buf, uint32_t frac32)
+{
+	return buf[0] + ((buf[1] - buf[0]) * ((frac32 >> 8) * (1.0f / (1 << 24))));
+}
+
+#ifndef ST3_NO_EXTRA_INTRP
+static FORCEINLINE mixsmp_t intrpCubic(const mixsmp_t *buf, uint32_t frac32)
+{
+	const float *c = &fCubicLUT[(frac32 >> (32-CUBIC_PHASES_BITS)) << 2];
+	return (buf[0] * c[0]) + (buf[1] * c[1]) + (buf[2] * c[2]) + (buf[3] * c[3]);
+}
+
+static FORCEINLINE mixsmp_t intrpSinc8(const mixsmp_t *buf, uint32_t frac32)
+{
+	return sincKernel(buf, fSinc8LUT, 8, 3, frac32);
+}
+
+static FORCEINLINE mixsmp_t intrpSinc32(const mixsmp_t *buf, uint32_t frac32)
+{
+	return sincKernel(buf, fSinc32LUT, 32, 5, frac32);
+}
+#endif
+
+static FORCEINLINE mixsmp_t intrpSinc16(const mixsmp_t *buf, uint32_t frac32)
+{
+	return sincKernel(buf, fSincLUT, SINC_TAPS, SINC_TAPS_BITS, frac32);
+}
+
+static FORCEINLINE void intrpZOHStereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	(void)frac32;
+	*outL = bufL[0];
+	*outR = bufR[0];
+}
+
+static FORCEINLINE void intrpLinearStereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	const float fFrac = (frac32 >> 8) * (1.0f / (1 << 24));
+	*outL = bufL[0] + ((bufL[1] - bufL[0]) * fFrac);
+	*outR = bufR[0] + ((bufR[1] - bufR[0]) * fFrac);
+}
+
+#ifndef ST3_NO_EXTRA_INTRP
+static FORCEINLINE void intrpCubicStereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	const float *c = &fCubicLUT[(frac32 >> (32-CUBIC_PHASES_BITS)) << 2];
+	*outL = (bufL[0] * c[0]) + (bufL[1] * c[1]) + (bufL[2] * c[2]) + (bufL[3] * c[3]);
+	*outR = (bufR[0] * c[0]) + (bufR[1] * c[1]) + (bufR[2] * c[2]) + (bufR[3] * c[3]);
+}
+
+static FORCEINLINE void intrpSinc8Stereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	sincKernelStereo(bufL, bufR, fSinc8LUT, 8, 3, frac32, outL, outR);
+}
+
+static FORCEINLINE void intrpSinc32Stereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	sincKernelStereo(bufL, bufR, fSinc32LUT, 32, 5, frac32, outL, outR);
+}
+#endif
+
+static FORCEINLINE void intrpSinc16Stereo(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR)
+{
+	sincKernelStereo(bufL, bufR, fSincLUT, SINC_TAPS, SINC_TAPS_BITS, frac32, outL, outR);
+}
+
+#endif
+
+/* 8bb: The block resamplers. quality is a constant in every caller, so
+** the compiler makes one loop for every kernel.
+*/
+static FORCEINLINE void resampleMono(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples, const int32_t quality)
+{
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		frac += delta;
+		in += frac >> RESAMPLING_FRAC_BITS; // 8bb: same as shifting the ring buffer
+		frac &= RESAMPLING_FRAC_MASK;
+
+		switch (quality)
+		{
+			case INTRP_ZOH: out[i] = intrpZOH(in, (uint32_t)frac); break;
+			case INTRP_LINEAR: out[i] = intrpLinear(in, (uint32_t)frac); break;
+#ifndef ST3_NO_EXTRA_INTRP
+			case INTRP_CUBIC: out[i] = intrpCubic(in, (uint32_t)frac); break;
+			case INTRP_SINC8: out[i] = intrpSinc8(in, (uint32_t)frac); break;
+			case INTRP_SINC32: out[i] = intrpSinc32(in, (uint32_t)frac); break;
+#endif
+			default: out[i] = intrpSinc16(in, (uint32_t)frac); break;
+		}
+	}
+}
+
+static FORCEINLINE void resampleStereo(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta,
+	mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples, const int32_t quality)
+{
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		frac += delta;
+		inL += frac >> RESAMPLING_FRAC_BITS;
+		inR += frac >> RESAMPLING_FRAC_BITS;
+		frac &= RESAMPLING_FRAC_MASK;
+
+		switch (quality)
+		{
+			case INTRP_ZOH: intrpZOHStereo(inL, inR, (uint32_t)frac, &outL[i], &outR[i]); break;
+			case INTRP_LINEAR: intrpLinearStereo(inL, inR, (uint32_t)frac, &outL[i], &outR[i]); break;
+#ifndef ST3_NO_EXTRA_INTRP
+			case INTRP_CUBIC: intrpCubicStereo(inL, inR, (uint32_t)frac, &outL[i], &outR[i]); break;
+			case INTRP_SINC8: intrpSinc8Stereo(inL, inR, (uint32_t)frac, &outL[i], &outR[i]); break;
+			case INTRP_SINC32: intrpSinc32Stereo(inL, inR, (uint32_t)frac, &outL[i], &outR[i]); break;
+#endif
+			default: intrpSinc16Stereo(inL, inR, (uint32_t)frac, &outL[i], &outR[i]); break;
+		}
+	}
+}
+
+static void resampleMonoZOH(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples)
+{
+	resampleMono(in, frac, delta, out, numSamples, INTRP_ZOH);
+}
+
+static void resampleMonoLinear(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples)
+{
+	resampleMono(in, frac, delta, out, numSamples, INTRP_LINEAR);
+}
+
+static void resampleMonoSinc16(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples)
+{
+	resampleMono(in, frac, delta, out, numSamples, INTRP_SINC16);
+}
+
+static void resampleStereoZOH(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta, mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples)
+{
+	resampleStereo(inL, inR, frac, delta, outL, outR, numSamples, INTRP_ZOH);
+}
+
+static void resampleStereoLinear(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta, mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples)
+{
+	resampleStereo(inL, inR, frac, delta, outL, outR, numSamples, INTRP_LINEAR);
+}
+
+static void resampleStereoSinc16(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta, mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples)
+{
+	resampleStereo(inL, inR, frac, delta, outL, outR, numSamples, INTRP_SINC16);
+}
+
+#ifndef ST3_NO_EXTRA_INTRP
+static void resampleMonoCubic(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples)
+{
+	resampleMono(in, frac, delta, out, numSamples, INTRP_CUBIC);
+}
+
+static void resampleMonoSinc8(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples)
+{
+	resampleMono(in, frac, delta, out, numSamples, INTRP_SINC8);
+}
+
+static void resampleMonoSinc32(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples)
+{
+	resampleMono(in, frac, delta, out, numSamples, INTRP_SINC32);
+}
+
+static void resampleStereoCubic(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta, mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples)
+{
+	resampleStereo(inL, inR, frac, delta, outL, outR, numSamples, INTRP_CUBIC);
+}
+
+static void resampleStereoSinc8(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta, mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples)
+{
+	resampleStereo(inL, inR, frac, delta, outL, outR, numSamples, INTRP_SINC8);
+}
+
+static void resampleStereoSinc32(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta, mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples)
+{
+	resampleStereo(inL, inR, frac, delta, outL, outR, numSamples, INTRP_SINC32);
+}
+#endif
+
+typedef struct intrpkernels_t
+{
+	intrpmonofunc_t mono;
+	intrpstereofunc_t stereo;
+	intrpresamplemonofunc_t resampleMono;
+	intrpresamplestereofunc_t resampleStereo;
+} intrpkernels_t;
+
+// 8bb: [INTRP_*]
+static const intrpkernels_t intrpKernels[6] =
+{
+	{ intrpZOH,    intrpZOHStereo,    resampleMonoZOH,    resampleStereoZOH    },
+	{ intrpLinear, intrpLinearStereo, resampleMonoLinear, resampleStereoLinear },
+#ifndef ST3_NO_EXTRA_INTRP
+	{ intrpCubic,  intrpCubicStereo,  resampleMonoCubic,  resampleStereoCubic  },
+	{ intrpSinc8,  intrpSinc8Stereo,  resampleMonoSinc8,  resampleStereoSinc8  },
+#else
+	{ NULL, NULL, NULL, NULL }, // 8bb: not selectable
+	{ NULL, NULL, NULL, NULL },
+#endif
+	{ intrpSinc16, intrpSinc16Stereo, resampleMonoSinc16, resampleStereoSinc16 },
+#ifndef ST3_NO_EXTRA_INTRP
+	{ intrpSinc32, intrpSinc32Stereo, resampleMonoSinc32, resampleStereoSinc32 }
+#else
+	{ NULL, NULL, NULL, NULL }
+#endif
+};
+
+intrpmonofunc_t Intrp_Mono = intrpSinc16;
+intrpstereofunc_t Intrp_Stereo = intrpSinc16Stereo;
+intrpresamplemonofunc_t Intrp_ResampleMono = resampleMonoSinc16;
+intrpresamplestereofunc_t Intrp_ResampleStereo = resampleStereoSinc16;
+
+void Intrp_SetQuality(int32_t quality)
+{
+	switch (quality)
+	{
+		case INTRP_ZOH: intrpTaps = 1; break;
+		case INTRP_LINEAR: intrpTaps = 2; break;
+
+#ifndef ST3_NO_EXTRA_INTRP
+		case INTRP_CUBIC:
+		{
+			if (!cubicMade)
+			{
+				makeCubicLUT();
+				cubicMade = true;
+			}
+
+			intrpTaps = 4;
+		}
+		break;
+
+		case INTRP_SINC8:
+		{
+			if (!sinc8Made)
+			{
+				makeSincLUT(fSinc8LUT, 8, 5.0);
+				sinc8Made = true;
+			}
+
+			intrpTaps = 8;
+		}
+		break;
+
+		case INTRP_SINC32:
+		{
+			if (!sinc32Made)
+			{
+				makeSincLUT(fSinc32LUT, 32, 10.0);
+				sinc32Made = true;
+			}
+
+			intrpTaps = 32;
+		}
+		break;
+#endif
+
+		default:
+			quality = INTRP_SINC16;
+			intrpTaps = SINC_TAPS;
+			break;
+	}
+
+	intrpQuality = quality;
+
+	const intrpkernels_t *k = &intrpKernels[quality];
+	Intrp_Mono = k->mono;
+	Intrp_Stereo = k->stereo;
+	Intrp_ResampleMono = k->resampleMono;
+	Intrp_ResampleStereo = k->resampleStereo;
+
+#ifdef ST3_FIXEDPOINT
+	// 8bb: convert the table to Q14 for the integer kernels (float math is only used here)
+	const float *fLUT = NULL;
+	int32_t length = 0;
+
+	switch (quality)
+	{
+#ifndef ST3_NO_EXTRA_INTRP
+		case INTRP_CUBIC: fLUT = fCubicLUT; length = CUBIC_PHASES * 4; break;
+		case INTRP_SINC8: fLUT = fSinc8LUT; length = (SINC_OVERSAMPLING+1) * 8; break;
+		case INTRP_SINC32: fLUT = fSinc32LUT; length = (SINC_OVERSAMPLING+1) * 32; break;
+#endif
+		case INTRP_SINC16: fLUT = fSincLUT; length = (SINC_OVERSAMPLING+1) * SINC_TAPS; break;
+		default: break;
+	}
+
+	for (int32_t i = 0; i < length; i++)
+		iIntrpLUT[i] = (int16_t)lrintf(fLUT[i] * 16384.0f);
+#endif
+}
+
+uint32_t Intrp_GetMemUsage(void) // 8bb: fSincLUT is const, so it's not counted (it can stay in ROM)
+{
+	uint32_t bytes = 0;
+#ifndef ST3_NO_EXTRA_INTRP
+	bytes += sizeof (fSinc8LUT) + sizeof (fSinc32LUT) + sizeof (fCubicLUT);
+#endif
+#ifdef ST3_FIXEDPOINT
+	bytes += sizeof (iIntrpLUT);
+#endif
+	return bytes;
+}
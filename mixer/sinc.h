@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include "../digdata.h" // 8bb: INTRP_* qualities
+
 #define SINC_TAPS 16
 #define SINC_TAPS_BITS 4 /* log2(SINC_TAPS) */
 #define SINC_OVERSAMPLING 256
@@ -14,3 +17,67 @@
 #define INTRP_PHASE_MASK (INTRP_PHASE_SCALE-1)
 
 extern const float fSincLUT[(SINC_OVERSAMPLING+1) * SINC_TAPS];
+
+/* 8bb: Selectable interpolation quality (see Intrp_SetQuality()). The
+** resamplers keep the last intrpTaps input samples in buf[0..intrpTaps-1]
+** (buf[intrpTaps-1] = newest sample, the stems have ring buffers of
+** INTRP_MAX_TAPS samples), and the output is interpolated between
+** buf[intrpTaps/2-1] and buf[intrpTaps/2].
+*/
+#ifdef ST3_NO_EXTRA_INTRP
+#define INTRP_MAX_TAPS SINC_TAPS // 8bb: only ZOH, linear and 16-tap sinc (see digdata.h)
+#else
+#define INTRP_MAX_TAPS 32
+#endif
+#define CUBIC_PHASES_BITS 10
+#define CUBIC_PHASES (1 << CUBIC_PHASES_BITS)
+
+extern int32_t intrpQuality, intrpTaps;
+
+/* 8bb: The kernels of the selected quality, set by Intrp_SetQuality(), so
+** that the resamplers don't have to check the quality for every sample.
+**
+** Intrp_ResampleMono()/Intrp_ResampleStereo() make a block of numSamples
+** output samples. in[] holds the last intrpTaps input samples of the
+** previous block, followed by the new input samples of this block (see
+** Intrp_BlockSize()), and frac is the position (0.32fp) at the start of
+** the block, like in the ring buffer above. Intrp_Mono()/Intrp_Stereo() do
+** one output sample from the ring buffer (for the stem renders).
+*/
+typedef mixsmp_t (*intrpmonofunc_t)(const mixsmp_t *buf, uint32_t frac32);
+typedef void (*intrpstereofunc_t)(const mixsmp_t *bufL, const mixsmp_t *bufR, uint32_t frac32, mixsmp_t *outL, mixsmp_t *outR);
+typedef void (*intrpresamplemonofunc_t)(const mixsmp_t *in, uint64_t frac, uint64_t delta, mixsmp_t *out, int32_t numSamples);
+typedef void (*intrpresamplestereofunc_t)(const mixsmp_t *inL, const mixsmp_t *inR, uint64_t frac, uint64_t delta,
+	mixsmp_t *outL, mixsmp_t *outR, int32_t numSamples);
+
+extern intrpmonofunc_t Intrp_Mono;
+extern intrpstereofunc_t Intrp_Stereo;
+extern intrpresamplemonofunc_t Intrp_ResampleMono;
+extern intrpresamplestereofunc_t Intrp_ResampleStereo;
+
+/* 8bb: Max. new input samples per block, the resamplers' input buffers are
+** INTRP_MAX_TAPS+INTRP_BLOCK long. The input rate has to be below
+** INTRP_BLOCK times the output rate (the chips run at <50kHz, the output
+** is at least 8kHz).
+*/
+#ifdef ST3_NO_EXTRA_INTRP
+#define INTRP_BLOCK 64
+#else
+#define INTRP_BLOCK 256
+#endif
+
+/* 8bb: Returns how many of numSamples output samples the next block can
+** have, and how many new input samples it needs (*numInput).
+*/
+static inline int32_t Intrp_BlockSize(uint64_t frac, uint64_t delta, int32_t numSamples, int32_t *numInput)
+{
+	const uint64_t maxSamples = ((((uint64_t)INTRP_BLOCK+1) << RESAMPLING_FRAC_BITS) - 1 - frac) / delta;
+	if ((uint64_t)numSamples > maxSamples)
+		numSamples = (int32_t)maxSamples;
+
+	*numInput = (int32_t)((frac + (numSamples * delta)) >> RESAMPLING_FRAC_BITS);
+	return numSamples;
+}
+
+void Intrp_SetQuality(int32_t quality); // 8bb: not thread-safe, lock the mixer first
+uint32_t Intrp_GetMemUsage(void); // 8bb: bytes of RAM tables
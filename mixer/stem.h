@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include "../digdata.h" // 8bb: mixsmp_t
+#include "sinc.h" // 8bb: INTRP_MAX_TAPS
+
+/* 8bb: One ST3 channel in a stem render (see Dig_RenderStemsToWAV()).
+** Every stem has its own resampling ring buffers at the rate of the chip,
+** so that each stem is resampled on its own. The mixers write numSamples
+** to outL/outR, which are set by the caller before each call.
+*/
+typedef struct stem_t
+{
+	mixsmp_t bufL[INTRP_MAX_TAPS], bufR[INTRP_MAX_TAPS];
+	mixsmp_t *outL, *outR;
+} stem_t;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "meter.h"
+#include "scope.h"
+
+/* 8bb: Optional per-voice outputs of a mixer, for the UI (see dig.c).
+** The mixers only take the path with these when one is set, the voice
+** loops get the tap as an inline parameter (NULL in the normal path).
+*/
+typedef struct mixtap_t
+{
+	mixmeter_t *meters; // 8bb: NULL = off
+	scope_t *scope; // 8bb: NULL = off
+} mixtap_t;
@@ -0,0 +1,189 @@
+// helper thread for mixing jobs
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "worker.h"
+
+static void (*jobFunc)(void *arg);
+static void *jobArg;
+static bool workerOpen, quitFlag;
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+static HANDLE hThread, hJobEvent, hDoneEvent; // 8bb: auto-reset events
+
+static DWORD WINAPI workerThread(LPVOID arg)
+{
+	while (true)
+	{
+		WaitForSingleObject(hJobEvent, INFINITE);
+		if (quitFlag)
+			break;
+
+		jobFunc(jobArg);
+		SetEvent(hDoneEvent);
+	}
+
+	return 0;
+	(void)arg;
+}
+
+bool Worker_Init(void)
+{
+	if (workerOpen)
+		return true;
+
+	quitFlag = false;
+
+	hJobEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hDoneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (hJobEvent == NULL || hDoneEvent == NULL)
+	{
+		Worker_Free();
+		return false;
+	}
+
+	hThread = CreateThread(NULL, 0, workerThread, NULL, 0, NULL);
+	if (hThread == NULL)
+	{
+		Worker_Free();
+		return false;
+	}
+
+	workerOpen = true;
+	return true;
+}
+
+void Worker_Free(void)
+{
+	if (hThread != NULL)
+	{
+		quitFlag = true;
+		SetEvent(hJobEvent);
+		WaitForSingleObject(hThread, INFINITE);
+
+		CloseHandle(hThread);
+		hThread = NULL;
+	}
+
+	if (hJobEvent != NULL)
+	{
+		CloseHandle(hJobEvent);
+		hJobEvent = NULL;
+	}
+
+	if (hDoneEvent != NULL)
+	{
+		CloseHandle(hDoneEvent);
+		hDoneEvent = NULL;
+	}
+
+	workerOpen = false;
+}
+
+void Worker_Start(void (*func)(void *arg), void *arg)
+{
+	jobFunc = func;
+	jobArg = arg;
+	SetEvent(hJobEvent); // 8bb: also a memory barrier
+}
+
+void Worker_Wait(void)
+{
+	WaitForSingleObject(hDoneEvent, INFINITE);
+}
+
+void Worker_Yield(void)
+{
+	SwitchToThread();
+}
+
+#else
+
+#include <pthread.h>
+#include <sched.h>
+
+static pthread_t threadId;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobCond = PTHREAD_COND_INITIALIZER, doneCond = PTHREAD_COND_INITIALIZER;
+static bool jobPending;
+
+static void *workerThread(void *arg)
+{
+	pthread_mutex_lock(&mutex);
+	while (true)
+	{
+		while (!jobPending && !quitFlag)
+			pthread_cond_wait(&jobCond, &mutex);
+
+		if (quitFlag)
+			break;
+
+		pthread_mutex_unlock(&mutex);
+		jobFunc(jobArg);
+		pthread_mutex_lock(&mutex);
+
+		jobPending = false;
+		pthread_cond_signal(&doneCond);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return NULL;
+	(void)arg;
+}
+
+bool Worker_Init(void)
+{
+	if (workerOpen)
+		return true;
+
+	quitFlag = jobPending = false;
+	if (pthread_create(&threadId, NULL, workerThread, NULL) != 0)
+		return false;
+
+	workerOpen = true;
+	return true;
+}
+
+void Worker_Free(void)
+{
+	if (!workerOpen)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	quitFlag = true;
+	pthread_cond_signal(&jobCond);
+	pthread_mutex_unlock(&mutex);
+
+	pthread_join(threadId, NULL);
+	workerOpen = false;
+}
+
+void Worker_Start(void (*func)(void *arg), void *arg)
+{
+	pthread_mutex_lock(&mutex);
+	jobFunc = func;
+	jobArg = arg;
+	jobPending = true;
+	pthread_cond_signal(&jobCond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void Worker_Wait(void)
+{
+	pthread_mutex_lock(&mutex);
+	while (jobPending)
+		pthread_cond_wait(&doneCond, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+void Worker_Yield(void)
+{
+	sched_yield();
+}
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* 8bb: One helper thread that runs one job at a time (used for rendering
+** the OPL2 emulator while the PCM voices are mixed, see dig.c).
+** Worker_Start() hands over a job and returns right away, Worker_Wait()
+** blocks until the job is done. Only one thread may start/wait for jobs.
+*/
+bool Worker_Init(void);
+void Worker_Free(void);
+void Worker_Start(void (*func)(void *arg), void *arg);
+void Worker_Wait(void);
+void Worker_Yield(void); // 8bb: gives up the rest of the time slice (for short waits on other threads)
@@ -19,6 +19,8 @@
 #include "../dig.h" // 8bb: CLAMP(), etc.
 #include "../mixer/sinc.h"
 
+#ifndef ST3_NO_ADLIB // 8bb: small-footprint profile, see digdata.h
+
 #define ISA_OSCPIN_CLK (157500000.0 / 11.0) /* 8bb: exact nominal clock */
 #define OPL2_OUTPUT_RATE (ISA_OSCPIN_CLK / 288.0) /* 8bb: ~49715.9090Hz */
 #define NUM_CHANNELS 9
@@ -36,20 +38,22 @@ enum
 
 typedef struct rcFilter_t
 {
+#ifdef ST3_FIXEDPOINT
+	int32_t lastSample, a0; // 8bb: lastSample is 15.12fp, a0 is 0.24fp
+#else
 	float lastSample, b1, a0;
+#endif
 } rcFilter_t;
 
+/* 8bb: Register state of an operator, only used when the registers are
+** written. What's needed for every output sample is in OpBank (OpBank_t).
+*/
 typedef struct Operator_t
 {
 	void *ParentChan; // 8bb: Channel_t type
-	bool KeyOn, KeyScaleRate, SustainMode, TremoloEnable, VibratoEnable;
-	int16_t EnvelopeLevel, Out[2];
-	const uint16_t *AttackTab, *DecayTab, *ReleaseTab;
-	uint16_t Waveform, FreqMultTimes2, OutputLevel, AttackRate, DecayRate, SustainLevel, ReleaseRate;
-	uint16_t AttackShift, AttackMask, AttackAdd, DecayShift, DecayMask, DecayAdd, ReleaseShift;
-	uint16_t ReleaseMask, ReleaseAdd, KeyScaleShift, KeyScaleLevel;
-	int32_t EnvelopeStage;
-	uint32_t Phase;
+	bool KeyOn, KeyScaleRate;
+	uint16_t OutputLevel, AttackRate, DecayRate, ReleaseRate, KeyScaleShift, KeyScaleLevel;
+	int32_t Slot; // 8bb: index in OpBank
 } Operator_t;
 
 typedef struct Channel_t
@@ -59,6 +63,36 @@ typedef struct Channel_t
 	Operator_t *Op[OPERATORS_PER_CHANNEL];
 } Channel_t;
 
+enum // 8bb: envelope rate index in OpBank_t
+{
+	RATE_ATTACK  = 0,
+	RATE_DECAY   = 1,
+	RATE_RELEASE = 2
+};
+
+/* 8bb: The per-sample operator state, as a structure-of-arrays. Slot 0..8
+** are the modulators and 9..17 the carriers of channel 0..8, so that
+** OutputOPL2Sample() can run every stage for all operators in a row, and
+** all modulators before the carriers (the carrier phase depends on the
+** modulator output). Operators that are off are skipped entirely: their
+** phase isn't used before the next key-on resets it.
+*/
+typedef struct OpBank_t
+{
+	uint32_t Phase[NUM_OPERATORS];
+	int32_t EnvelopeStage[NUM_OPERATORS], VibratoMask[NUM_OPERATORS]; // 8bb: VibratoMask is 0 or -1
+	int16_t EnvelopeLevel[NUM_OPERATORS];
+	uint16_t TotalLevel[NUM_OPERATORS]; // 8bb: OutputLevel + KeyScaleLevel
+	uint16_t TremoloMask[NUM_OPERATORS]; // 8bb: 0 or 0xFFFF
+	uint16_t FreqMultTimes2[NUM_OPERATORS], SustainLevel[NUM_OPERATORS];
+	uint16_t WaveMirror[NUM_OPERATORS], WaveSilence[NUM_OPERATORS], WaveNegate[NUM_OPERATORS]; // 8bb: see SetWaveform()
+	bool SustainMode[NUM_OPERATORS];
+	uint32_t ActiveMask; // 8bb: bit n = slot n is not ENV_OFF
+	int16_t Out[2][NUM_CHANNELS]; // 8bb: last two modulator outputs, for feedback
+	const uint16_t *EnvTab[3][NUM_OPERATORS]; // 8bb: [RATE_*][slot]
+	uint16_t EnvShift[3][NUM_OPERATORS], EnvMask[3][NUM_OPERATORS], EnvAdd[3][NUM_OPERATORS];
+} OpBank_t;
+
 static const uint16_t RateTables[4][8] =
 {
 	{ 1, 0, 1, 0, 1, 0, 1, 0 },
@@ -108,6 +142,7 @@ static const uint16_t LogSinTable[256] = // 8bb: from ROM
 };
 
 static const int chan_ops[NUM_CHANNELS] = { 0, 1, 2, 6, 7, 8, 12, 13, 14 };
+static const uint8_t slotChannel[NUM_OPERATORS] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8 }; // 8bb: OpBank slot -> channel
 
 static const int8_t op_lookup[32] =
 {
@@ -122,6 +157,17 @@ static const uint16_t mul_times_2[16] =
 
 static const uint8_t kslShift[4] = { 8, 1, 2, 0 };
 
+/* 8bb: Mirror (for phase bit 8), silence and negate phase bits of the four
+** waveforms (sine, half sine, positive sine, quarter positive sine).
+*/
+static const uint16_t waveformBits[4][3] =
+{
+	{ 0xFF, 0x000, 0x200 },
+	{ 0xFF, 0x200, 0x000 },
+	{ 0xFF, 0x000, 0x000 },
+	{ 0x00, 0x100, 0x000 }
+};
+
 static const uint8_t levtab[128] = // 8bb: based on KSL table from ROM, but modified for speed
 {
 	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
@@ -136,39 +182,56 @@ static const uint8_t levtab[128] = // 8bb: based on KSL table from ROM, but modi
 
 static bool NoteSel, TremoloDepth, VibratoDepth;
 static uint16_t Clock, TremoloClock, TremoloLevel, VibratoTick, VibratoClock;
-static float fSampleBuffer[SINC_TAPS];
+static mixsmp_t sampleBuffer[INTRP_MAX_TAPS+INTRP_BLOCK];
 static uint64_t resamplingFrac, resamplingDelta;
 static Channel_t Channel[NUM_CHANNELS];
 static Operator_t Operator[NUM_OPERATORS];
-static rcFilter_t filter;
+static OpBank_t OpBank;
+static uint32_t dirtyRates; // 8bb: bit n = the envelope rates of OpBank slot n are out of date
+static uint16_t muteMask; // 8bb: bit n = channel n, see OPL2_SetMuteMask()
+static mixtap_t mixTap; // 8bb: see OPL2_SetMeters()/OPL2_SetScope()
+#ifdef ST3_FIXEDPOINT
+static int32_t outGainL = 256, outGainR = 256; // 8bb: 256 = 1.0, see OPL2_SetGain()
+#else
+static float outGainL = 1.0f, outGainR = 1.0f;
+#endif
+static rcFilter_t filter, stemFilter[NUM_CHANNELS]; // 8bb: stemFilter is for OPL2_RenderStems()
 
-static int16_t OperatorOutput(Operator_t *Op, uint32_t phase_step, int16_t vibrato, int16_t mod, int16_t fbshift)
+static inline int16_t OperatorOutput(int32_t k, uint16_t level, int16_t mod) // 8bb: waveform output of a running operator
 {
-	// Advance wave phase
-	if (Op->VibratoEnable)
-		phase_step += vibrato;
+	const uint16_t phase = (uint16_t)(OpBank.Phase[k] >> 10) + mod;
+
+	// 8bb: the waveform switch is replaced by the bits from waveformBits[] (see SetWaveform())
+	const uint16_t offset = (phase & 0xFF) ^ (OpBank.WaveMirror[k] & -((phase >> 8) & 1));
+	const uint16_t logsin = (phase & OpBank.WaveSilence[k]) ? 0x1000 : LogSinTable[offset];
 
-	Op->Phase += (phase_step * Op->FreqMultTimes2) >> 1;
+	uint16_t mix = logsin + level;
+	if (mix > 0x1FFF)
+		mix = 0x1FFF;
+
+	int16_t v = ExpTable[mix & 0xFF] >> (mix >> 8);
+
+	v += v;
+	v ^= -(int16_t)((phase & OpBank.WaveNegate[k]) != 0);
 
-	const uint16_t level = (Op->EnvelopeLevel + Op->OutputLevel + Op->KeyScaleLevel + (Op->TremoloEnable ? TremoloLevel : 0)) << 3;
+	return v;
+}
 
-	switch (Op->EnvelopeStage)
+static inline bool UpdateEnvelope(int32_t k) // 8bb: returns false if the operator is (or just got) silent
+{
+	// 8bb: EnvAdd is zero for rate 0
+	switch (OpBank.EnvelopeStage[k])
 	{
 		// Attack stage
 		case ENV_ATTACK:
 		{
-			uint16_t add = ((Op->AttackAdd >> Op->AttackTab[(Clock >> Op->AttackShift) & 7]) * ~Op->EnvelopeLevel) >> 3;
-			if (Op->AttackRate == 0)
-				add = 0;
-
-			if (Op->AttackMask && (Clock & Op->AttackMask))
-				add = 0;
+			if (!(Clock & OpBank.EnvMask[RATE_ATTACK][k]))
+				OpBank.EnvelopeLevel[k] += (uint16_t)(((OpBank.EnvAdd[RATE_ATTACK][k] >> OpBank.EnvTab[RATE_ATTACK][k][(Clock >> OpBank.EnvShift[RATE_ATTACK][k]) & 7]) * ~OpBank.EnvelopeLevel[k]) >> 3);
 
-			Op->EnvelopeLevel += add;
-			if (Op->EnvelopeLevel <= 0)
+			if (OpBank.EnvelopeLevel[k] <= 0)
 			{
-				Op->EnvelopeLevel = 0;
-				Op->EnvelopeStage = ENV_DECAY;
+				OpBank.EnvelopeLevel[k] = 0;
+				OpBank.EnvelopeStage[k] = ENV_DECAY;
 			}
 		}
 		break;
@@ -176,18 +239,13 @@ static int16_t OperatorOutput(Operator_t *Op, uint32_t phase_step, int16_t vibra
 		// Decay stage
 		case ENV_DECAY:
 		{
-			uint16_t add = Op->DecayAdd >> Op->DecayTab[(Clock >> Op->DecayShift) & 7];
-			if (Op->DecayRate == 0)
-				add = 0;
-
-			if (Op->DecayMask && (Clock & Op->DecayMask))
-				add = 0;
+			if (!(Clock & OpBank.EnvMask[RATE_DECAY][k]))
+				OpBank.EnvelopeLevel[k] += (uint16_t)(OpBank.EnvAdd[RATE_DECAY][k] >> OpBank.EnvTab[RATE_DECAY][k][(Clock >> OpBank.EnvShift[RATE_DECAY][k]) & 7]);
 
-			Op->EnvelopeLevel += add;
-			if (Op->EnvelopeLevel >= Op->SustainLevel)
+			if (OpBank.EnvelopeLevel[k] >= OpBank.SustainLevel[k])
 			{
-				Op->EnvelopeLevel = Op->SustainLevel;
-				Op->EnvelopeStage = ENV_SUSTAIN;
+				OpBank.EnvelopeLevel[k] = OpBank.SustainLevel[k];
+				OpBank.EnvelopeStage[k] = ENV_SUSTAIN;
 			}
 		}
 		break;
@@ -195,7 +253,7 @@ static int16_t OperatorOutput(Operator_t *Op, uint32_t phase_step, int16_t vibra
 		// Sustain stage
 		case ENV_SUSTAIN:
 		{
-			if (Op->SustainMode)
+			if (OpBank.SustainMode[k])
 				break;
 
 			// Note: fall-through!
@@ -204,102 +262,34 @@ static int16_t OperatorOutput(Operator_t *Op, uint32_t phase_step, int16_t vibra
 		// Release stage
 		case ENV_RELEASE:
 		{
-			uint16_t add = Op->ReleaseAdd >> Op->ReleaseTab[(Clock >> Op->ReleaseShift) & 7];
-			if (Op->ReleaseRate == 0)
-				add = 0;
+			if (!(Clock & OpBank.EnvMask[RATE_RELEASE][k]))
+				OpBank.EnvelopeLevel[k] += (uint16_t)(OpBank.EnvAdd[RATE_RELEASE][k] >> OpBank.EnvTab[RATE_RELEASE][k][(Clock >> OpBank.EnvShift[RATE_RELEASE][k]) & 7]);
 
-			if (Op->ReleaseMask && (Clock & Op->ReleaseMask))
-				add = 0;
-
-			Op->EnvelopeLevel += add;
-			if (Op->EnvelopeLevel >= 0x1FF)
+			if (OpBank.EnvelopeLevel[k] >= 0x1FF)
 			{
-				Op->EnvelopeLevel = 0x1FF;
-				Op->EnvelopeStage = ENV_OFF;
-				Op->Out[0] = Op->Out[1] = 0;
-				return 0;
+				OpBank.EnvelopeLevel[k] = 0x1FF;
+				OpBank.EnvelopeStage[k] = ENV_OFF;
+				OpBank.ActiveMask &= ~(1UL << k);
+
+				if (k < NUM_CHANNELS)
+					OpBank.Out[0][k] = OpBank.Out[1][k] = 0;
+
+				return false;
 			}
 		}
 		break;
 
 		// Envelope, and therefore the operator, is not running
 		default:
-			Op->Out[0] = Op->Out[1] = 0;
-			return 0;
+			return false;
 	}
 
-	// Feedback? In that case we modulate by a blend of the last two samples
-	if (fbshift != 0)
-		mod += (Op->Out[0] + Op->Out[1]) >> fbshift;
-
-	const uint16_t phase = (uint16_t)(Op->Phase >> 10) + mod;
-	uint16_t offset = phase & 0xFF;
-	uint16_t logsin;
-	bool negate = false;
-
-	switch (Op->Waveform)
-	{
-		case 0: // Standard sine wave
-		{
-			if (phase & 0x100)
-				offset ^= 0xFF;
-
-			logsin = LogSinTable[offset];
-			negate = !!(phase & 0x200);
-		}
-		break;
-
-		case 1: // Half sine wave
-		{
-			if (phase & 0x200)
-				logsin = 0x1000;
-			else if (phase & 0x100)
-				logsin = LogSinTable[offset ^ 0xFF];
-			else
-				logsin = LogSinTable[offset];
-		}
-		break;
-
-		case 2: // Positive sine wave
-		{
-			if (phase & 0x100)
-				offset ^= 0xFF;
-
-			logsin = LogSinTable[offset];
-		}
-		break;
-
-		default:
-		case 3: // Quarter positive sine wave
-		{
-			if (phase & 0x100)
-				logsin = 0x1000;
-			else
-				logsin = LogSinTable[offset];
-		}
-		break;
-	}
-
-	uint16_t mix = logsin + level;
-	if (mix > 0x1FFF)
-		mix = 0x1FFF;
-
-	int16_t v = ExpTable[mix & 0xFF] >> (mix >> 8);
-
-	v += v;
-	if (negate)
-		v = ~v;
-
-	// Keep last two results for feedback calculation
-	Op->Out[1] = Op->Out[0];
-	Op->Out[0] = v;
-
-	return v;
+	return true;
 }
 
-static int16_t ChannelOutput(Channel_t *Ch)
+static int32_t ChannelVibrato(const Channel_t *Ch)
 {
-	int16_t out, vibrato = (Ch->Freq >> 7) & 7;
+	int16_t vibrato = (Ch->Freq >> 7) & 7;
 	if (!VibratoDepth)
 		vibrato >>= 1;
 
@@ -319,31 +309,127 @@ static int16_t ChannelOutput(Channel_t *Ch)
 			vibrato = -vibrato; // The second half positions are negative
 	}
 
-	// Combine individual operator outputs
-	if (Ch->ModulationType == 0)
-	{
-		// Frequency modulation (well, phase modulation technically)
-		out = OperatorOutput(Ch->Op[0], Ch->PhaseStep, vibrato, 0, Ch->FeedbackShift);
-		out = OperatorOutput(Ch->Op[1], Ch->PhaseStep, vibrato, out, 0);
-	}
-	else
-	{
-		// Additive
-		out  = OperatorOutput(Ch->Op[0], Ch->PhaseStep, vibrato, 0, Ch->FeedbackShift);
-		out += OperatorOutput(Ch->Op[1], Ch->PhaseStep, vibrato, 0, 0);
-	}
+	return vibrato;
+}
+
+static inline mixsmp_t DCBlock(rcFilter_t *f, int32_t smp)
+{
+#ifdef ST3_FIXEDPOINT
+	/* 8bb: apply DC-centering high-pass filter. Since b1 = 1-a0, this is
+	** the same as the float version below: y += (x - y) * a0
+	*/
+	f->lastSample += (int32_t)(((int64_t)((smp * 4096) - f->lastSample) * f->a0) >> 24);
+	return smp - (f->lastSample >> 12); // 8bb: Q15
+#else
+	float fSmp = (float)smp * (1.0f / 32768.0f);
+
+	// 8bb: apply DC-centering high-pass filter
+	f->lastSample = (fSmp * f->a0) + (f->lastSample * f->b1);
+	fSmp -= f->lastSample;
 
-	return out;
+	return fSmp;
+#endif
 }
 
-static float OutputOPL2Sample(void)
+/* 8bb: chanOut is NULL except for OPL2_RenderStems(), where it gets the
+** output of every channel (it has to be cleared by the caller). tap is
+** NULL except for meters/scopes (before the DC filter).
+*/
+static inline mixsmp_t OutputOPL2Sample(int16_t *chanOut, const mixtap_t *tap)
 {
 	int32_t mix = 0;
+	const bool capture = (tap != NULL && tap->scope != NULL && Scope_Begin(tap->scope));
+
+	// 8bb: the stages below run for all operators at once (see OpBank_t)
+	if (OpBank.ActiveMask != 0)
+	{
+		int32_t vibrato[NUM_CHANNELS];
+		uint16_t level[NUM_OPERATORS];
+		int16_t modOut[NUM_CHANNELS];
+
+		const Channel_t *Ch = Channel;
+		for (int32_t c = 0; c < NUM_CHANNELS; c++, Ch++)
+			vibrato[c] = ChannelVibrato(Ch);
+
+		/* Advance wave phase, get the attenuation (from the envelope level
+		** before it's updated), and update the envelope.
+		*/
+		uint32_t running = 0;
+		for (uint32_t mask = OpBank.ActiveMask; mask != 0; mask &= mask - 1)
+		{
+			const int32_t k = lowestbit64(mask);
+			const int32_t c = slotChannel[k];
+
+			OpBank.Phase[k] += ((Channel[c].PhaseStep + (vibrato[c] & OpBank.VibratoMask[k])) * OpBank.FreqMultTimes2[k]) >> 1;
+			level[k] = (uint16_t)((OpBank.EnvelopeLevel[k] + OpBank.TotalLevel[k] + (TremoloLevel & OpBank.TremoloMask[k])) << 3);
+
+			if (UpdateEnvelope(k))
+				running |= 1UL << k;
+		}
+
+		// Modulators (with feedback, a blend of the last two samples)
+		Ch = Channel;
+		for (int32_t c = 0; c < NUM_CHANNELS; c++, Ch++)
+		{
+			modOut[c] = 0;
+			if (!(running & (1UL << c)))
+				continue;
+
+			int16_t mod = 0;
+			if (Ch->FeedbackShift != 0)
+				mod += (OpBank.Out[0][c] + OpBank.Out[1][c]) >> Ch->FeedbackShift;
+
+			modOut[c] = OperatorOutput(c, level[c], mod);
+
+			// Keep last two results for feedback calculation
+			OpBank.Out[1][c] = OpBank.Out[0][c];
+			OpBank.Out[0][c] = modOut[c];
+		}
+
+		/* Carriers, and combine the operator outputs. 8bb: Muted channels
+		** are skipped here (the modulators above have to run for the feedback,
+		** and phase/envelope for seamless unmuting).
+		*/
+		Ch = Channel;
+		for (int32_t c = 0; c < NUM_CHANNELS; c++, Ch++)
+		{
+			if (muteMask & (1 << c))
+				continue;
+
+			const int32_t k = NUM_CHANNELS + c;
+
+			int16_t out;
+			if (Ch->ModulationType == 0)
+			{
+				// Frequency modulation (well, phase modulation technically)
+				out = (running & (1UL << k)) ? OperatorOutput(k, level[k], modOut[c]) : 0;
+			}
+			else
+			{
+				// Additive
+				out = modOut[c];
+				if (running & (1UL << k))
+					out += OperatorOutput(k, level[k], 0);
+			}
+
+			mix += out;
+			if (chanOut != NULL)
+				chanOut[c] = out;
+
+			if (tap != NULL)
+			{
+				if (tap->meters != NULL)
+					Meter_Add(&tap->meters[c], out);
+
+				if (capture)
+					Scope_Add(tap->scope, c, out);
+			}
+		}
+	}
+
+	if (capture)
+		Scope_End(tap->scope);
 
-	// Sum the output of each channel
-	Channel_t *Ch = Channel;
-	for (int32_t i = 0; i < NUM_CHANNELS; i++, Ch++)
-		mix += ChannelOutput(Ch);
 	mix = CLAMP(mix, INT16_MIN, INT16_MAX);
 
 	Clock++;
@@ -359,13 +445,7 @@ static float OutputOPL2Sample(void)
 		VibratoClock = (VibratoClock + 1) & 7;
 	}
 
-	float fMix = (float)mix * (1.0f / 32768.0f);
-
-	// 8bb: apply DC-centering high-pass filter
-	filter.lastSample = (fMix * filter.a0) + (filter.lastSample * filter.b1);
-	fMix -= filter.lastSample;
-
-	return fMix;
+	return DCBlock(&filter, mix);
 }
 
 static void ComputePhaseStep(Channel_t *Ch)
@@ -373,43 +453,63 @@ static void ComputePhaseStep(Channel_t *Ch)
 	Ch->PhaseStep = (uint32_t)Ch->Freq << Ch->Octave;
 }
 
-static void ComputeRates(Channel_t *Ch, Operator_t *Op)
+static void ComputeRate(int32_t r, int32_t k, uint16_t rate, uint16_t keyScaleNumber) // 8bb: r = RATE_*, k = OpBank slot
 {
-	int32_t combined_rate = Op->AttackRate * 4 + (Ch->KeyScaleNumber >> (Op->KeyScaleRate ? 0 : 2));
-	int32_t rate_high = combined_rate >> 2;
-	int32_t rate_low = combined_rate & 3;
+	const int32_t combined_rate = rate * 4 + keyScaleNumber;
+	const int32_t rate_high = combined_rate >> 2;
+	const int32_t rate_low = combined_rate & 3;
 
-	Op->AttackShift = (uint16_t)(rate_high < 12 ? (12 - rate_high) : 0);
-	Op->AttackMask = (1 << Op->AttackShift) - 1;
-	Op->AttackAdd = (rate_high < 12) ? 1 : (1 << (rate_high - 12));
-	Op->AttackTab = RateTables[rate_low];
+	OpBank.EnvShift[r][k] = (uint16_t)(rate_high < 12 ? (12 - rate_high) : 0);
+	OpBank.EnvMask[r][k] = (1 << OpBank.EnvShift[r][k]) - 1;
+	OpBank.EnvAdd[r][k] = (rate_high < 12) ? 1 : (1 << (rate_high - 12));
+	OpBank.EnvTab[r][k] = RateTables[rate_low];
 
-	if (Op->AttackRate == 15) // Attack rate of 15 is always instant
-		Op->AttackAdd = 0xFFF;
-
-	combined_rate = Op->DecayRate * 4 + (Ch->KeyScaleNumber >> (Op->KeyScaleRate ? 0 : 2));
-	rate_high = combined_rate >> 2;
-	rate_low = combined_rate & 3;
+	if (rate == 0)
+		OpBank.EnvAdd[r][k] = 0; // 8bb: a rate of 0 never changes the envelope level
+}
 
-	Op->DecayShift = (uint16_t)(rate_high < 12 ? (12 - rate_high) : 0);
-	Op->DecayMask = (1 << Op->DecayShift) - 1;
-	Op->DecayAdd = (rate_high < 12) ? 1 : (1 << (rate_high - 12));
-	Op->DecayTab = RateTables[rate_low];
+static void ComputeRates(Channel_t *Ch, Operator_t *Op) // 8bb: use MarkRatesDirty() when writing registers
+{
+	const uint16_t keyScaleNumber = Ch->KeyScaleNumber >> (Op->KeyScaleRate ? 0 : 2);
 
-	combined_rate = Op->ReleaseRate * 4 + (Ch->KeyScaleNumber >> (Op->KeyScaleRate ? 0 : 2));
-	rate_high = combined_rate >> 2;
-	rate_low = combined_rate & 3;
+	ComputeRate(RATE_ATTACK, Op->Slot, Op->AttackRate, keyScaleNumber);
+	if (Op->AttackRate == 15) // Attack rate of 15 is always instant
+		OpBank.EnvAdd[RATE_ATTACK][Op->Slot] = 0xFFF;
 
-	Op->ReleaseShift = (uint16_t)(rate_high < 12 ? (12 - rate_high) : 0);
-	Op->ReleaseMask = (1 << Op->ReleaseShift) - 1;
-	Op->ReleaseAdd = (rate_high < 12) ? 1 : (1 << (rate_high - 12));
-	Op->ReleaseTab = RateTables[rate_low];
+	ComputeRate(RATE_DECAY, Op->Slot, Op->DecayRate, keyScaleNumber);
+	ComputeRate(RATE_RELEASE, Op->Slot, Op->ReleaseRate, keyScaleNumber);
 }
 
 static void ComputeKeyScaleLevel(Channel_t *Ch, Operator_t *Op)
 {
 	const int32_t i = (Ch->Octave << 4) | (Ch->Freq >> 6);
 	Op->KeyScaleLevel = levtab[i & 127] >> Op->KeyScaleShift;
+	OpBank.TotalLevel[Op->Slot] = Op->OutputLevel + Op->KeyScaleLevel;
+}
+
+/* 8bb: The envelope rates are only needed for rendering, and one register
+** write sequence (f.ex. an instrument load, or 0xB0 with both octave and
+** frequency) used to compute them several times per operator. They are
+** now computed once per changed operator in CommitRegisters(), right before
+** the next samples are rendered. Nothing else reads them, and they only
+** depend on the current register values, so the output is the same.
+*/
+static void MarkRatesDirty(Operator_t *Op)
+{
+	dirtyRates |= 1UL << Op->Slot;
+}
+
+static void CommitRegisters(void)
+{
+	for (uint32_t mask = dirtyRates; mask != 0; mask &= mask - 1)
+	{
+		const int32_t k = lowestbit64(mask);
+		Channel_t *Ch = &Channel[slotChannel[k]];
+
+		ComputeRates(Ch, Ch->Op[k >= NUM_CHANNELS]);
+	}
+
+	dirtyRates = 0;
 }
 
 static void ComputeKeyScaleNumber(Channel_t *Ch)
@@ -425,9 +525,8 @@ static void ComputeKeyScaleNumber(Channel_t *Ch)
 		if (Op == NULL)
 			continue;
 
-		Channel_t *OpCh = (Channel_t *)Op->ParentChan;
-		ComputeRates(OpCh, Op);
-		ComputeKeyScaleLevel(OpCh, Op);
+		MarkRatesDirty(Op);
+		ComputeKeyScaleLevel((Channel_t *)Op->ParentChan, Op);
 	}
 }
 
@@ -460,23 +559,24 @@ static void OperatorSetKeyOn(Operator_t *Op, bool on)
 	if (on)
 	{
 		// The highest attack rate is instant; it bypasses the attack phase
+		OpBank.ActiveMask |= 1UL << Op->Slot;
 		if (Op->AttackRate == 15)
 		{
-			Op->EnvelopeStage = ENV_DECAY;
-			Op->EnvelopeLevel = 0;
+			OpBank.EnvelopeStage[Op->Slot] = ENV_DECAY;
+			OpBank.EnvelopeLevel[Op->Slot] = 0;
 		}
 		else
 		{
-			Op->EnvelopeStage = ENV_ATTACK;
+			OpBank.EnvelopeStage[Op->Slot] = ENV_ATTACK;
 		}
 
-		Op->Phase = 0;
+		OpBank.Phase[Op->Slot] = 0;
 	}
 	else
 	{
 		// Stopping current sound?
-		if (Op->EnvelopeStage != ENV_OFF && Op->EnvelopeStage != ENV_RELEASE)
-			Op->EnvelopeStage = ENV_RELEASE;
+		if (OpBank.EnvelopeStage[Op->Slot] != ENV_OFF && OpBank.EnvelopeStage[Op->Slot] != ENV_RELEASE)
+			OpBank.EnvelopeStage[Op->Slot] = ENV_RELEASE;
 	}
 }
 
@@ -491,10 +591,10 @@ static void SetFeedback(Channel_t *Ch, uint16_t val)
 	Ch->FeedbackShift = val ? (9 - val) : 0;
 }
 
-static void SetEnvelopeScaling(Channel_t *Ch, Operator_t *Op, bool on)
+static void SetEnvelopeScaling(Operator_t *Op, bool on)
 {
 	Op->KeyScaleRate = on;
-	ComputeRates(Ch, Op);
+	MarkRatesDirty(Op);
 }
 
 static void SetKeyScale(Channel_t *Ch, Operator_t *Op, uint16_t scale)
@@ -503,27 +603,71 @@ static void SetKeyScale(Channel_t *Ch, Operator_t *Op, uint16_t scale)
 	ComputeKeyScaleLevel(Ch, Op);
 }
 
-static void SetAttackRate(Channel_t *Ch, Operator_t *Op, uint16_t rate)
+static void SetOutputLevel(Operator_t *Op, uint16_t level)
+{
+	Op->OutputLevel = level;
+	OpBank.TotalLevel[Op->Slot] = Op->OutputLevel + Op->KeyScaleLevel;
+}
+
+static void SetWaveform(Operator_t *Op, uint16_t waveform)
+{
+	OpBank.WaveMirror[Op->Slot]  = waveformBits[waveform][0];
+	OpBank.WaveSilence[Op->Slot] = waveformBits[waveform][1];
+	OpBank.WaveNegate[Op->Slot]  = waveformBits[waveform][2];
+}
+
+static void SetAttackRate(Operator_t *Op, uint16_t rate)
 {
 	Op->AttackRate = rate;
-	ComputeRates(Ch, Op);
+	MarkRatesDirty(Op);
 }
 
-static void SetDecayRate(Channel_t *Ch, Operator_t *Op, uint16_t rate)
+static void SetDecayRate(Operator_t *Op, uint16_t rate)
 {
 	Op->DecayRate = rate;
-	ComputeRates(Ch, Op);
+	MarkRatesDirty(Op);
 }
 
 static void SetSustainLevel(Operator_t *Op, uint16_t level)
 {
-	Op->SustainLevel = (level < 15 ? level : 31) << 4;
+	OpBank.SustainLevel[Op->Slot] = (level < 15 ? level : 31) << 4;
 }
 
-static void SetReleaseRate(Channel_t *Ch, Operator_t *Op, uint16_t rate)
+static void SetReleaseRate(Operator_t *Op, uint16_t rate)
 {
 	Op->ReleaseRate = rate;
-	ComputeRates(Ch, Op);
+	MarkRatesDirty(Op);
+}
+
+uint32_t OPL2_GetMemUsage(void)
+{
+	return sizeof (Channel) + sizeof (Operator) + sizeof (OpBank) + sizeof (dirtyRates) + sizeof (muteMask) + sizeof (outGainL) + sizeof (outGainR) + sizeof (sampleBuffer) + sizeof (filter) + sizeof (stemFilter);
+}
+
+void OPL2_SetMuteMask(uint16_t mask) // 8bb: not reset by OPL2_Init()
+{
+	muteMask = mask & ((1 << NUM_CHANNELS) - 1);
+}
+
+void OPL2_SetMeters(mixmeter_t *channelMeters) // 8bb: not reset by OPL2_Init()
+{
+	mixTap.meters = channelMeters;
+}
+
+void OPL2_SetScope(scope_t *scope) // 8bb: not reset by OPL2_Init()
+{
+	mixTap.scope = scope;
+}
+
+double OPL2_GetOutputRate(void)
+{
+	return OPL2_OUTPUT_RATE;
+}
+
+void OPL2_SetGain(mixsmp_t gainL, mixsmp_t gainR) // 8bb: not reset by OPL2_Init()
+{
+	outGainL = gainL;
+	outGainR = gainR;
 }
 
 void OPL2_Init(int32_t audioOutputFrequency)
@@ -533,21 +677,30 @@ void OPL2_Init(int32_t audioOutputFrequency)
 
 	// 8bb: OPL DC-blocking high-pass filter
 	const double cutoffHz = 3.18309886184; // 8bb: based on RC values from Sound Blaster 1.0 schematics
+#ifdef ST3_FIXEDPOINT
+	filter.a0 = (int32_t)round((1.0 - exp((-2.0 * PI) * cutoffHz / OPL2_OUTPUT_RATE)) * (1 << 24));
+	filter.lastSample = 0;
+#else
 	filter.b1 = (float)exp((-2.0 * PI) * cutoffHz / OPL2_OUTPUT_RATE);
 	filter.a0 = 1.0f - filter.b1;
 	filter.lastSample = 0.0f;
+#endif
+
+	for (int32_t i = 0; i < NUM_CHANNELS; i++)
+		stemFilter[i] = filter;
 
 	TremoloClock = TremoloLevel = VibratoTick = VibratoClock = Clock = 0;
+	dirtyRates = 0;
 	NoteSel = TremoloDepth = VibratoDepth = false;
 
 	// Initialize operators
 	memset(Operator, 0, sizeof (Operator));
-	Operator_t *Op = Operator;
-	for (int32_t i = 0; i < NUM_OPERATORS; i++, Op++)
+	memset(&OpBank, 0, sizeof (OpBank));
+	for (int32_t i = 0; i < NUM_OPERATORS; i++)
 	{
-		Op->FreqMultTimes2 = 1;
-		Op->EnvelopeStage = ENV_OFF;
-		Op->EnvelopeLevel = 0x1FF;
+		OpBank.FreqMultTimes2[i] = 1;
+		OpBank.EnvelopeStage[i] = ENV_OFF;
+		OpBank.EnvelopeLevel[i] = 0x1FF;
 	}
 
 	// Initialize channels
@@ -560,15 +713,21 @@ void OPL2_Init(int32_t audioOutputFrequency)
 		Ch->Op[1] = &Operator[op+3];
 		Ch->Op[0]->ParentChan = Ch;
 		Ch->Op[1]->ParentChan = Ch;
+		Ch->Op[0]->Slot = i;
+		Ch->Op[1]->Slot = NUM_CHANNELS + i;
 	}
 
 	// Initialize operator rates
-	Op = Operator;
+	Operator_t *Op = Operator;
 	for (int32_t i = 0; i < NUM_OPERATORS; i++, Op++)
+	{
 		ComputeRates((Channel_t *)Op->ParentChan, Op);
+		SetWaveform(Op, 0);
+	}
 
 	resamplingDelta = (uint64_t)round(RESAMPLING_FRAC_SCALE * (OPL2_OUTPUT_RATE / (double)audioOutputFrequency));
 	resamplingFrac = 0;
+	memset(sampleBuffer, 0, sizeof (sampleBuffer)); // 8bb: so that the song always renders the same
 }
 
 void OPL2_WritePort(uint16_t reg_num, uint8_t val)
@@ -645,79 +804,162 @@ void OPL2_WritePort(uint16_t reg_num, uint8_t val)
 		{
 			// Tremolo Enable / Vibrato Enable / Sustain Mode / Envelope Scaling / Frequency Multiplier
 			case 0x20:
-				Op->TremoloEnable = !!(val & 0x80);
-				Op->VibratoEnable = !!(val & 0x40);
-				Op->SustainMode = !!(val & 0x20);
-				SetEnvelopeScaling(OpCh, Op, !!(val & 0x10));
-				Op->FreqMultTimes2 = mul_times_2[val & 15];
+				OpBank.TremoloMask[Op->Slot] = (val & 0x80) ? 0xFFFF : 0;
+				OpBank.VibratoMask[Op->Slot] = (val & 0x40) ? -1 : 0;
+				OpBank.SustainMode[Op->Slot] = !!(val & 0x20);
+				SetEnvelopeScaling(Op, !!(val & 0x10));
+				OpBank.FreqMultTimes2[Op->Slot] = mul_times_2[val & 15];
 				break;
 
 			// Key Scale / Output Level
 			case 0x40:
 				SetKeyScale(OpCh, Op, val >> 6);
-				Op->OutputLevel = (val & 0x3F) << 2;
+				SetOutputLevel(Op, (val & 0x3F) << 2);
 				break;
 
 			// Attack Rate / Decay Rate
 			case 0x60:
-				SetAttackRate(OpCh, Op, val >> 4);
-				SetDecayRate(OpCh, Op, val & 15);
+				SetAttackRate(Op, val >> 4);
+				SetDecayRate(Op, val & 15);
 				break;
 
 			// Sustain Level / Release Rate
 			case 0x80:
 				SetSustainLevel(Op, val >> 4);
-				SetReleaseRate(OpCh, Op, val & 15);
+				SetReleaseRate(Op, val & 15);
 				break;
 			
 			// Waveform
 			case 0xE0:
-				Op->Waveform = val & 3;
+				SetWaveform(Op, val & 3);
 				break;
 		}
 	}
 }
 
-static float OPL2_Output(void)
+/* 8bb: Makes the OPL2 samples for up to INTRP_BLOCK output samples at a
+** time after the last intrpTaps ones (see Intrp_ResampleMono() in
+** mixer/sinc.h), and resamples them with the kernel of the selected
+** interpolation quality.
+*/
+static FORCEINLINE void OPL2_Output(mixsmp_t *outBuf, int32_t numSamples, const mixtap_t *tap)
 {
-	resamplingFrac += resamplingDelta;
-	while (resamplingFrac >= RESAMPLING_FRAC_SCALE)
+	const int32_t taps = intrpTaps;
+
+	while (numSamples > 0)
 	{
-		resamplingFrac -= RESAMPLING_FRAC_SCALE;
+		int32_t numInput;
+		const int32_t samples = Intrp_BlockSize(resamplingFrac, resamplingDelta, numSamples, &numInput);
+
+		for (int32_t i = 0; i < numInput; i++)
+			sampleBuffer[taps+i] = OutputOPL2Sample(NULL, tap);
+
+		Intrp_ResampleMono(sampleBuffer, resamplingFrac, resamplingDelta, outBuf, samples); // 8bb: mixer/sinc.h
+		resamplingFrac = (resamplingFrac + (samples * resamplingDelta)) & RESAMPLING_FRAC_MASK;
 
-		// 8bb: advance resampling ring buffer
-		for (int32_t i = 0; i < SINC_TAPS-1; i++)
-			fSampleBuffer[i] = fSampleBuffer[1+i];
-		fSampleBuffer[SINC_TAPS-1] = OutputOPL2Sample();
+		// 8bb: keep the last taps samples for the next block
+		memmove(sampleBuffer, &sampleBuffer[numInput], taps * sizeof (mixsmp_t));
+
+		outBuf += samples;
+		numSamples -= samples;
 	}
+}
+
+static inline void MixOutput(mixsmp_t *mixL, mixsmp_t *mixR, mixsmp_t sample)
+{
+	// 8bb: lower gain of the PCM voices a little, and mix in the OPL2 output
+#ifdef ST3_FIXEDPOINT
+	*mixL = ((*mixL * 2) / 3) + ((sample * outGainL) >> 8);
+	*mixR = ((*mixR * 2) / 3) + ((sample * outGainR) >> 8);
+#else
+	*mixL = (*mixL * (2.0f/3.0f)) + (sample * outGainL);
+	*mixR = (*mixR * (2.0f/3.0f)) + (sample * outGainR);
+#endif
+}
 
-	const uint32_t frac32 = (uint32_t)resamplingFrac;
-	const uint32_t lutPhase = frac32 >> INTRP_PHASE_SHIFT; // 8bb: 0 .. SINC_OVERSAMPLING-1
-	const float fIntrpFrac = (int32_t)(frac32 & INTRP_PHASE_MASK) * (1.0f / INTRP_PHASE_SCALE);
+void OPL2_RenderToBuffer(mixsmp_t *outBuf, int32_t numSamples)
+{
+	if (dirtyRates != 0)
+		CommitRegisters();
 
-	// 8bb: it may look like we go out of bounds for fSinc_2, but we have an extra phase after LUT
-	const float *fSinc_1 = fSincLUT + ( lutPhase    << SINC_TAPS_BITS);
-	const float *fSinc_2 = fSincLUT + ((lutPhase+1) << SINC_TAPS_BITS);
+	if (mixTap.meters != NULL || mixTap.scope != NULL)
+		OPL2_Output(outBuf, numSamples, &mixTap);
+	else
+		OPL2_Output(outBuf, numSamples, NULL);
+}
 
-	float fSum = 0.0f;
-	for (int32_t i = 0; i < SINC_TAPS; i++)
+void OPL2_RenderSamples(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples)
+{
+	mixsmp_t oplBuf[INTRP_BLOCK];
+
+	while (numSamples > 0)
+	{
+		const int32_t samples = (numSamples < INTRP_BLOCK) ? numSamples : INTRP_BLOCK;
+
+		OPL2_RenderToBuffer(oplBuf, samples);
+		for (int32_t i = 0; i < samples; i++)
+			MixOutput(&mixBufL[i], &mixBufR[i], oplBuf[i]);
+
+		mixBufL += samples;
+		mixBufR += samples;
+		numSamples -= samples;
+	}
+}
+
+void OPL2_MixBuffer(mixsmp_t *mixBufL, mixsmp_t *mixBufR, const mixsmp_t *oplBuf, int32_t numSamples)
+{
+	if (oplBuf == NULL) // 8bb: only lower the gain (PCM stems)
 	{
-		// 8bb: do linear interpolation between phases
-		const float y1 = fSinc_1[i];
-		const float y2 = fSinc_2[i];
-		fSum += fSampleBuffer[i] * (y1 + ((y2 - y1) * fIntrpFrac));
+		for (int32_t i = 0; i < numSamples; i++)
+			MixOutput(&mixBufL[i], &mixBufR[i], 0);
+
+		return;
 	}
 
-	return fSum;
+	for (int32_t i = 0; i < numSamples; i++)
+		MixOutput(&mixBufL[i], &mixBufR[i], oplBuf[i]);
 }
 
-void OPL2_RenderSamples(float *fMixBufL, float *fMixBufR, int32_t numSamples)
+/* 8bb: Stem render. The channels get their own DC filter, so that the
+** stems add up to the normal output (except where that clips). The gain
+** is applied, as with OPL2_MixBuffer() on a silent buffer.
+*/
+void OPL2_RenderStems(stem_t *stems, int32_t numSamples)
 {
+	const int32_t taps = intrpTaps;
+
+	if (dirtyRates != 0)
+		CommitRegisters();
+
 	for (int32_t i = 0; i < numSamples; i++)
 	{
-		const float sample = OPL2_Output();
+		resamplingFrac += resamplingDelta;
+		while (resamplingFrac >= RESAMPLING_FRAC_SCALE)
+		{
+			resamplingFrac -= RESAMPLING_FRAC_SCALE;
 
-		fMixBufL[i] += sample;
-		fMixBufR[i] += sample;
+			int16_t chanOut[NUM_CHANNELS] = { 0 };
+			OutputOPL2Sample(chanOut, NULL);
+
+			stem_t *s = stems;
+			for (int32_t c = 0; c < NUM_CHANNELS; c++, s++)
+			{
+				// 8bb: advance resampling ring buffer
+				for (int32_t k = 0; k < taps-1; k++)
+					s->bufL[k] = s->bufL[1+k];
+				s->bufL[taps-1] = DCBlock(&stemFilter[c], chanOut[c]);
+			}
+		}
+
+		stem_t *s = stems;
+		for (int32_t c = 0; c < NUM_CHANNELS; c++, s++)
+		{
+			mixsmp_t L = 0, R = 0;
+			MixOutput(&L, &R, Intrp_Mono(s->bufL, (uint32_t)resamplingFrac));
+			s->outL[i] = L;
+			s->outR[i] = R;
+		}
 	}
 }
+
+#endif
@@ -1,7 +1,24 @@
 #pragma once
 
 #include <stdint.h>
+#include "../digdata.h" // 8bb: mixsmp_t
+#include "../mixer/stem.h"
+#include "../mixer/tap.h"
 
 void OPL2_Init(int32_t audioOutputFrequency);
 void OPL2_WritePort(uint16_t reg_num, uint8_t val);
-void OPL2_RenderSamples(float *fMixBufL, float *fMixBufR, int32_t numSamples);
+void OPL2_SetGain(mixsmp_t gainL, mixsmp_t gainR); // 8bb: output gain, 1.0f = unity (256 with ST3_FIXEDPOINT)
+void OPL2_SetMuteMask(uint16_t mask); // 8bb: bit n = channel n, muted channels aren't mixed (but keep running)
+void OPL2_SetMeters(mixmeter_t *channelMeters); // 8bb: channelMeters[0..8], NULL = off
+void OPL2_SetScope(scope_t *scope); // 8bb: channel c = voice c, NULL = off
+double OPL2_GetOutputRate(void);
+void OPL2_RenderSamples(mixsmp_t *mixBufL, mixsmp_t *mixBufR, int32_t numSamples); // 8bb: mixBuf = (mixBuf * 2/3) + (OPL2 * gain)
+
+/* 8bb: The same in two steps, so that the OPL2 output can be rendered on
+** another thread while the PCM voices are mixed. Don't write ports while
+** OPL2_RenderToBuffer() is running.
+*/
+void OPL2_RenderToBuffer(mixsmp_t *outBuf, int32_t numSamples);
+void OPL2_MixBuffer(mixsmp_t *mixBufL, mixsmp_t *mixBufR, const mixsmp_t *oplBuf, int32_t numSamples); // 8bb: oplBuf = NULL: only lowers the gain
+void OPL2_RenderStems(stem_t *stems, int32_t numSamples); // 8bb: stems[0..8] = AdLib channels (ST3 channels 16..24)
+uint32_t OPL2_GetMemUsage(void); // 8bb: bytes of static emulator state
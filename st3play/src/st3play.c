@@ -12,6 +12,8 @@
 #define DEFAULT_MIX_FREQ 48000
 #define DEFAULT_MIX_BUFSIZE 1024
 #define DEFAULT_MIX_VOL 256
+#define DEFAULT_ADLIB_VOL 256
+#define DEFAULT_ADLIB_PAN 0
 #define DEFAULT_SOUNDCARD -1 /* -1 (auto-detect), SOUNDCARD_SBPRO or SOUNDCARD_GUS */
 
 // set to true if you want st3play to always render to WAV
@@ -21,14 +23,19 @@
 bool renderToWavFlag = DEFAULT_WAVRENDER_MODE_FLAG;
 static int32_t soundCardType = DEFAULT_SOUNDCARD;
 static int32_t mixingVolume = DEFAULT_MIX_VOL;
+static int32_t adlibVolume = DEFAULT_ADLIB_VOL;
+static int32_t adlibPanning = DEFAULT_ADLIB_PAN;
 static int32_t mixingFrequency = DEFAULT_MIX_FREQ;
 static int32_t mixingBufferSize = DEFAULT_MIX_BUFSIZE;
 // ----------------------------------------------------------
 
 static volatile bool programRunning;
+static bool memUsageFlag, adlibThreadFlag, renderStemsFlag, loudnessFlag;
 static char *filename, *WAVRenderFilename;
 
 static void showUsage(void);
+static void showMemUsage(void);
+static void showLoudness(const st3_loudness_t *l);
 static void handleArguments(int argc, char *argv[]);
 static void readKeyboard(void);
 static int32_t renderToWav(void);
@@ -40,7 +47,10 @@ void wavRecordingThread(void *arg)
 void *wavRecordingThread(void *arg)
 #endif
 {
-	Dig_RenderToWAV(mixingFrequency, mixingBufferSize, WAVRenderFilename);
+	if (renderStemsFlag)
+		Dig_RenderStemsToWAV(mixingFrequency, mixingBufferSize, filename);
+	else
+		Dig_RenderToWAV(mixingFrequency, mixingBufferSize, WAVRenderFilename);
 #ifndef _WIN32
 	return NULL;
 #endif
@@ -72,7 +82,11 @@ int main(int argc, char *argv[])
 	handleArguments(argc, argv);
 #endif
 
+#ifdef ST3_FIXEDPOINT
+	audio.mixingVol = mixingVolume;
+#else
 	audio.fMixingVol = mixingVolume / (256.0f / 32768.0f);
+#endif
 
 	if (!initMusic(mixingFrequency, mixingBufferSize))
 	{
@@ -86,6 +100,20 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	setAdLibMix(adlibVolume, adlibPanning);
+	if (adlibThreadFlag && !setAdLibThread(true))
+		printf("Warning: Couldn't start the AdLib rendering thread!\n");
+
+	if (loudnessFlag && renderToWavFlag && !renderStemsFlag && !setLoudnessAnalysis(true))
+		printf("Warning: Out of memory for the loudness analysis!\n");
+
+	if (memUsageFlag)
+	{
+		showMemUsage();
+		closeMusic();
+		return 0;
+	}
+
 	if (soundCardType == -1)
 	{
 		printf("NOTE:\n");
@@ -111,14 +139,17 @@ int main(int argc, char *argv[])
 	printf("\n");
 	printf("Controls:\n");
 	printf("Esc=Quit   Space=Toggle Pause   Plus = inc. song pos   Minus = dec. song pos\n");
+	printf("1..9 = Toggle mute of song channel 1..9   0 = Unmute all channels\n");
 	printf("\n");
 	printf("Name: %s\n", song.header.name);
 	printf("Instruments: %d/99\n", song.header.insnum);
 	printf("Song length: %d/255\n", song.header.ordnum);
 
+#ifndef ST3_NO_GUS
 	if (audio.soundcardtype == SOUNDCARD_GUS)
 		printf("Sound card: Gravis Ultrasound (%d voices - %.2fHz)\n", GUS_GetNumberOfVoices(), GUS_GetOutputRate());
 	else
+#endif
 		printf("Sound card: Sound Blaster Pro (%s - %.2fHz)\n",  song.stereomode ? "stereo" : "mono", SBPro_GetOutputRate());
 
 	printf("Audio output frequency: %dHz\n", audio.outputFreq);
@@ -137,6 +168,7 @@ int main(int argc, char *argv[])
 	while (programRunning)
 	{
 		readKeyboard();
+		st3_materializewanted(song.shared); // 8bb: loads the samples of a lazily loaded song (no-op otherwise)
 
 		if (audio.soundcardtype == SOUNDCARD_GUS)
 		{
@@ -189,7 +221,9 @@ static void showUsage(void)
 {
 	printf("Usage:\n");
 	printf("  st3play input_module [-f hz] [-s sb/gus] [-b buffersize]\n");
-	printf("  st3play input_module [--no-intrp] [--render-to-wav]\n");
+	printf("  st3play input_module [-a adlibvol] [-p adlibpan] [--adlib-thread]\n");
+	printf("  st3play input_module [--no-intrp] [--render-to-wav] [--mem-usage]\n");
+	printf("  st3play input_module [--render-stems] [--loudness]\n");
 	printf("\n");
 	printf("  Options:\n");
 	printf("    input_module     Specifies the module file to load (.S3M)\n");
@@ -199,13 +233,24 @@ static void showUsage(void)
 	printf("                     Certain behaviors in the replayer depends on the sound card\n");
 	printf("                     type. GUS also has volume ramping.\n");
 	printf("    -b buffersize    Specifies the mixing buffer size (256..8192)\n");
+	printf("    -a adlibvol      Specifies the AdLib volume (0..256)\n");
+	printf("    -p adlibpan      Specifies the AdLib panning (-128..128, 0 = center)\n");
 	printf("    --render-to-wav  Renders song to WAV instead of playing it. The output\n");
 	printf("                     filename will be the input filename with .WAV added to the\n");
 	printf("                     end.\n");
+	printf("    --render-stems   Renders every channel to its own WAV file in one pass. The\n");
+	printf("                     output filenames will be the input filename with the ST3\n");
+	printf("                     channel name (.L1.wav, .R1.wav, .A1.wav etc.) added.\n");
+	printf("    --loudness       Measures the loudness (EBU R128) and true peak while\n");
+	printf("                     rendering to WAV, and shows them afterwards.\n");
+	printf("    --adlib-thread   Renders AdLib on a separate thread (for multi-core CPUs).\n");
+	printf("    --mem-usage      Shows the memory usage of the replayer and the loaded\n");
+	printf("                     song, then exits.\n");
 	printf("\n");
 	printf("Default settings:\n");
 	printf("  - Mixing buffer size:       %d\n", DEFAULT_MIX_BUFSIZE);
 	printf("  - Mixing volume:            %d\n", DEFAULT_MIX_VOL);
+	printf("  - AdLib volume/panning:     %d/%d\n", DEFAULT_ADLIB_VOL, DEFAULT_ADLIB_PAN);
 	printf("  - Sound card type:          %s\n",
 		(soundCardType == -1) ? "Auto-Detect" :
 		((soundCardType == SOUNDCARD_GUS) ? "Gravis Ultrasound" : "Sound Blaster Pro"));
@@ -213,6 +258,30 @@ static void showUsage(void)
 	printf("\n");
 }
 
+static void showMemUsage(void)
+{
+	st3_memusage_t m;
+	st3_memusage(song.shared, &m);
+
+	printf("Memory usage (bytes):\n");
+	printf("  Replayer/mixer:     %u\n", m.player);
+	printf("  Song struct:        %u\n", m.song);
+	printf("  Pattern data:       %u\n", m.patterns);
+	printf("  Sample data:        %u\n", m.samples);
+	printf("  Module data:        %u\n", m.filebuffer);
+	printf("  Total:              %u\n", m.player + m.song + m.patterns + m.samples + m.filebuffer);
+}
+
+static void showLoudness(const st3_loudness_t *l)
+{
+	printf("Loudness (EBU R128):\n");
+	printf("  Integrated:         %.1f LUFS\n", l->integrated);
+	printf("  Max. momentary:     %.1f LUFS\n", l->maxMomentary);
+	printf("  Max. short-term:    %.1f LUFS\n", l->maxShortTerm);
+	printf("  True peak:          %.1f dBTP\n", l->truePeak);
+	printf("  Sample peak:        %.1f dBFS\n", l->samplePeak);
+}
+
 static void handleArguments(int argc, char *argv[])
 {
 	filename = argv[1];
@@ -240,10 +309,37 @@ static void handleArguments(int argc, char *argv[])
 				const int32_t num = atoi(argv[i+1]);
 				mixingBufferSize = CLAMP(num, 256, 8192);
 			}
+			else if (!_stricmp(argv[i], "-a") && i+1 < argc)
+			{
+				const int32_t num = atoi(argv[i+1]);
+				adlibVolume = CLAMP(num, 0, 256);
+			}
+			else if (!_stricmp(argv[i], "-p") && i+1 < argc)
+			{
+				const int32_t num = atoi(argv[i+1]);
+				adlibPanning = CLAMP(num, -128, 128);
+			}
 			else if (!_stricmp(argv[i], "--render-to-wav"))
 			{
 				renderToWavFlag = true;
 			}
+			else if (!_stricmp(argv[i], "--render-stems"))
+			{
+				renderToWavFlag = true;
+				renderStemsFlag = true;
+			}
+			else if (!_stricmp(argv[i], "--loudness"))
+			{
+				loudnessFlag = true;
+			}
+			else if (!_stricmp(argv[i], "--adlib-thread"))
+			{
+				adlibThreadFlag = true;
+			}
+			else if (!_stricmp(argv[i], "--mem-usage"))
+			{
+				memUsageFlag = true;
+			}
 		}
 	}
 }
@@ -272,8 +368,21 @@ static void readKeyboard(void)
 				shutupsounds();
 				zgotosong((song.np_ord - 2) & 0xFF, 0);
 			break;
+
+			case '0': // 8bb: unmute all channels
+				setChannelMuteMask(0);
+			break;
 			
-			default: break;
+			default:
+			{
+				if (key >= '1' && key <= '9') // 8bb: toggle mute of song channel 1..9
+				{
+					const uint8_t ch = song.header.channel[key - '1'];
+					if (ch < 32)
+						muteChannel(ch, !(getChannelMuteMask() & (1UL << ch)));
+				}
+			}
+			break;
 		}
 	}
 }
@@ -311,7 +420,10 @@ static int32_t renderToWav(void)
 		return 1;
 	}
 
-	printf("Rendering to WAV. If stuck forever, press any key to stop rendering...\n");
+	if (renderStemsFlag)
+		printf("Rendering stems to WAV. If stuck forever, press any key to stop rendering...\n");
+	else
+		printf("Rendering to WAV. If stuck forever, press any key to stop rendering...\n");
 
 #ifndef _WIN32
 	modifyTerminal();
@@ -328,6 +440,10 @@ static int32_t renderToWav(void)
 
 	closeSingleThread();
 
+	st3_loudness_t l;
+	if (getLoudness(&l))
+		showLoudness(&l);
+
 	free(WAVRenderFilename);
 	closeMusic();
 
@@ -0,0 +1,144 @@
+/* 8bb: Cold cache benchmark (not a test, run with "make-tests.sh bench").
+** An audio callback usually runs after the rest of the program has pushed
+** the replayer state out of the CPU caches, so this evicts the L1/L2 caches
+** (by writing EVICT_SIZE bytes, make it bigger than the L2 cache) before
+** every musmixer() block, and only times musmixer(). The difference to the
+** warm timing is mostly the cost of the cache misses on the song/voice
+** state and the mixer tables.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 64 // 8bb: a short callback, so that the misses matter
+#define NUM_BLOCKS 1000
+#define RUNS 5
+#define EVICT_SIZE (8*1024*1024)
+
+typedef struct
+{
+	const char *title, *module;
+	int32_t card;
+} benchcase_t;
+
+static const benchcase_t cases[] =
+{
+	{ "SB 8ch",   "st_a", SOUNDCARD_SBPRO },
+	{ "SB 16ch",  "big",  SOUNDCARD_SBPRO },
+#ifndef ST3_NO_GUS
+	{ "GUS 8ch",  "st_a", SOUNDCARD_GUS },
+	{ "GUS 16ch", "big",  SOUNDCARD_GUS },
+#endif
+};
+
+static uint8_t *evictBuffer;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void evictCaches(void)
+{
+	static uint8_t value;
+
+	value++;
+	for (int32_t i = 0; i < EVICT_SIZE; i += 64) // 8bb: one write per cache line
+		evictBuffer[i] = value;
+}
+
+static double benchCase(const uint8_t *data, uint32_t length, int32_t card, bool cold) // 8bb: in microseconds per block
+{
+	int16_t buffer[RENDER_BLOCK * 2];
+
+	double best = -1.0;
+	for (int32_t i = 0; i < RUNS; i++)
+	{
+		if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+			return -1.0;
+
+		setTestMixingVolume(256);
+		if (!load_st3_from_ram(data, length, card))
+		{
+			closeMusic();
+			return -1.0;
+		}
+
+		zplaysong(0);
+
+		double time = 0.0;
+		for (int32_t j = 0; j < NUM_BLOCKS; j++)
+		{
+			if (cold)
+				evictCaches();
+
+			WAVRender_Flag = true;
+
+			const double start = now();
+			musmixer(buffer, RENDER_BLOCK);
+			time += now() - start;
+		}
+
+		closeMusic();
+
+		if (best < 0.0 || time < best)
+			best = time;
+	}
+
+	return (best * 1e6) / NUM_BLOCKS;
+}
+
+static const testmodule_t *findModule(const char *name)
+{
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		if (!strcmp(testModules[i].name, name))
+			return &testModules[i];
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	const int32_t numCases = sizeof (cases) / sizeof (cases[0]);
+
+	evictBuffer = (uint8_t *)calloc(EVICT_SIZE, 1);
+	if (evictBuffer == NULL)
+		return 1;
+
+	printf("us per %d-sample block (%d Hz, %d blocks, best of %d)\n%-8s", RENDER_BLOCK, RENDER_FREQ, NUM_BLOCKS, RUNS, "");
+	for (int32_t i = 0; i < numCases; i++)
+		printf("%10s", cases[i].title);
+	printf("\n");
+
+	for (int32_t cold = 0; cold <= 1; cold++)
+	{
+		printf("%-8s", cold ? "cold" : "warm");
+		for (int32_t i = 0; i < numCases; i++)
+		{
+			uint32_t length;
+			uint8_t *data = makeTestModule(findModule(cases[i].module), &length);
+			if (data == NULL)
+				return 1;
+
+			printf("%10.2f", benchCase(data, length, cases[i].card, cold != 0));
+			fflush(stdout);
+
+			free(data);
+		}
+		printf("\n");
+	}
+
+	free(evictBuffer);
+	return 0;
+}
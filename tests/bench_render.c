@@ -0,0 +1,128 @@
+/* 8bb: Render speed benchmark (not a test, run with "make-tests.sh bench").
+** Renders test modules with every interpolation quality, and prints how
+** many times faster than realtime that is (CPU time, the best of a few
+** runs, so that other processes disturb it less).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 1024
+#define RENDER_SECONDS 10
+#define RUNS 7
+
+typedef struct
+{
+	const char *title, *module;
+	int32_t card;
+} benchcase_t;
+
+static const benchcase_t cases[] =
+{
+	{ "SB stereo", "st_a",   SOUNDCARD_SBPRO },
+	{ "SB mono",   "mono_a", SOUNDCARD_SBPRO },
+	{ "SB+AdLib",  "adl_a",  SOUNDCARD_SBPRO },
+	{ "SB 16ch",   "big",    SOUNDCARD_SBPRO },
+#ifndef ST3_NO_GUS
+	{ "GUS",       "st_a",   SOUNDCARD_GUS },
+	{ "GUS 16ch",  "big",    SOUNDCARD_GUS },
+#endif
+};
+
+static const char *qualityNames[6] = { "zoh", "linear", "cubic", "sinc8", "sinc16", "sinc32" };
+
+static double cpuTime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static double benchCase(const uint8_t *data, uint32_t length, int32_t card, int32_t quality)
+{
+	double best = -1.0;
+	for (int32_t i = 0; i < RUNS; i++)
+	{
+		if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+			return -1.0;
+
+		setTestMixingVolume(256);
+		if (!load_st3_from_ram(data, length, card))
+		{
+			closeMusic();
+			return -1.0;
+		}
+
+		setInterpolationQuality(quality);
+		zplaysong(0);
+
+		const double start = cpuTime();
+		renderHash(RENDER_SECONDS, RENDER_BLOCK, NULL);
+		const double time = cpuTime() - start;
+
+		closeMusic();
+
+		if (best < 0.0 || time < best)
+			best = time;
+	}
+
+	return RENDER_SECONDS / best;
+}
+
+static const testmodule_t *findModule(const char *name)
+{
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		if (!strcmp(testModules[i].name, name))
+			return &testModules[i];
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const int32_t numCases = sizeof (cases) / sizeof (cases[0]);
+
+	// 8bb: "bench_render quality" only benchmarks that quality (0..5, see INTRP_*)
+	const int32_t onlyQuality = (argc > 1) ? atoi(argv[1]) : -1;
+
+	printf("x realtime (%d Hz, %ds, CPU time, best of %d)\n%-8s", RENDER_FREQ, RENDER_SECONDS, RUNS, "");
+	for (int32_t i = 0; i < numCases; i++)
+		printf("%11s", cases[i].title);
+	printf("\n");
+
+	for (int32_t quality = INTRP_ZOH; quality <= INTRP_SINC32; quality++)
+	{
+#ifdef ST3_NO_EXTRA_INTRP
+		if (quality == INTRP_CUBIC || quality == INTRP_SINC8 || quality == INTRP_SINC32)
+			continue;
+#endif
+		if (onlyQuality >= 0 && quality != onlyQuality)
+			continue;
+
+		printf("%-8s", qualityNames[quality]);
+		for (int32_t i = 0; i < numCases; i++)
+		{
+			uint32_t length;
+			uint8_t *data = makeTestModule(findModule(cases[i].module), &length);
+			if (data == NULL)
+				return 1;
+
+			printf("%11.1f", benchCase(data, length, cases[i].card, quality));
+			fflush(stdout);
+
+			free(data);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Builds and runs the tests (Linux/macOS), run it from the tests folder.
+# "./make-tests.sh asan" builds with AddressSanitizer/UBSan instead.
+# "./make-tests.sh tsan" only runs the tests that use threads, with ThreadSanitizer (slow).
+# "./make-tests.sh bench" only builds and runs the benchmarks.
+
+CC=${CC:-gcc}
+SRC="../*.c ../mixer/*.c ../opl2/*.c ../audiodrivers/null/*.c testutil.c"
+FLAGS="-DNDEBUG -DAUDIODRIVER_NULL -O2 -ffp-contract=off -Wall -Wextra -Wshadow -Wno-unused-result -Wno-missing-field-initializers"
+LIBS="-lm -lpthread"
+
+if [ "$1" == "asan" ]; then
+	FLAGS="$FLAGS -g -fsanitize=address,undefined"
+elif [ "$1" == "tsan" ]; then
+	FLAGS="$FLAGS -g -fsanitize=thread"
+fi
+
+mkdir -p bin
+failed=0
+
+# build <name> <output> [flags]
+build() {
+	if ! $CC $FLAGS "${@:3}" $SRC $1.c $LIBS -o bin/$2; then
+		echo "$2: BUILD FAILED"
+		failed=1
+		return 1
+	fi
+	return 0
+}
+
+# test <name> [args]
+test() {
+	if ! bin/$1 "${@:2}"; then
+		failed=1
+	fi
+}
+
+if [ "$1" == "bench" ]; then
+	build bench_render bench_render && bin/bench_render || exit 1
+	build bench_cache bench_cache && bin/bench_cache
+	exit $?
+fi
+
+if [ "$1" == "tsan" ]; then
+	echo Compiling and running the threaded tests with ThreadSanitizer, please wait...
+	build test_render test_render && test test_render # AdLib thread
+	build test_taps test_taps && test test_taps # scope reader thread
+	build test_stems test_stems && test test_stems # AdLib stems thread
+	[ $failed -eq 0 ] && echo All tests passed. || echo Some tests FAILED.
+	exit $failed
+fi
+
+echo Compiling and running the tests, please wait...
+
+build test_render test_render && test test_render
+build test_render test_render_small -DST3_SMALLFOOTPRINT && test test_render_small
+build test_render test_render_fixed -DST3_FIXEDPOINT && test test_render_fixed
+build test_probe test_probe && test test_probe
+build test_taps test_taps && test test_taps
+build test_stems test_stems && test test_stems
+build test_stems test_stems_small -DST3_SMALLFOOTPRINT && test test_stems_small
+build test_stems test_stems_fixed -DST3_FIXEDPOINT && test test_stems_fixed
+build test_mute test_mute && test test_mute
+build test_loudness test_loudness && test test_loudness
+
+# the float build writes its output for the fixed-point build to compare with
+if build test_fixedpoint fixedpoint_ref && build test_fixedpoint test_fixedpoint -DST3_FIXEDPOINT; then
+	if ! bin/fixedpoint_ref | bin/test_fixedpoint; then
+		failed=1
+	fi
+fi
+
+if [ $failed -ne 0 ]; then
+	echo Some tests FAILED.
+	exit 1
+fi
+
+echo All tests passed.
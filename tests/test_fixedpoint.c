@@ -0,0 +1,114 @@
+/* 8bb: ST3_FIXEDPOINT test. This file is built twice: the float build
+** writes the raw output of the test modules to stdout, and the fixed-point
+** build renders the same and reads that from stdin, and the signal-to-noise
+** ratio of its output against the float output has to be at least MIN_SNR.
+** See make-tests.sh:
+**
+** bin/fixedpoint_ref | bin/test_fixedpoint
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_SECONDS 5
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 1024
+#define MIN_SNR 60.0 // 8bb: in dB, the test modules give 66..71
+
+static const int32_t cards[2] = { SOUNDCARD_SBPRO, SOUNDCARD_GUS };
+
+static bool renderModule(const uint8_t *data, uint32_t length, int32_t card, int16_t *out)
+{
+	if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+		return false;
+
+	setTestMixingVolume(256);
+	if (!load_st3_from_ram(data, length, card))
+	{
+		closeMusic();
+		return false;
+	}
+
+	zplaysong(0);
+	renderHash(RENDER_SECONDS, RENDER_BLOCK, out);
+	closeMusic();
+
+	return true;
+}
+
+int main(void)
+{
+	const int32_t samples = RENDER_FREQ * RENDER_SECONDS * 2;
+
+	int16_t *output = (int16_t *)calloc(samples, sizeof (int16_t));
+#ifdef ST3_FIXEDPOINT
+	int16_t *reference = (int16_t *)malloc(samples * sizeof (int16_t));
+	if (output == NULL || reference == NULL)
+#else
+	if (output == NULL)
+#endif
+	{
+		printf("out of memory\n");
+		return 1;
+	}
+
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		if (data == NULL)
+			return 1;
+
+		for (int32_t j = 0; j < 2; j++)
+		{
+#ifdef ST3_NO_GUS
+			if (cards[j] == SOUNDCARD_GUS)
+				continue;
+#endif
+			const bool rendered = renderModule(data, length, cards[j], output);
+
+#ifdef ST3_FIXEDPOINT
+			CHECK(rendered, "%s card %d: couldn't load", m->name, cards[j]);
+
+			if (fread(reference, sizeof (int16_t), samples, stdin) != (size_t)samples)
+			{
+				CHECK(false, "the float output (stdin) is too short");
+				return testResult("test_fixedpoint");
+			}
+
+			double signal = 0.0, noise = 0.0;
+			for (int32_t k = 0; k < samples; k++)
+			{
+				const double diff = (double)output[k] - reference[k];
+				signal += (double)reference[k] * reference[k];
+				noise += diff * diff;
+			}
+
+			const double snr = (noise > 0.0) ? (10.0 * log10(signal / noise)) : HUGE_VAL;
+			CHECK(signal > 0.0 && snr >= MIN_SNR, "%s card %d: SNR %.1f dB", m->name, cards[j], snr);
+#else
+			if (!rendered)
+				memset(output, 0, samples * sizeof (int16_t)); // 8bb: test_fixedpoint fails on silence
+			fwrite(output, sizeof (int16_t), samples, stdout);
+#endif
+		}
+
+		free(data);
+	}
+
+	free(output);
+#ifdef ST3_FIXEDPOINT
+	free(reference);
+	return testResult("test_fixedpoint");
+#else
+	return 0;
+#endif
+}
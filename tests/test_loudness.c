@@ -0,0 +1,206 @@
+/* 8bb: Loudness analysis test. The analyzer (mixer/loudness.c) gets signals
+** with a known loudness/peak (the EBU Tech 3341 sine tests, the gating and
+** a true peak between the samples), and on the player output the sample
+** peak has to match the rendered samples, the true peak can't be lower,
+** and halving the mixing volume has to lower everything by 6 dB.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../dig.h"
+#include "../mixer/loudness.h"
+#include "testutil.h"
+
+#ifndef PI
+#define PI 3.14159265358979323846264338327950288
+#endif
+
+#define TEST_FREQ 48000
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 1024
+#define RENDER_SECONDS 10
+#define LUFS_TOLERANCE 0.1 // 8bb: as in EBU Tech 3341
+#define PEAK_TOLERANCE 0.05 // 8bb: in dB, for the sample peak (rounding/dithering of the output)
+
+static const char *moduleNames[2] = { "st_a", "adl_a" };
+static const int32_t cards[2] = { SOUNDCARD_SBPRO, SOUNDCARD_GUS };
+
+// 8bb: analyzes seconds of a sine (level in dBFS, left/right on or off), at the phase where the last one stopped
+static void analyzeSine(double seconds, double frequency, double phase, double level, bool left, bool right)
+{
+	mixsmp_t bufL[1024], bufR[1024];
+	const double amplitude = (level == -HUGE_VAL) ? 0.0 : pow(10.0, level / 20.0);
+
+	static uint32_t pos;
+	int32_t samples = (int32_t)(seconds * TEST_FREQ);
+	while (samples > 0)
+	{
+		const int32_t n = (samples > 1024) ? 1024 : samples;
+		for (int32_t i = 0; i < n; i++, pos++)
+		{
+			const double x = amplitude * sin((2.0 * PI * frequency * pos / TEST_FREQ) + phase);
+#ifdef ST3_FIXEDPOINT
+			const mixsmp_t smp = (mixsmp_t)floor((x * 32768.0) + 0.5);
+#else
+			const mixsmp_t smp = (mixsmp_t)x;
+#endif
+			bufL[i] = left ? smp : 0;
+			bufR[i] = right ? smp : 0;
+		}
+
+#ifdef ST3_FIXEDPOINT
+		Loudness_Process(bufL, bufR, n, 1.0f / 32768.0f);
+#else
+		Loudness_Process(bufL, bufR, n, 1.0f);
+#endif
+		samples -= n;
+	}
+}
+
+static void testAnalyzer(void)
+{
+	st3_loudness_t info;
+
+	// 8bb: silence
+	CHECK(Loudness_Init(TEST_FREQ), "Loudness_Init() failed");
+	analyzeSine(5.0, 1000.0, 0.0, -HUGE_VAL, true, true);
+	Loudness_Get(&info);
+	CHECK(info.integrated == -HUGE_VAL && info.samplePeak == -HUGE_VAL, "silence: %.2f LUFS, %.2f dBFS", info.integrated, info.samplePeak);
+	CHECK(info.samples == 5*TEST_FREQ, "silence: %d samples analyzed", (int32_t)info.samples);
+
+	// 8bb: EBU Tech 3341 test 1, 1 kHz at -23 dBFS (stereo) is -23 LUFS
+	Loudness_Init(TEST_FREQ);
+	analyzeSine(20.0, 1000.0, 0.0, -23.0, true, true);
+	Loudness_Get(&info);
+	CHECK(fabs(info.integrated + 23.0) <= LUFS_TOLERANCE, "1 kHz at -23 dBFS: integrated %.2f LUFS", info.integrated);
+	CHECK(fabs(info.momentary + 23.0) <= LUFS_TOLERANCE, "1 kHz at -23 dBFS: momentary %.2f LUFS", info.momentary);
+	CHECK(fabs(info.shortTerm + 23.0) <= LUFS_TOLERANCE, "1 kHz at -23 dBFS: short-term %.2f LUFS", info.shortTerm);
+	CHECK(fabs(info.samplePeak + 23.0) <= PEAK_TOLERANCE, "1 kHz at -23 dBFS: sample peak %.2f dBFS", info.samplePeak);
+	CHECK(fabs(info.truePeak + 23.0) <= PEAK_TOLERANCE, "1 kHz at -23 dBFS: true peak %.2f dBTP", info.truePeak);
+
+	// 8bb: one channel is 3 dB less
+	Loudness_Init(TEST_FREQ);
+	analyzeSine(10.0, 1000.0, 0.0, -20.0, true, false);
+	Loudness_Get(&info);
+	CHECK(fabs(info.integrated + 23.01) <= LUFS_TOLERANCE, "1 kHz at -20 dBFS (left): integrated %.2f LUFS", info.integrated);
+
+	// 8bb: EBU Tech 3341 test 4, the quiet parts are gated (absolute gate for -72, relative gate for -36)
+	Loudness_Init(TEST_FREQ);
+	analyzeSine(10.0, 1000.0, 0.0, -72.0, true, true);
+	analyzeSine(10.0, 1000.0, 0.0, -36.0, true, true);
+	analyzeSine(60.0, 1000.0, 0.0, -23.0, true, true);
+	analyzeSine(10.0, 1000.0, 0.0, -36.0, true, true);
+	analyzeSine(10.0, 1000.0, 0.0, -72.0, true, true);
+	Loudness_Get(&info);
+	CHECK(fabs(info.integrated + 23.0) <= LUFS_TOLERANCE, "gating: integrated %.2f LUFS", info.integrated);
+	CHECK(fabs(info.maxShortTerm + 23.0) <= LUFS_TOLERANCE, "gating: max. short-term %.2f LUFS", info.maxShortTerm);
+	CHECK(info.momentary < -60.0, "gating: momentary %.2f LUFS at the end", info.momentary);
+
+	// 8bb: fs/4 with a 45 degree phase, the samples are 3 dB below the peaks between them
+	Loudness_Init(TEST_FREQ);
+	analyzeSine(1.0, TEST_FREQ / 4.0, PI / 4.0, -6.0, true, true);
+	Loudness_Get(&info);
+	CHECK(fabs(info.samplePeak + 9.01) <= PEAK_TOLERANCE, "fs/4: sample peak %.2f dBFS", info.samplePeak);
+	CHECK(fabs(info.truePeak + 6.0) <= 0.5, "fs/4: true peak %.2f dBTP", info.truePeak);
+
+	Loudness_Free();
+}
+
+static bool renderModule(const uint8_t *data, uint32_t length, int32_t card, int32_t mixingVolume, int16_t *out, st3_loudness_t *info)
+{
+	if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+		return false;
+
+	setTestMixingVolume(mixingVolume);
+	if (!load_st3_from_ram(data, length, card) || !setLoudnessAnalysis(true))
+	{
+		closeMusic();
+		return false;
+	}
+
+	zplaysong(0);
+	renderHash(RENDER_SECONDS, RENDER_BLOCK, out);
+
+	const bool on = getLoudness(info);
+	closeMusic();
+
+	return on;
+}
+
+static void testPlayer(const testmodule_t *m, const uint8_t *data, uint32_t length, int32_t card, int16_t *out)
+{
+	const int32_t numSamples = RENDER_FREQ * RENDER_SECONDS * 2;
+	st3_loudness_t info, half;
+
+	CHECK(renderModule(data, length, card, 256, out, &info), "%s card %d: couldn't render", m->name, card);
+
+	int32_t peak = 0;
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		if (abs(out[i]) > peak)
+			peak = abs(out[i]);
+	}
+
+	CHECK(info.samples == (uint64_t)RENDER_FREQ * RENDER_SECONDS, "%s card %d: %d samples analyzed", m->name, card, (int32_t)info.samples);
+
+	// 8bb: the analysis is before the clipping of the output
+	const double outputPeak = 20.0 * log10(peak / 32768.0);
+	if (peak < 32767)
+		CHECK(fabs(info.samplePeak - outputPeak) <= PEAK_TOLERANCE, "%s card %d: sample peak %.2f dBFS, the output %.2f dBFS", m->name, card, info.samplePeak, outputPeak);
+	else
+		CHECK(info.samplePeak >= -PEAK_TOLERANCE, "%s card %d: sample peak %.2f dBFS, but the output clips", m->name, card, info.samplePeak);
+
+	CHECK(info.truePeak >= info.samplePeak, "%s card %d: true peak %.2f < sample peak %.2f", m->name, card, info.truePeak, info.samplePeak);
+	CHECK(info.integrated > -40.0 && info.integrated <= info.maxMomentary, "%s card %d: integrated %.2f LUFS (max. momentary %.2f)", m->name, card, info.integrated, info.maxMomentary);
+	CHECK(info.momentary <= info.maxMomentary && info.shortTerm <= info.maxShortTerm, "%s card %d: momentary/short-term above the max.", m->name, card);
+
+	// 8bb: the mixing volume is applied
+	CHECK(renderModule(data, length, card, 128, out, &half), "%s card %d: couldn't render", m->name, card);
+
+	const double gain = 20.0 * log10(0.5);
+	CHECK(fabs((half.integrated - info.integrated) - gain) <= 0.05, "%s card %d: half the mixing volume, %.2f LU lower", m->name, card, info.integrated - half.integrated);
+	CHECK(fabs((half.samplePeak - info.samplePeak) - gain) <= 0.05, "%s card %d: half the mixing volume, %.2f dB lower sample peak", m->name, card, info.samplePeak - half.samplePeak);
+}
+
+int main(void)
+{
+	testAnalyzer();
+
+	int16_t *out = (int16_t *)malloc(RENDER_FREQ * RENDER_SECONDS * 2 * sizeof (int16_t));
+	if (out == NULL)
+	{
+		printf("out of memory\n");
+		return 1;
+	}
+
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+		if (strcmp(m->name, moduleNames[0]) != 0 && strcmp(m->name, moduleNames[1]) != 0)
+			continue;
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		CHECK(data != NULL, "%s: out of memory", m->name);
+		if (data == NULL)
+			continue;
+
+		for (int32_t j = 0; j < 2; j++)
+		{
+#ifdef ST3_NO_GUS
+			if (cards[j] == SOUNDCARD_GUS)
+				continue;
+#endif
+			testPlayer(m, data, length, cards[j], out);
+		}
+
+		free(data);
+	}
+
+	free(out);
+	return testResult("test_loudness");
+}
@@ -0,0 +1,220 @@
+/* 8bb: Channel mute test. Muting every channel has to give silence, muting
+** a channel has to remove just that channel (the soloed channel and the
+** rest add up to the normal output, where that doesn't clip), and a muted
+** channel has to keep playing silently, so that after unmuting it the
+** output is the same as if it had never been muted. That takes a few
+** frames (the resampler history), and up to ADLIB_SETTLE frames for AdLib
+** channels, as the DC filter of the OPL2 output has to settle.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 1024
+#define RENDER_SECONDS 4
+#define TOTAL_FRAMES (RENDER_FREQ * RENDER_SECONDS)
+#define UNMUTE_FRAME (RENDER_BLOCK * 94) // 8bb: ~2 seconds, between two musmixer() calls
+#define UNMUTE_SETTLE 64 // 8bb: in frames, more than the sinc32 kernel
+#define ADLIB_SETTLE RENDER_FREQ
+#define ADLIB_MAX_ERROR 64 // 8bb: the DC filter difference while it settles
+#define ALL_CHANNELS 0x1FFFFFF
+#define CLIP_LEVEL 32000
+#define CLIP_WINDOW 32 // 8bb: in frames, see test_stems.c
+#define SB_MAX_SPREAD 512 // 8bb: two 8-bit steps, see test_stems.c
+#define GUS_MAX_ERROR 3 // 8bb: the dithering of the three outputs
+#define MAX_SILENCE 2 // 8bb: peak to peak, the dithering (after UNMUTE_SETTLE frames, SB Pro has a DC offset)
+
+static const char *moduleNames[2] = { "mono_a", "adl_a" };
+static const int32_t cards[2] = { SOUNDCARD_SBPRO, SOUNDCARD_GUS };
+
+static bool usedChannel(const testmodule_t *m, int32_t channel) // 8bb: see the channel settings in makeTestModule()
+{
+	if (channel >= 16)
+		return m->adlib && channel < 16+4;
+
+	const int32_t c = ((channel & 8) ? 1 : 0) + ((channel & 7) * 2);
+	return c < m->channels;
+}
+
+// 8bb: renders with the channels in muteMask muted, and unmutes them at unmuteFrame (if not -1)
+static bool renderMuted(const uint8_t *data, uint32_t length, int32_t card, uint32_t muteMask, int32_t unmuteFrame, int16_t *out)
+{
+	if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+		return false;
+
+	setTestMixingVolume(256);
+	if (!load_st3_from_ram(data, length, card))
+	{
+		closeMusic();
+		return false;
+	}
+
+	zplaysong(0);
+	setChannelMuteMask(muteMask);
+
+	for (int32_t n = 0; n < TOTAL_FRAMES; n += RENDER_BLOCK)
+	{
+		if (n == unmuteFrame)
+			setChannelMuteMask(0);
+
+		const int32_t frames = (TOTAL_FRAMES-n < RENDER_BLOCK) ? (TOTAL_FRAMES-n) : RENDER_BLOCK;
+
+		WAVRender_Flag = true;
+		musmixer(&out[n*2], frames);
+	}
+
+	setChannelMuteMask(0);
+	closeMusic();
+
+	return true;
+}
+
+static int32_t peakToPeak(const int16_t *buffer, int32_t numSamples)
+{
+	int16_t minSample = INT16_MAX, maxSample = INT16_MIN;
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		if (buffer[i] < minSample) minSample = buffer[i];
+		if (buffer[i] > maxSample) maxSample = buffer[i];
+	}
+
+	return (numSamples > 0) ? (maxSample - minSample) : 0;
+}
+
+static bool nearClipping(const int16_t *buffer, int32_t i, int32_t clipLevel)
+{
+	const int32_t start = (i > CLIP_WINDOW*2) ? (i - CLIP_WINDOW*2) : 0;
+	const int32_t end = (TOTAL_FRAMES*2-i > CLIP_WINDOW*2) ? (i + CLIP_WINDOW*2) : TOTAL_FRAMES*2;
+
+	for (int32_t j = start; j < end; j++)
+	{
+		if (buffer[j] < -clipLevel || buffer[j] > clipLevel)
+			return true;
+	}
+
+	return false;
+}
+
+static void testMute(const testmodule_t *m, const uint8_t *data, uint32_t length, int32_t card, int16_t **buffers)
+{
+	int16_t *full = buffers[0], *solo = buffers[1], *muted = buffers[2], *unmuted = buffers[3];
+	const int32_t numSamples = TOTAL_FRAMES * 2;
+	const int32_t silenceStart = UNMUTE_SETTLE * 2;
+
+	// 8bb: the PCM voices are clipped before they're lowered to 2/3 for the AdLib output (opl2.c)
+	const int32_t clipLevel = m->adlib ? ((CLIP_LEVEL * 2) / 3) : CLIP_LEVEL;
+
+	CHECK(renderMuted(data, length, card, 0, -1, full), "%s card %d: couldn't load", m->name, card);
+	CHECK(peakToPeak(full, numSamples) > 1000, "%s card %d: no output", m->name, card);
+
+	CHECK(renderMuted(data, length, card, ALL_CHANNELS, -1, muted), "%s card %d: couldn't load", m->name, card);
+	const int32_t silenceLevel = peakToPeak(&muted[silenceStart], numSamples-silenceStart);
+	CHECK(silenceLevel <= MAX_SILENCE, "%s card %d: all channels muted, but %d peak to peak", m->name, card, silenceLevel);
+
+	for (int32_t c = 0; c < 25; c++)
+	{
+#ifdef ST3_NO_ADLIB
+		if (c >= 16)
+			break;
+#endif
+		const uint32_t channelBit = 1UL << c;
+
+		CHECK(renderMuted(data, length, card, ALL_CHANNELS & ~channelBit, -1, solo), "%s card %d: couldn't load", m->name, card);
+		if (!usedChannel(m, c))
+		{
+			const int32_t soloLevel = peakToPeak(&solo[silenceStart], numSamples-silenceStart);
+			CHECK(soloLevel <= MAX_SILENCE, "%s card %d: unused channel %d soloed, but %d peak to peak", m->name, card, c, soloLevel);
+			continue;
+		}
+
+		// 8bb: soloed + muted = normal output
+		CHECK(renderMuted(data, length, card, channelBit, -1, muted), "%s card %d: couldn't load", m->name, card);
+
+		int32_t minDiff = INT32_MAX, maxDiff = INT32_MIN;
+		for (int32_t i = 0; i < numSamples; i++)
+		{
+			const int32_t diff = (solo[i] + muted[i]) - full[i];
+			if ((diff < minDiff || diff > maxDiff) && !nearClipping(full, i, clipLevel) && !nearClipping(muted, i, clipLevel))
+			{
+				if (diff < minDiff) minDiff = diff;
+				if (diff > maxDiff) maxDiff = diff;
+			}
+		}
+
+		if (card == SOUNDCARD_SBPRO)
+			CHECK(maxDiff-minDiff <= SB_MAX_SPREAD, "%s card %d channel %d: soloed + muted - normal = %d..%d", m->name, card, c, minDiff, maxDiff);
+		else
+			CHECK(minDiff >= -GUS_MAX_ERROR && maxDiff <= GUS_MAX_ERROR, "%s card %d channel %d: soloed + muted - normal = %d..%d", m->name, card, c, minDiff, maxDiff);
+
+		// 8bb: unmuted while playing, the same as never muted (and as muted before that)
+		CHECK(renderMuted(data, length, card, channelBit, UNMUTE_FRAME, unmuted), "%s card %d: couldn't load", m->name, card);
+		CHECK(!memcmp(unmuted, muted, UNMUTE_FRAME * 2 * sizeof (int16_t)), "%s card %d channel %d: differs before unmuting", m->name, card, c);
+
+		const int32_t settle = (c >= 16) ? ADLIB_SETTLE : UNMUTE_SETTLE;
+
+		int32_t lastDiffer = -1, maxError = 0;
+		for (int32_t i = UNMUTE_FRAME*2; i < numSamples; i++)
+		{
+			const int32_t frame = (i / 2) - UNMUTE_FRAME;
+			const int32_t error = abs(unmuted[i] - full[i]);
+
+			if (error > 0)
+				lastDiffer = frame;
+
+			if (frame >= UNMUTE_SETTLE && error > maxError)
+				maxError = error;
+		}
+
+		CHECK(lastDiffer < settle, "%s card %d channel %d: differs %d frames after unmuting", m->name, card, c, lastDiffer);
+		CHECK(maxError <= ADLIB_MAX_ERROR, "%s card %d channel %d: differs by %d after unmuting", m->name, card, c, maxError);
+	}
+}
+
+int main(void)
+{
+	int16_t *buffers[4];
+	for (int32_t i = 0; i < 4; i++)
+	{
+		buffers[i] = (int16_t *)malloc(TOTAL_FRAMES * 2 * sizeof (int16_t));
+		if (buffers[i] == NULL)
+		{
+			printf("out of memory\n");
+			return 1;
+		}
+	}
+
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+		if (strcmp(m->name, moduleNames[0]) != 0 && strcmp(m->name, moduleNames[1]) != 0)
+			continue;
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		CHECK(data != NULL, "%s: out of memory", m->name);
+		if (data == NULL)
+			continue;
+
+		for (int32_t j = 0; j < 2; j++)
+		{
+#ifdef ST3_NO_GUS
+			if (cards[j] == SOUNDCARD_GUS)
+				continue;
+#endif
+			testMute(m, data, length, cards[j], buffers);
+		}
+
+		free(data);
+	}
+
+	for (int32_t i = 0; i < 4; i++)
+		free(buffers[i]);
+
+	return testResult("test_mute");
+}
@@ -0,0 +1,88 @@
+/* 8bb: st3_probe() test. The metadata has to be the same as what the loader
+** gives, the duration has to match a render of songs that end (within one
+** tick), and truncated module data must not crash the probe.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 64
+#define MAX_SECONDS 600
+#define MAX_TICK_TIME (2.5 / 32) // 8bb: at the lowest tempo
+
+static double renderDuration(void) // 8bb: until the song ends (or MAX_SECONDS)
+{
+	int16_t buffer[RENDER_BLOCK * 2];
+
+	int64_t frames = 0;
+	WAVRender_Flag = true;
+	while (WAVRender_Flag && frames < (int64_t)RENDER_FREQ * MAX_SECONDS)
+	{
+		musmixer(buffer, RENDER_BLOCK);
+		frames += RENDER_BLOCK;
+	}
+
+	return WAVRender_Flag ? -1.0 : (double)frames / RENDER_FREQ;
+}
+
+int main(void)
+{
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		if (data == NULL)
+			continue;
+
+		st3_probe_t info;
+		CHECK(st3_probe_from_ram(data, length, &info), "%s: probe failed", m->name);
+
+		CHECK(initMusic(RENDER_FREQ, RENDER_BLOCK), "initMusic() failed");
+		setTestMixingVolume(256);
+		CHECK(load_st3_from_ram(data, length, -1), "%s: load failed", m->name);
+
+		CHECK(!memcmp(&info.header, &song.header, sizeof (ds_fileheader)), "%s: header differs from the loader's", m->name);
+		CHECK(info.soundcardtype == audio.soundcardtype, "%s: sound card %d, loader %d", m->name, info.soundcardtype, audio.soundcardtype);
+		CHECK(info.numsamples == 6, "%s: %d samples", m->name, info.numsamples);
+		CHECK(info.numadlibins == (m->adlib ? 3 : 0), "%s: %d AdLib instruments", m->name, info.numadlibins);
+
+		zplaysong(0);
+		const double dRendered = renderDuration();
+
+		// 8bb: the replayer sets song.adlibused when it handles an AdLib channel
+		CHECK(info.adlibused == song.adlibused, "%s: adlibused %d, replayer %d", m->name, info.adlibused, song.adlibused);
+
+		if (dRendered >= 0.0) // 8bb: the song loops otherwise, and the probe gives the time until the loop
+		{
+			CHECK(fabs(dRendered - info.dDuration) < MAX_TICK_TIME,
+				"%s: probed %.3fs, rendered %.3fs", m->name, info.dDuration, dRendered);
+		}
+
+		closeMusic();
+
+		// 8bb: truncated data, the probe may fail but must not read outside of it (run with ASan)
+		for (uint32_t cut = 0; cut < length; cut += 97)
+		{
+			uint8_t *truncated = (uint8_t *)malloc(cut + 1);
+			if (truncated == NULL)
+				break;
+
+			memcpy(truncated, data, cut);
+			st3_probe_from_ram(truncated, cut, &info);
+			free(truncated);
+		}
+
+		free(data);
+	}
+
+	return testResult("test_probe");
+}
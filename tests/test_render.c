@@ -0,0 +1,166 @@
+/* 8bb: Render regression test. Renders the test modules in SB Pro and GUS
+** mode at two output rates/buffer sizes, and compares the hash of the
+** output against reference hashes made with the original replayer (the
+** first commit of this repo, float build), so that the optimizations have
+** to stay bit-exact. The same songs are also played through the shared-song
+** loader with lazy samples and in-place patterns, and with the AdLib helper
+** thread, which have to give the exact same output.
+**
+** "test_render --print" prints the hashes of this build in the format of
+** refHashes[] below.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_SECONDS 20
+
+typedef struct
+{
+	int32_t card, freq, bufferSize;
+} renderconfig_t;
+
+static const renderconfig_t configs[4] =
+{
+	{ SOUNDCARD_SBPRO, 48000, 1024 },
+	{ SOUNDCARD_SBPRO, 44100, 777 },
+	{ SOUNDCARD_GUS,   48000, 1024 },
+	{ SOUNDCARD_GUS,   44100, 777 }
+};
+
+// 8bb: [testModules[]][configs[]]
+static const uint64_t refHashes[][4] =
+{
+	{ 0x79fa55fedab428faULL, 0xdead09acbb4fad3dULL, 0xea0e59c586af0570ULL, 0x148f68f2c619833dULL }, // st_a
+	{ 0x3f2afe1ccc331af4ULL, 0x660e05c3556d0c0fULL, 0xf29182b15c73821dULL, 0x9d3b79606324d30dULL }, // st_b
+	{ 0x7e5e90916c66b9c1ULL, 0x87bf92525617dde4ULL, 0x1218627935f15154ULL, 0xe48454d1d1e965fdULL }, // mono_a
+	{ 0x09e1cba116a6290fULL, 0x8f2d8e20a9c24f4aULL, 0x879add13b185c1b3ULL, 0x77fbc153014f38e4ULL }, // mono_b
+	{ 0xd3168c3ad166ef3eULL, 0x68a20c96a9351e8eULL, 0x86ee2ea275ee7e51ULL, 0x7d443b6b00de8accULL }, // adl_a
+	{ 0x007af5ac08eb6d67ULL, 0x98de6ba67d79d909ULL, 0x9afe0e3f2eb2bf12ULL, 0x93ea78919c34adaaULL }, // adl_b
+	{ 0x757a851c4972afe3ULL, 0xaee9342716317db1ULL, 0x334b09657d923635ULL, 0xbf432f08befc5ce9ULL }, // big
+	{ 0xf80805fa845de39aULL, 0xedb83ae317adb57eULL, 0xa09986671dcc28a0ULL, 0xa4ac87f86e17567cULL }, // uc24
+	{ 0x84e6d6ddfd7027d0ULL, 0x84670893ce898eebULL, 0xe67f2b1a6ccf08c8ULL, 0x248390b5c4489dedULL }, // uc32
+	{ 0x0a6db123cb293c7aULL, 0xd6406bdacd6bef99ULL, 0x48a44b829b827129ULL, 0x6a520acda6ed87acULL }, // ffv1
+	{ 0xe30a32beec877fa9ULL, 0x61c1152722812a6aULL, 0x08234a5a1d357df9ULL, 0x05f804a20405e3ffULL }, // old
+};
+
+static bool configSupported(const renderconfig_t *c)
+{
+#ifdef ST3_NO_GUS
+	if (c->card == SOUNDCARD_GUS)
+		return false;
+#else
+	(void)c;
+#endif
+	return true;
+}
+
+static uint64_t renderModule(const uint8_t *data, uint32_t length, const renderconfig_t *c, int32_t loadFlags, bool adlibThread)
+{
+	if (!initMusic(c->freq, c->bufferSize))
+		return 0;
+
+	setTestMixingVolume(256);
+
+	bool loaded;
+	if (loadFlags < 0)
+	{
+		loaded = load_st3_from_ram(data, length, c->card);
+	}
+	else
+	{
+		st3_song_t *s = st3_loadsong_from_ram(data, length, loadFlags);
+		loaded = (s != NULL) && st3_attachsong(s, c->card);
+		st3_releasesong(s);
+	}
+
+	if (!loaded)
+	{
+		closeMusic();
+		return 0;
+	}
+
+	if (adlibThread && !setAdLibThread(true))
+	{
+		closeMusic();
+		return 0;
+	}
+
+	zplaysong(0);
+	const uint64_t hash = renderHash(RENDER_SECONDS, c->bufferSize, NULL);
+
+	closeMusic();
+	return hash;
+}
+
+int main(int argc, char *argv[])
+{
+	const bool printHashes = (argc > 1 && !strcmp(argv[1], "--print"));
+
+#if defined ST3_FIXEDPOINT || defined ST3_SMALLFOOTPRINT || defined ST3_NO_GUS || defined ST3_NO_ADLIB || defined ST3_NO_EXTRA_INTRP
+	const bool checkReference = false; // 8bb: the reference hashes are for the default float build
+	printf("test_render: not the default build, only checking the loaders/threads against each other\n");
+#else
+	const bool checkReference = (sizeof (refHashes) / sizeof (refHashes[0])) == (size_t)numTestModules;
+#endif
+
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		CHECK(data != NULL, "%s: out of memory", m->name);
+		if (data == NULL)
+			continue;
+
+		uint64_t hashes[4] = { 0, 0, 0, 0 };
+		for (int32_t j = 0; j < 4; j++)
+		{
+			const renderconfig_t *c = &configs[j];
+			if (!configSupported(c))
+				continue;
+
+			const uint64_t hash = renderModule(data, length, c, -1, false);
+			CHECK(hash != 0, "%s config %d: couldn't load/render", m->name, j);
+			hashes[j] = hash;
+
+			if (printHashes)
+				continue;
+
+			if (checkReference)
+				CHECK(hash == refHashes[i][j], "%s config %d: output differs from the reference", m->name, j);
+
+			static const int32_t loadFlags[3] = { ST3_LOAD_LAZYSAMPLES, ST3_LOAD_INPLACEPATTERNS, ST3_LOAD_LAZYSAMPLES|ST3_LOAD_INPLACEPATTERNS };
+			for (int32_t k = 0; k < 3; k++)
+			{
+				CHECK(renderModule(data, length, c, loadFlags[k], false) == hash,
+					"%s config %d: st3_loadsong_from_ram() with flags %d differs from load_st3_from_ram()", m->name, j, loadFlags[k]);
+			}
+
+#ifndef ST3_NO_ADLIB
+			if (m->adlib)
+				CHECK(renderModule(data, length, c, -1, true) == hash, "%s config %d: the AdLib thread changes the output", m->name, j);
+#endif
+		}
+
+		if (printHashes)
+		{
+			printf("\t{ 0x%016llxULL, 0x%016llxULL, 0x%016llxULL, 0x%016llxULL }, // %s\n",
+				(unsigned long long)hashes[0], (unsigned long long)hashes[1],
+				(unsigned long long)hashes[2], (unsigned long long)hashes[3], m->name);
+		}
+
+		free(data);
+	}
+
+	if (printHashes)
+		return 0;
+
+	return testResult("test_render");
+}
@@ -0,0 +1,229 @@
+/* 8bb: Stem render test. Dig_RenderStemsToWAV() has to write a WAV file for
+** every channel that the song plays on (and none for the others), and the
+** stems have to add up to the output of Dig_RenderToWAV() where that doesn't
+** clip. They don't add up exactly: every stem is rounded to 16 bits and the
+** mix is dithered, and the SB Pro mixer rounds the mix to 8 bits (and has a
+** small DC offset), so for SB Pro only the spread of the difference is
+** checked. Uses the test modules that end, as both functions render until
+** the song ends.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 1024
+#define NUM_STEMS 25
+#define WAV_HEADER_SIZE 44 // 8bb: as written by dig.c
+#define CLIP_LEVEL 32000
+#define CLIP_WINDOW 32 // 8bb: in frames, more than the sinc32 kernel
+#define SB_MAX_SPREAD 512 // 8bb: two 8-bit steps (the sinc kernels ring)
+#ifdef ST3_FIXEDPOINT
+#define STEM_ERROR 1.0 // 8bb: per stem, the fixed-point resampler truncates
+#else
+#define STEM_ERROR 0.5
+#endif
+
+static const char *moduleNames[3] = { "st_b", "mono_b", "adl_b" };
+static const int32_t cards[2] = { SOUNDCARD_SBPRO, SOUNDCARD_GUS };
+
+static const char stemNames[NUM_STEMS][3] =
+{
+	"L1","L2","L3","L4","L5","L6","L7","L8",
+	"R1","R2","R3","R4","R5","R6","R7","R8",
+	"A1","A2","A3","A4","A5","A6","A7","A8","A9"
+};
+
+static bool usedChannel(const testmodule_t *m, int32_t channel) // 8bb: see the channel settings in makeTestModule()
+{
+	if (channel >= 16)
+	{
+#ifdef ST3_NO_ADLIB
+		return false;
+#else
+		return m->adlib && channel < 16+4;
+#endif
+	}
+
+	const int32_t c = ((channel & 8) ? 1 : 0) + ((channel & 7) * 2);
+	return c < m->channels;
+}
+
+static int16_t *readWAV(const char *fileName, int32_t *numSamples) // 8bb: NULL if it doesn't exist
+{
+	FILE *f = fopen(fileName, "rb");
+	if (f == NULL)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	const long dataSize = ftell(f) - WAV_HEADER_SIZE;
+	fseek(f, WAV_HEADER_SIZE, SEEK_SET);
+
+	int16_t *data = (int16_t *)malloc((dataSize > 0) ? dataSize : 1);
+	if (data == NULL || dataSize < 0 || fread(data, 1, dataSize, f) != (size_t)dataSize)
+	{
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+	*numSamples = (int32_t)(dataSize / sizeof (int16_t));
+	return data;
+}
+
+static bool loadTestModule(const uint8_t *data, uint32_t length, int32_t card, int32_t quality)
+{
+	if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+		return false;
+
+	setTestMixingVolume(256);
+	if (!load_st3_from_ram(data, length, card))
+	{
+		closeMusic();
+		return false;
+	}
+
+	setInterpolationQuality(quality);
+	zplaysong(0);
+	return true;
+}
+
+static void testStems(const testmodule_t *m, const uint8_t *data, uint32_t length, int32_t card, int32_t quality, const char *dir)
+{
+	char fileName[1024];
+
+	snprintf(fileName, sizeof (fileName), "%s/mix.wav", dir);
+	CHECK(loadTestModule(data, length, card, quality), "%s card %d: couldn't load", m->name, card);
+	CHECK(Dig_RenderToWAV(RENDER_FREQ, RENDER_BLOCK, fileName), "%s card %d: Dig_RenderToWAV() failed", m->name, card);
+	closeMusic();
+
+	int32_t numSamples = 0;
+	int16_t *mix = readWAV(fileName, &numSamples);
+	remove(fileName);
+	CHECK(mix != NULL && numSamples > 0, "%s card %d: no mix output", m->name, card);
+	if (mix == NULL)
+		return;
+
+	char prefix[512];
+	snprintf(prefix, sizeof (prefix), "%s/stem", dir);
+	CHECK(loadTestModule(data, length, card, quality), "%s card %d: couldn't load", m->name, card);
+	CHECK(Dig_RenderStemsToWAV(RENDER_FREQ, RENDER_BLOCK, prefix), "%s card %d: Dig_RenderStemsToWAV() failed", m->name, card);
+	closeMusic();
+
+	int32_t *sum = (int32_t *)calloc(numSamples, sizeof (int32_t));
+	if (sum == NULL)
+	{
+		free(mix);
+		return;
+	}
+
+	int32_t numStems = 0;
+	for (int32_t i = 0; i < NUM_STEMS; i++)
+	{
+		snprintf(fileName, sizeof (fileName), "%s.%s.wav", prefix, stemNames[i]);
+
+		int32_t stemSamples = 0;
+		int16_t *stem = readWAV(fileName, &stemSamples);
+		remove(fileName);
+
+		CHECK((stem != NULL) == usedChannel(m, i), "%s card %d: stem %s %s", m->name, card, stemNames[i], (stem != NULL) ? "for an unused channel" : "missing");
+		if (stem == NULL)
+			continue;
+
+		CHECK(stemSamples == numSamples, "%s card %d: stem %s has %d samples, the mix %d", m->name, card, stemNames[i], stemSamples, numSamples);
+		for (int32_t j = 0; j < numSamples && j < stemSamples; j++)
+			sum[j] += stem[j];
+
+		numStems++;
+		free(stem);
+	}
+
+	// 8bb: the stems don't clip, so skip the output around clipping (the resampler smears it)
+	bool *clipped = (bool *)calloc(numSamples, sizeof (bool));
+	if (clipped == NULL)
+	{
+		free(sum);
+		free(mix);
+		return;
+	}
+
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		if (mix[i] < -CLIP_LEVEL || mix[i] > CLIP_LEVEL)
+		{
+			const int32_t start = (i > CLIP_WINDOW*2) ? (i - CLIP_WINDOW*2) : 0;
+			const int32_t end = (numSamples-i > CLIP_WINDOW*2) ? (i + CLIP_WINDOW*2) : numSamples;
+			for (int32_t j = start; j < end; j++)
+				clipped[j] = true;
+		}
+	}
+
+	int32_t minDiff = INT32_MAX, maxDiff = INT32_MIN, compared = 0;
+	for (int32_t i = 0; i < numSamples; i++)
+	{
+		if (clipped[i])
+			continue;
+
+		const int32_t diff = sum[i] - mix[i];
+		if (diff < minDiff) minDiff = diff;
+		if (diff > maxDiff) maxDiff = diff;
+		compared++;
+	}
+
+	CHECK(compared > numSamples/2, "%s card %d quality %d: only %d of %d samples don't clip", m->name, card, quality, compared, numSamples);
+
+	const double maxError = (numStems * STEM_ERROR) + 2.0; // 8bb: + the dithering of the mix
+	if (card == SOUNDCARD_SBPRO)
+		CHECK(maxDiff-minDiff <= SB_MAX_SPREAD, "%s card %d quality %d: stems - mix = %d..%d", m->name, card, quality, minDiff, maxDiff);
+	else
+		CHECK(minDiff >= -maxError && maxDiff <= maxError, "%s card %d quality %d: stems - mix = %d..%d (%d stems)", m->name, card, quality, minDiff, maxDiff, numStems);
+
+	free(clipped);
+	free(sum);
+	free(mix);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/st3stemsXXXXXX";
+	if (mkdtemp(dir) == NULL)
+	{
+		printf("couldn't create a temporary folder\n");
+		return 1;
+	}
+
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+		if (strcmp(m->name, moduleNames[0]) != 0 && strcmp(m->name, moduleNames[1]) != 0 && strcmp(m->name, moduleNames[2]) != 0)
+			continue;
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		CHECK(data != NULL, "%s: out of memory", m->name);
+		if (data == NULL)
+			continue;
+
+		for (int32_t j = 0; j < 2; j++)
+		{
+#ifdef ST3_NO_GUS
+			if (cards[j] == SOUNDCARD_GUS)
+				continue;
+#endif
+			testStems(m, data, length, cards[j], INTRP_SINC16, dir);
+			testStems(m, data, length, cards[j], INTRP_LINEAR, dir);
+		}
+
+		free(data);
+	}
+
+	rmdir(dir);
+	return testResult("test_stems");
+}
@@ -0,0 +1,205 @@
+/* 8bb: Channel meter/scope test. Turning the meters and scopes on must not
+** change the output, they have to show the channels that the song plays on
+** (and nothing on the others), and readChannelScope() on another thread
+** has to be safe while the scopes are turned on/off and the player is
+** closed (run with ASan, see make-tests.sh).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define RENDER_FREQ 48000
+#define RENDER_BLOCK 1024
+#define RENDER_SECONDS 10
+#define NUM_SCOPES 25
+#define TOGGLE_ROUNDS 200
+
+static bool loadTestModule(const uint8_t *data, uint32_t length, int32_t card)
+{
+	if (!initMusic(RENDER_FREQ, RENDER_BLOCK))
+		return false;
+
+	setTestMixingVolume(256);
+	if (!load_st3_from_ram(data, length, card))
+	{
+		closeMusic();
+		return false;
+	}
+
+	zplaysong(0);
+	return true;
+}
+
+static bool usedChannel(const testmodule_t *m, int32_t channel) // 8bb: see the channel settings in makeTestModule()
+{
+	if (channel >= 16)
+		return m->adlib && channel < 16+4;
+
+	const int32_t c = ((channel & 8) ? 1 : 0) + ((channel & 7) * 2);
+	return c < m->channels;
+}
+
+static void testMetersAndScopes(const testmodule_t *m, const uint8_t *data, uint32_t length, int32_t card)
+{
+	const int32_t totalFrames = RENDER_FREQ * RENDER_SECONDS;
+
+	int16_t *reference = (int16_t *)malloc(totalFrames * 2 * sizeof (int16_t));
+	if (reference == NULL)
+		return;
+
+	CHECK(loadTestModule(data, length, card), "%s card %d: couldn't load", m->name, card);
+	renderHash(RENDER_SECONDS, RENDER_BLOCK, reference);
+	closeMusic();
+
+	CHECK(loadTestModule(data, length, card), "%s card %d: couldn't load", m->name, card);
+	setChannelMeters(true);
+	CHECK(setChannelScopes(true, 0), "%s card %d: setChannelScopes() failed", m->name, card);
+
+	float peak[NUM_SCOPES];
+	int32_t scopeSamples[NUM_SCOPES], scopeNonZero[NUM_SCOPES];
+	memset(peak, 0, sizeof (peak));
+	memset(scopeSamples, 0, sizeof (scopeSamples));
+	memset(scopeNonZero, 0, sizeof (scopeNonZero));
+
+	int16_t buffer[RENDER_BLOCK * 2], scope[4096];
+	int32_t differingBlocks = 0;
+
+	for (int32_t n = 0; n < totalFrames; n += RENDER_BLOCK)
+	{
+		const int32_t frames = (totalFrames-n < RENDER_BLOCK) ? (totalFrames-n) : RENDER_BLOCK;
+
+		WAVRender_Flag = true;
+		musmixer(buffer, frames);
+		if (memcmp(buffer, &reference[n*2], frames * 2 * sizeof (int16_t)) != 0)
+			differingBlocks++;
+
+		st3_meters_t meters;
+		if (getChannelMeters(&meters))
+		{
+			for (int32_t i = 0; i < NUM_SCOPES; i++)
+			{
+				if (meters.peak[i] > peak[i])
+					peak[i] = meters.peak[i];
+			}
+		}
+
+		for (int32_t i = 0; i < NUM_SCOPES; i++)
+		{
+			const int32_t samples = readChannelScope(i, scope, 4096);
+			scopeSamples[i] += samples;
+			for (int32_t j = 0; j < samples; j++)
+			{
+				if (scope[j] != 0)
+					scopeNonZero[i]++;
+			}
+		}
+	}
+
+	closeMusic();
+	setChannelMeters(false);
+	free(reference);
+
+	CHECK(differingBlocks == 0, "%s card %d: %d blocks differ with the meters/scopes on", m->name, card, differingBlocks);
+
+	for (int32_t i = 0; i < NUM_SCOPES; i++)
+	{
+		if (usedChannel(m, i))
+		{
+			CHECK(peak[i] > 0.0f, "%s card %d: no meter level on channel %d", m->name, card, i);
+			CHECK(scopeNonZero[i] > 0, "%s card %d: empty scope on channel %d (%d samples)", m->name, card, i, scopeSamples[i]);
+		}
+		else
+		{
+			CHECK(peak[i] == 0.0f, "%s card %d: meter level %f on unused channel %d", m->name, card, peak[i], i);
+			CHECK(scopeNonZero[i] == 0, "%s card %d: scope samples on unused channel %d", m->name, card, i);
+		}
+	}
+}
+
+static int32_t readerQuit; // 8bb: atomic
+static int64_t samplesRead; // 8bb: only read after pthread_join()
+
+static void *scopeReader(void *arg)
+{
+	(void)arg;
+
+	int16_t scope[4096];
+	while (!ATOMIC_LOAD(readerQuit))
+	{
+		for (int32_t i = 0; i < NUM_SCOPES; i++)
+			samplesRead += readChannelScope(i, scope, 4096);
+	}
+
+	return NULL;
+}
+
+static void testScopeToggling(const testmodule_t *m, const uint8_t *data, uint32_t length)
+{
+	pthread_t thread;
+	ATOMIC_STORE(readerQuit, 0);
+	samplesRead = 0;
+	if (pthread_create(&thread, NULL, scopeReader, NULL) != 0)
+	{
+		CHECK(false, "couldn't start the reader thread");
+		return;
+	}
+
+	int16_t buffer[RENDER_BLOCK * 2];
+	for (int32_t i = 0; i < TOGGLE_ROUNDS; i++)
+	{
+		if (!loadTestModule(data, length, -1))
+		{
+			CHECK(false, "%s: couldn't load", m->name);
+			break;
+		}
+
+		CHECK(setChannelScopes(true, (i & 1) ? 0 : 8000), "%s: setChannelScopes() failed", m->name);
+		for (int32_t j = 0; j < 4; j++)
+		{
+			musmixer(buffer, RENDER_BLOCK);
+			if (j == 1)
+				setChannelScopes(false, 0);
+			else if (j == 2)
+				setChannelScopes(true, 0);
+		}
+
+		closeMusic(); // 8bb: turns the scopes off while the reader reads them
+	}
+
+	ATOMIC_STORE(readerQuit, 1);
+	pthread_join(thread, NULL);
+
+	CHECK(samplesRead > 0, "%s: the reader thread got no scope samples", m->name);
+}
+
+int main(void)
+{
+	for (int32_t i = 0; i < numTestModules; i++)
+	{
+		const testmodule_t *m = &testModules[i];
+		if (strcmp(m->name, "adl_a") != 0 && strcmp(m->name, "big") != 0)
+			continue;
+
+		uint32_t length;
+		uint8_t *data = makeTestModule(m, &length);
+		CHECK(data != NULL, "%s: out of memory", m->name);
+		if (data == NULL)
+			continue;
+
+		testMetersAndScopes(m, data, length, SOUNDCARD_SBPRO);
+#ifndef ST3_NO_GUS
+		testMetersAndScopes(m, data, length, SOUNDCARD_GUS);
+#endif
+		testScopeToggling(m, data, length);
+
+		free(data);
+	}
+
+	return testResult("test_taps");
+}
@@ -0,0 +1,375 @@
+// helpers for the tests (test module generator, render hash)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dig.h"
+#include "testutil.h"
+
+#define NUM_SAMPLES 6
+#define NUM_ADLIB_INS 3
+
+const testmodule_t testModules[] =
+{
+	// name      seed stereo adlib  flags cwtv    ffv chn pat ord uc  mm
+	{ "st_a",    1,   true,  false, 0,    0x1320, 2,  8,  4,  8,  16, 0x30 },
+	{ "st_b",    2,   true,  false, 16,   0x1320, 2,  8,  4,  8,  16, 0x30 },
+	{ "mono_a",  3,   false, false, 0,    0x1320, 2,  8,  4,  8,  16, 0x30 },
+	{ "mono_b",  4,   false, false, 8|1,  0x1320, 2,  8,  4,  8,  16, 0x30 },
+	{ "adl_a",   5,   true,  true,  0,    0x1320, 2,  8,  4,  8,  16, 0x30 },
+	{ "adl_b",   6,   false, true,  64,   0x1301, 2,  8,  4,  8,  16, 0x30 },
+	{ "big",     7,   true,  false, 8,    0x1320, 2,  16, 6,  12, 16, 0x30 },
+	{ "uc24",    8,   true,  false, 0,    0x1320, 2,  8,  4,  8,  24, 0x30 },
+	{ "uc32",    9,   true,  true,  0,    0x1320, 2,  12, 4,  8,  32, 0x30 },
+	{ "ffv1",    10,  true,  false, 0,    0x1320, 1,  8,  4,  8,  16, 0x01 },
+	{ "old",     11,  true,  true,  1|16, 0x1300, 2,  8,  4,  8,  16, 0x30 }
+};
+
+const int32_t numTestModules = sizeof (testModules) / sizeof (testModules[0]);
+
+int32_t testFailures;
+bool renderToWavFlag = true; // 8bb: no audio thread (see dig.h), normally defined by st3play
+
+static uint32_t randSeed;
+
+static uint32_t rnd(uint32_t range) // 8bb: xorshift32, 0..range-1
+{
+	randSeed ^= randSeed << 13;
+	randSeed ^= randSeed >> 17;
+	randSeed ^= randSeed << 5;
+	return randSeed % range;
+}
+
+static bool chance(int32_t percent)
+{
+	return (int32_t)rnd(100) < percent;
+}
+
+static void put16(uint8_t *p, uint32_t x)
+{
+	p[0] = x & 0xFF;
+	p[1] = (x >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t x)
+{
+	put16(p, x & 0xFFFF);
+	put16(p+2, x >> 16);
+}
+
+static uint32_t align16(uint32_t x)
+{
+	return (x + 15) & ~15U;
+}
+
+static uint32_t makePattern(const testmodule_t *m, const uint8_t *channels, uint8_t *out)
+{
+	static const uint8_t stSubCmds[13] = { 0x0,0x1,0x2,0x3,0x4,0x8,0xA,0xB,0xC,0xD,0xE,0xD,0xC };
+	const int32_t numIns = NUM_SAMPLES + (m->adlib ? NUM_ADLIB_INS : 0);
+
+	uint32_t n = 0;
+	for (int32_t row = 0; row < 64; row++)
+	{
+		for (int32_t c = 0; c < 32; c++)
+		{
+			if (channels[c] == 255 || chance(45))
+				continue;
+
+			const bool adlibChannel = channels[c] >= 16;
+			uint8_t cell[6], dat = (uint8_t)c;
+			int32_t cellLen = 0;
+
+			if (chance(60))
+			{
+				dat |= 32;
+
+				const int32_t r = rnd(100);
+				if (r < 8)
+					cell[cellLen++] = 254;
+				else if (r < 12)
+					cell[cellLen++] = 255;
+				else
+					cell[cellLen++] = (uint8_t)(((2 + rnd(5)) << 4) | rnd(12));
+
+				if (adlibChannel)
+				{
+					static const uint8_t adlibIns[5] = { 0, NUM_SAMPLES+1, NUM_SAMPLES+2, NUM_SAMPLES+3, 1 };
+					cell[cellLen++] = adlibIns[rnd(5)];
+				}
+				else
+				{
+					const int32_t ins = (int32_t)rnd(numIns + 3) - 2; // 8bb: some cells without instrument
+					cell[cellLen++] = (uint8_t)((ins < 0) ? 0 : ins);
+				}
+			}
+
+			if (chance(30))
+			{
+				dat |= 64;
+				cell[cellLen++] = (uint8_t)rnd(70);
+			}
+
+			if (chance(55))
+			{
+				dat |= 128;
+
+				int32_t cmd = 1 + rnd(26);
+				int32_t info = rnd(256);
+				if (cmd == 1) // Axx
+					info = 1 + rnd(8);
+				else if (cmd == 2) // 8bb: Bxx/Cxx are rare, else the song would end too soon
+					cmd = chance(5) ? 2 : 4;
+				else if (cmd == 3) // Cxx
+				{
+					if (chance(90))
+					{
+						cmd = 8;
+					}
+					else
+					{
+						const int32_t breakRow = rnd(64); // 8bb: the original replayer reads past the pattern on rows >63
+						info = ((breakRow / 10) << 4) | (breakRow % 10);
+					}
+				}
+				else if (cmd == 20) // Txx
+					info = 0x18 + rnd(0xFF-0x18);
+				else if (cmd == 19) // Sxx
+				{
+					const int32_t sub = stSubCmds[rnd(13)];
+					int32_t lo = rnd(16);
+					if (sub == 0xB || sub == 0xE)
+						lo = rnd(3);
+
+					info = (sub << 4) | lo;
+				}
+
+				if (cmd == 2)
+					info = chance(5) ? (int32_t)rnd(m->orders + 1) : 0;
+
+				if (chance(20))
+					info = 0;
+
+				cell[cellLen++] = (uint8_t)cmd;
+				cell[cellLen++] = (uint8_t)info;
+			}
+
+			out[n++] = dat;
+			memcpy(&out[n], cell, cellLen);
+			n += cellLen;
+		}
+
+		out[n++] = 0; // end of row
+	}
+
+	return n;
+}
+
+uint8_t *makeTestModule(const testmodule_t *m, uint32_t *length)
+{
+	uint32_t sampleLength[NUM_SAMPLES];
+	uint8_t patData[32 * 6 * 64 + 64];
+
+	randSeed = 0x9E3779B9 ^ (m->seed * 0x85EBCA6B);
+
+	const int32_t insNum = NUM_SAMPLES + (m->adlib ? NUM_ADLIB_INS : 0);
+	const int32_t ordNum = (m->orders + 2) & ~1; // 8bb: +1 for the end marker, rounded up to even
+	const int32_t patNum = m->patterns;
+
+	uint32_t maxLength = 0x60 + ordNum + (insNum * 2) + (patNum * 2) + 32 + 16;
+	maxLength += insNum * (0x50 + 16);
+	maxLength += patNum * (2 + sizeof (patData) + 16);
+
+	static const uint32_t lengths[4] = { 300, 1200, 5000, 12000 };
+	for (int32_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		sampleLength[i] = lengths[rnd(4)];
+		maxLength += sampleLength[i] + 16;
+	}
+
+	uint8_t *f = (uint8_t *)calloc(maxLength, 1);
+	if (f == NULL)
+		return NULL;
+
+	// channel settings (SB Pro L1,R1,L2,R2.. and AdLib A1..A4 after them)
+	uint8_t channels[32];
+	memset(channels, 255, sizeof (channels));
+	for (int32_t c = 0; c < m->channels; c++)
+		channels[c] = (uint8_t)(((c & 1) * 8) + (c >> 1));
+
+	if (m->adlib)
+	{
+		for (int32_t c = 0; c < 4; c++)
+			channels[m->channels+c] = (uint8_t)(16 + c);
+	}
+
+	// header
+	memcpy(f, "testmodule", 10);
+	f[0x1C] = 0x1A;
+	f[0x1D] = 16;
+	put16(&f[0x20], ordNum);
+	put16(&f[0x22], insNum);
+	put16(&f[0x24], patNum);
+	put16(&f[0x26], m->flags);
+	put16(&f[0x28], m->cwtv);
+	put16(&f[0x2A], m->ffv);
+	memcpy(&f[0x2C], "SCRM", 4);
+	f[0x30] = 64;
+	f[0x31] = (uint8_t)(3 + rnd(4));
+	f[0x32] = (uint8_t)(90 + rnd(111));
+	f[0x33] = (m->stereo ? 0x80 : 0) | m->masterMul;
+	f[0x34] = m->ultraClick;
+	f[0x35] = 252; // 8bb: channel pan table present
+	memcpy(&f[0x40], channels, 32);
+
+	uint32_t offs = 0x60;
+	for (int32_t i = 0; i < ordNum; i++)
+		f[offs++] = (i < m->orders) ? (uint8_t)rnd(patNum) : 255;
+
+	if (m->orders > 4 && chance(50))
+		f[0x60+3] = 254; // 8bb: a marker order
+
+	const uint32_t insPtrOffs = offs;
+	const uint32_t patPtrOffs = insPtrOffs + (insNum * 2);
+	offs = patPtrOffs + (patNum * 2);
+
+	for (int32_t i = 0; i < 32; i++)
+		f[offs++] = chance(50) ? (uint8_t)(32 | rnd(16)) : 0;
+
+	// instruments
+	uint32_t insOffs[NUM_SAMPLES+NUM_ADLIB_INS];
+	for (int32_t i = 0; i < insNum; i++)
+	{
+		offs = align16(offs);
+		insOffs[i] = offs;
+		put16(&f[insPtrOffs+(i*2)], offs >> 4);
+
+		uint8_t *h = &f[offs];
+		if (i < NUM_SAMPLES)
+		{
+			static const uint32_t c2spds[6] = { 8363, 8363, 16726, 4000, 22050, 44100 };
+
+			const uint32_t len = sampleLength[i];
+			uint32_t loopStart = 0, loopEnd = 0;
+
+			const bool loop = chance(60);
+			if (loop)
+			{
+				static const uint32_t shortLoops[3] = { 20, 64, 150 };
+
+				loopStart = chance(50) ? (len - shortLoops[rnd(3)]) : rnd(len / 2);
+				loopEnd = len;
+			}
+
+			h[0x00] = 1;
+			put32(&h[0x10], len);
+			put32(&h[0x14], loopStart);
+			put32(&h[0x18], loopEnd);
+			h[0x1C] = (uint8_t)(20 + rnd(45));
+			h[0x1F] = loop ? 1 : 0;
+			put32(&h[0x20], c2spds[rnd(6)]);
+			put16(&h[0x28], 1); // 8bb: GUS address (non-zero = in GUS RAM)
+			memcpy(&h[0x4C], "SCRS", 4);
+		}
+		else
+		{
+			static const uint32_t c2spds[3] = { 8363, 500, 9000 };
+
+			h[0x00] = 2;
+			for (int32_t j = 0; j < 11; j++)
+				h[0x10+j] = (uint8_t)rnd(256);
+
+			h[0x1C] = (uint8_t)(30 + rnd(34));
+			put32(&h[0x20], c2spds[rnd(3)]);
+			memcpy(&h[0x4C], "SCRI", 4);
+		}
+
+		sprintf((char *)&h[0x30], "instrum%d", i+1);
+		offs += 0x50;
+	}
+
+	// patterns
+	for (int32_t i = 0; i < patNum; i++)
+	{
+		const uint32_t patLen = makePattern(m, channels, patData);
+
+		offs = align16(offs);
+		put16(&f[patPtrOffs+(i*2)], offs >> 4);
+		put16(&f[offs], patLen + 2);
+		memcpy(&f[offs+2], patData, patLen);
+		offs += 2 + patLen;
+	}
+
+	// sample data (triangle waves, unsigned unless ffv=1)
+	for (int32_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		offs = align16(offs);
+
+		uint8_t *h = &f[insOffs[i]];
+		const uint32_t seg = offs >> 4;
+		h[0x0D] = (uint8_t)(seg >> 16);
+		put16(&h[0x0E], seg & 0xFFFF);
+
+		const int32_t step = (i + 1) * 3;
+		for (uint32_t j = 0; j < sampleLength[i]; j++)
+		{
+			int32_t x = (int32_t)((j * step) & 511);
+			x = (x < 256) ? (x - 128) : (383 - x);
+			f[offs++] = (uint8_t)(x + ((m->ffv == 1) ? 0 : 128));
+		}
+	}
+
+	*length = offs;
+	return f;
+}
+
+void setTestMixingVolume(int32_t volume)
+{
+#ifdef ST3_FIXEDPOINT
+	audio.mixingVol = volume;
+#else
+	audio.fMixingVol = volume / (256.0f / 32768.0f);
+#endif
+}
+
+uint64_t renderHash(int32_t seconds, int32_t bufferSize, int16_t *out)
+{
+	int16_t *buffer = (int16_t *)malloc(bufferSize * 2 * sizeof (int16_t));
+	if (buffer == NULL)
+		return 0;
+
+	uint64_t hash = 14695981039346656037ULL;
+
+	const int64_t totalFrames = (int64_t)audio.outputFreq * seconds;
+	for (int64_t n = 0; n < totalFrames; n += bufferSize)
+	{
+		const int32_t frames = (totalFrames-n < bufferSize) ? (int32_t)(totalFrames-n) : bufferSize;
+
+		WAVRender_Flag = true; // 8bb: keep going if the song ends
+		musmixer(buffer, frames);
+
+		const uint8_t *p = (const uint8_t *)buffer;
+		for (int32_t i = 0; i < frames * 2 * (int32_t)sizeof (int16_t); i++)
+		{
+			hash ^= p[i];
+			hash *= 1099511628211ULL;
+		}
+
+		if (out != NULL)
+			memcpy(&out[n*2], buffer, frames * 2 * sizeof (int16_t));
+	}
+
+	free(buffer);
+	return hash;
+}
+
+int32_t testResult(const char *testName)
+{
+	if (testFailures == 0)
+		printf("%s: OK\n", testName);
+	else
+		printf("%s: %d FAILED\n", testName, testFailures);
+
+	return (testFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* 8bb: Helpers for the tests in this folder. The test modules are generated
+** here from a fixed seed (random notes, instruments and effects), so that no
+** module files have to be shipped. Build and run everything with
+** make-tests.sh.
+*/
+
+typedef struct testmodule_t
+{
+	const char *name;
+	uint32_t seed;
+	bool stereo, adlib;
+	uint16_t flags, cwtv, ffv;
+	int32_t channels, patterns, orders;
+	uint8_t ultraClick, masterMul;
+} testmodule_t;
+
+extern const testmodule_t testModules[];
+extern const int32_t numTestModules;
+
+uint8_t *makeTestModule(const testmodule_t *m, uint32_t *length); // 8bb: free() the returned data
+
+void setTestMixingVolume(int32_t volume); // 8bb: 256 = normal, like st3play's -m switch
+
+/* 8bb: Renders seconds of the loaded song with musmixer() in blocks of
+** bufferSize, and returns the FNV-1a hash of the 16-bit output. out (can
+** be NULL) gets the samples (stereo, seconds*audio.outputFreq frames).
+*/
+uint64_t renderHash(int32_t seconds, int32_t bufferSize, int16_t *out);
+
+extern int32_t testFailures;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { testFailures++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+int32_t testResult(const char *testName); // 8bb: prints the result, returns the exit code